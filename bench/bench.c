@@ -0,0 +1,423 @@
+#include "pch.h"
+#include "renderer.h"
+#include "tagap.h"
+#include "tagap_entity.h"
+#include "jobs.h"
+
+/*
+ * bench.c
+ *
+ * Benchmark harness (built with 'make bench').  Loads a map, spawns extra
+ * entities and pooled projectiles, runs a fixed number of ticks (headless
+ * unless --gpu is given) and writes per-phase timings as JSON.  Per-tick
+ * phases are taken from the profiler zones (and, for per-entity code, its
+ * timers), so the numbers are the same code paths that the game runs.
+ */
+
+#ifdef PROFILE_DISABLE
+#  error "the benchmark needs the profiler; don't build it with PROFILE_DISABLE"
+#endif
+
+struct tagap g_state;
+
+enum bench_phase_id
+{
+    PHASE_PARSE,
+    PHASE_SPAWN,
+    PHASE_COLLISION,
+    PHASE_THINK,
+    PHASE_PARTICLES,
+    PHASE_RECORD,
+    PHASE_TICK,
+
+    PHASE_COUNT
+};
+
+static const char *PHASE_NAMES[] =
+{
+    [PHASE_PARSE]     = "parse",
+    [PHASE_SPAWN]     = "spawn",
+    [PHASE_COLLISION] = "collision",
+    [PHASE_THINK]     = "think",
+    [PHASE_PARTICLES] = "particles",
+    [PHASE_RECORD]    = "record",
+    [PHASE_TICK]      = "tick",
+};
+
+// Which profiler zones count towards each per-tick phase
+static const struct
+{
+    const char *zone;
+    enum bench_phase_id phase;
+} ZONE_PHASES[] =
+{
+    { "particles_update",              PHASE_PARTICLES },
+    { "vulkan_record_command_buffers", PHASE_RECORD },
+    { "level_update",                  PHASE_TICK },
+};
+
+// Which profiler timers count towards each per-tick phase
+static const enum bench_phase_id TIMER_PHASES[PROFILE_TIMER_COUNT] =
+{
+    [PROFILE_TIMER_COLLISION] = PHASE_COLLISION,
+    [PROFILE_TIMER_THINK]     = PHASE_THINK,
+};
+
+// Samples in microseconds
+static struct bench_phase
+{
+    f64 *samples;
+    u32 count, cap;
+} phases[PHASE_COUNT];
+
+struct bench_options
+{
+    const char *map_path;
+    const char *out_path;
+    u32 ticks;
+    u32 entities;
+    u32 projectiles;
+    u64 seed;
+    bool gpu;
+    bool gpu_cull;
+};
+
+static void
+bench_add_sample(enum bench_phase_id id, f64 us)
+{
+    struct bench_phase *p = &phases[id];
+    if (p->count == p->cap)
+    {
+        p->cap = p->cap ? p->cap * 2 : 256;
+        p->samples = realloc(p->samples, p->cap * sizeof(f64));
+    }
+    p->samples[p->count++] = us;
+}
+
+static void
+bench_sum_zone(const char *name, u64 start, u64 end, u32 tid, void *user)
+{
+    f64 *sums = user;
+    for (u32 i = 0; i < sizeof(ZONE_PHASES) / sizeof(ZONE_PHASES[0]); ++i)
+    {
+        if (strcmp(name, ZONE_PHASES[i].zone) == 0)
+        {
+            sums[ZONE_PHASES[i].phase] += (f64)(end - start) / 1000.0;
+            return;
+        }
+    }
+}
+
+static void
+bench_ignore_zone(const char *name, u64 start, u64 end, u32 tid, void *user)
+{
+}
+
+/* Random offset of up to +/- 'range' */
+static inline f32
+bench_jitter(f32 range)
+{
+    return ((f32)rng_int(&g_state.rng, 2001) / 1000.0f - 1.0f) * range;
+}
+
+/* Spawn copies of the map's (non-player) entities around the map */
+static u32
+bench_spawn_entities(u32 count)
+{
+    i32 source_count = g_map->entity_count;
+    u32 spawned = 0;
+    for (u32 i = 0; i < count && source_count; ++i)
+    {
+        struct tagap_entity *src = &g_map->entities[i % source_count];
+        if (src->info->think.mode == THINK_AI_USER) continue;
+
+        struct tagap_entity *e = level_add_entity(src->info);
+        if (!e) break;
+
+        u64 t = NOW_NS();
+        e->position = (vec2s)
+        {
+            src->position.x + bench_jitter(256.0f),
+            src->position.y,
+        };
+        e->flipped = src->flipped;
+        entity_spawn(e);
+        bench_add_sample(PHASE_SPAWN, (f64)(NOW_NS() - t) / 1000.0);
+        ++spawned;
+    }
+    return spawned;
+}
+
+/* Fire pooled projectiles in random directions around the player */
+static u32
+bench_spawn_projectiles(u32 count)
+{
+    // Get the entities that were pooled
+    struct tagap_entity_info *pooled[POOL_ID_COUNT];
+    u32 pooled_count = 0;
+    for (u32 i = 0; i < g_level->entity_info_count; ++i)
+    {
+        if (g_level->entity_infos[i].pool_id == POOL_ID_UNKNOWN) continue;
+        pooled[pooled_count++] = &g_level->entity_infos[i];
+    }
+
+    vec2s centre = g_map->player ?
+        g_map->player->position : (vec2s) { 0.0f, 0.0f };
+    u32 spawned = 0;
+    for (u32 i = 0; i < count && pooled_count; ++i)
+    {
+        u64 t = NOW_NS();
+        struct tagap_entity *e = entity_pool_get(pooled[i % pooled_count]);
+        if (!e) continue;
+        entity_reset(e,
+            (vec2s) { centre.x + bench_jitter(64.0f), centre.y + 32.0f },
+            (f32)rng_int(&g_state.rng, 360),
+            false);
+        bench_add_sample(PHASE_SPAWN, (f64)(NOW_NS() - t) / 1000.0);
+        ++spawned;
+    }
+    return spawned;
+}
+
+static int
+bench_compare(const void *a, const void *b)
+{
+    f64 x = *(const f64 *)a, y = *(const f64 *)b;
+    return (x > y) - (x < y);
+}
+
+static i32
+bench_write_json(
+    const struct bench_options *opts,
+    u32 entities,
+    u32 projectiles)
+{
+    FILE *fp = fopen(opts->out_path, "w");
+    if (!fp)
+    {
+        LOG_ERROR("[bench] failed to open '%s' for writing", opts->out_path);
+        return -1;
+    }
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "  \"map\": \"%s\",\n", opts->map_path);
+    fprintf(fp, "  \"ticks\": %u,\n", opts->ticks);
+    fprintf(fp, "  \"entities\": %u,\n", entities);
+    fprintf(fp, "  \"projectiles\": %u,\n", projectiles);
+    fprintf(fp, "  \"gpu\": %s,\n", opts->gpu ? "true" : "false");
+    fprintf(fp, "  \"phases\": {");
+    for (u32 i = 0; i < PHASE_COUNT; ++i)
+    {
+        struct bench_phase *p = &phases[i];
+        fprintf(fp, "%s\n    \"%s\": ", i ? "," : "", PHASE_NAMES[i]);
+        if (!p->count)
+        {
+            // e.g. command recording without a GPU
+            fprintf(fp, "null");
+            continue;
+        }
+
+        qsort(p->samples, p->count, sizeof(f64), bench_compare);
+        f64 total = 0.0;
+        for (u32 s = 0; s < p->count; ++s) total += p->samples[s];
+        u32 p99 = (u32)ceil(p->count * 0.99) - 1;
+
+        fprintf(fp,
+            "{ \"samples\": %u, \"median_us\": %.3f, \"p99_us\": %.3f, "
+            "\"mean_us\": %.3f, \"max_us\": %.3f }",
+            p->count,
+            p->samples[p->count / 2],
+            p->samples[p99],
+            total / p->count,
+            p->samples[p->count - 1]);
+    }
+    fprintf(fp, "\n  }\n}\n");
+    fclose(fp);
+
+    LOG_INFO("[bench] wrote results to '%s'", opts->out_path);
+    return 0;
+}
+
+static i32
+bench_parse_args(i32 argc, char **argv, struct bench_options *opts)
+{
+    const char *arg = NULL;
+    for (i32 i = 1; i < argc; ++i)
+    {
+        arg = argv[i];
+        const char *val = i + 1 < argc ? argv[i + 1] : NULL;
+        if (strcmp(arg, "--gpu") == 0)
+        {
+            opts->gpu = true;
+            continue;
+        }
+        if (strcmp(arg, "--gpu-cull") == 0)
+        {
+            opts->gpu = opts->gpu_cull = true;
+            continue;
+        }
+        if (!val) goto usage;
+
+        if (strcmp(arg, "--map") == 0)
+        {
+            opts->map_path = val;
+        }
+        else if (strcmp(arg, "--out") == 0)
+        {
+            opts->out_path = val;
+        }
+        else if (strcmp(arg, "--ticks") == 0)
+        {
+            opts->ticks = strtoul(val, NULL, 10);
+        }
+        else if (strcmp(arg, "--entities") == 0)
+        {
+            opts->entities = strtoul(val, NULL, 10);
+        }
+        else if (strcmp(arg, "--projectiles") == 0)
+        {
+            opts->projectiles = strtoul(val, NULL, 10);
+        }
+        else if (strcmp(arg, "--seed") == 0)
+        {
+            opts->seed = strtoull(val, NULL, 10);
+        }
+        else goto usage;
+        ++i;
+    }
+    if (strlen(opts->map_path) >= sizeof(g_state.l.map_path))
+    {
+        LOG_ERROR("[bench] map path '%s' is too long", opts->map_path);
+        return -1;
+    }
+    return 0;
+
+usage:
+    LOG_ERROR("[bench] bad option '%s'", arg);
+    LOG_INFO("usage: %s [--map PATH] [--ticks N] [--entities N] "
+        "[--projectiles N] [--seed N] [--out FILE] [--gpu | --gpu-cull]",
+        argv[0]);
+    return -1;
+}
+
+i32
+main(i32 argc, char **argv)
+{
+    struct bench_options opts =
+    {
+        .map_path = TAGAP_SCRIPT_DIR "/maps/Level_1-A.map",
+        .out_path = "bench.json",
+        .ticks = 2000,
+        .entities = 256,
+        .projectiles = 128,
+        .seed = 1,
+        .gpu = false,
+    };
+
+    setlocale(LC_NUMERIC, "");
+
+    memset(&g_state, 0, sizeof(struct tagap));
+    vulkan_renderer_init_state();
+    if (bench_parse_args(argc, argv, &opts) < 0) return -1;
+
+    g_vulkan->headless = !opts.gpu;
+    g_vulkan->gpu_driven = opts.gpu_cull;
+    rng_seed(&g_state.rng, opts.seed);
+    strcpy(g_state.l.map_path, opts.map_path);
+
+    i32 status = -1;
+    SDL_Window *win_handle = NULL;
+    level_init();
+    jobs_init();
+
+    if (opts.gpu)
+    {
+        if (SDL_Init(SDL_INIT_VIDEO) < 0)
+        {
+            LOG_ERROR("[bench] failed to initialise SDL");
+            goto done;
+        }
+        win_handle = SDL_CreateWindow("TAGAP Clone (benchmark)",
+            SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
+            WIDTH, HEIGHT,
+            SDL_WINDOW_VULKAN | SDL_WINDOW_SHOWN);
+        if (!win_handle)
+        {
+            LOG_ERROR("[bench] failed to create window");
+            goto done;
+        }
+    }
+    if (renderer_init(win_handle) < 0) goto done;
+
+    /*
+     * Load game scripts and the map
+     */
+    u64 t = NOW_NS();
+    if (tagap_script_run_dir(TAGAP_SCRIPT_DIR "/game") < 0) goto done;
+    bench_add_sample(PHASE_PARSE, (f64)(NOW_NS() - t) / 1000.0);
+
+    level_reset();
+    renderer_level_begin();
+    t = NOW_NS();
+    if (level_load(g_state.l.map_path) < 0) goto done;
+    bench_add_sample(PHASE_PARSE, (f64)(NOW_NS() - t) / 1000.0);
+
+    /*
+     * Spawn everything in
+     */
+    level_submit_to_renderer();
+    level_spawn_entities();
+    u32 entities = bench_spawn_entities(opts.entities);
+    u32 projectiles = bench_spawn_projectiles(opts.projectiles);
+    vulkan_level_end();
+    tagap_set_state(GAME_STATE_LEVEL);
+
+    /*
+     * Run the simulation
+     */
+    LOG_INFO("[bench] running %u ticks with %u extra entities and %u "
+        "projectiles", opts.ticks, entities, projectiles);
+
+    // Only want zones and timers from here onwards
+    u64 cursor = profile_read(0, bench_ignore_zone, NULL);
+    u64 timers[PROFILE_TIMER_COUNT];
+    profile_timers_take(timers);
+
+    g_state.dt = g_state.frame_dt = TICK_DT;
+    for (u32 tick = 0; tick < opts.ticks; ++tick)
+    {
+        renderer_begin_tick();
+        level_update();
+        ++g_state.tick;
+        g_state.sim_now = g_state.tick * NS_PER_SECOND / TICK_RATE;
+
+        // One frame per tick (only particles without a GPU)
+        if (opts.gpu) SDL_PumpEvents();
+        renderer_render(&g_state.cam_pos);
+
+        f64 sums[PHASE_COUNT] = { 0 };
+        cursor = profile_read(cursor, bench_sum_zone, sums);
+        profile_timers_take(timers);
+        for (u32 i = 0; i < PROFILE_TIMER_COUNT; ++i)
+        {
+            sums[TIMER_PHASES[i]] += (f64)timers[i] / 1000.0;
+        }
+        for (u32 i = PHASE_COLLISION; i < PHASE_COUNT; ++i)
+        {
+            if (i == PHASE_RECORD && !opts.gpu) continue;
+            bench_add_sample(i, sums[i]);
+        }
+    }
+
+    status = bench_write_json(&opts, entities, projectiles);
+
+done:
+    jobs_deinit();
+    level_deinit();
+    renderer_deinit();
+    if (win_handle) SDL_DestroyWindow(win_handle);
+    SDL_Quit();
+    for (u32 i = 0; i < PHASE_COUNT; ++i) free(phases[i].samples);
+
+    return status;
+}
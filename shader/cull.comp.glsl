@@ -0,0 +1,76 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(local_size_x = 64) in;
+
+// Object state (see struct gpu_renderable)
+struct Renderable
+{
+    vec4 pos_offset;
+    vec4 origin_rot;
+    vec4 size_scale_flip;
+    vec4 shading;
+    vec2 tex_offset;
+    int tex_index;
+    uint cull;
+    vec4 bounds;
+    uint index_count;
+    uint first_index;
+    int vertex_offset;
+    uint pad;
+};
+
+// Same as VkDrawIndexedIndirectCommand
+struct DrawCommand
+{
+    uint index_count;
+    uint instance_count;
+    uint first_index;
+    int vertex_offset;
+    uint first_instance;
+};
+
+layout(std430, binding = 0) readonly buffer Renderables
+{
+    Renderable objs[];
+};
+layout(std430, binding = 1) writeonly buffer DrawCommands
+{
+    DrawCommand cmds[];
+};
+
+// Push constants block
+layout(push_constant) uniform constants
+{
+    // Viewport bounds (Y up)
+    vec2 view_min;
+    vec2 view_max;
+    uint count;
+} pconsts;
+
+void main()
+{
+    uint i = gl_GlobalInvocationID.x;
+    if (i >= pconsts.count) return;
+
+    Renderable o = objs[i];
+
+    // Same test as vulkan_check_should_cull_obj
+    vec2 pos = vec2(o.pos_offset.x, -o.pos_offset.y);
+    vec2 o_min = pos + o.bounds.xy;
+    vec2 o_max = pos + o.bounds.zw;
+    bool visible = o.index_count != 0 && (o.cull == 0 ||
+        (o_min.x < pconsts.view_max.x &&
+         o_max.x > pconsts.view_min.x &&
+         o_min.y < pconsts.view_max.y &&
+         o_max.y > pconsts.view_min.y));
+
+    // Culled objects keep their slot with no instances, so the draw order
+    // stays the same
+    cmds[i] = DrawCommand(
+        o.index_count,
+        visible ? 1u : 0u,
+        o.first_index,
+        o.vertex_offset,
+        i);
+}
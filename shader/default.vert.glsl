@@ -8,11 +8,20 @@ layout(location = 0) out vec2 v_Texcoord;
 layout(location = 1) flat out int v_TexIndex;
 layout(location = 2) out vec4 v_Shading;
 
+// Per-frame uniforms (see struct frame_uniforms)
+layout(set = 0, binding = 2) uniform frame_uniforms
+{
+    // View-projection matrix
+    mat4 vp;
+} u_Frame;
+
 // Push constants block
 layout(push_constant) uniform constants
 {
-    // Model-view-projection matrix
-    mat4 mvp;
+    // Object transform (see struct transform_2d)
+    vec4 pos_offset;
+    vec4 origin_rot;
+    vec4 size_scale_flip;
 
     // Shading colour; note that we for unshaded things we set this to pure
     // white
@@ -27,8 +36,27 @@ layout(push_constant) uniform constants
 
 void main()
 {
+    float scale = pconsts.size_scale_flip.z;
+    float flip = pconsts.size_scale_flip.w;
+
+    // Place the object's vertices (or the unit quad)
+    vec3 p = vec3(
+        pconsts.origin_rot.xy + a_Position.xy * pconsts.size_scale_flip.xy,
+        pconsts.origin_rot.z + a_Position.z);
+
+    // Rotate, then flip (Y is always flipped) and scale
+    float r = radians(pconsts.origin_rot.w);
+    p.xy = vec2(
+        p.x * cos(r) - p.y * sin(r),
+        p.x * sin(r) + p.y * cos(r));
+    p.xy *= vec2(flip, -1.0) * scale;
+
+    // Move to object position
+    p.xy += pconsts.pos_offset.xy +
+        vec2(pconsts.pos_offset.z * flip, -pconsts.pos_offset.w);
+
+    gl_Position = u_Frame.vp * vec4(p, 1.0);
     v_Texcoord = a_Texcoord + pconsts.tex_offset;
-    gl_Position = pconsts.mvp * vec4(a_Position, 1.0);
     v_Shading = pconsts.shading;
     v_TexIndex = pconsts.tex_index;
 }
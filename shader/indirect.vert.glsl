@@ -0,0 +1,66 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec3 a_Position;
+layout(location = 1) in vec2 a_Texcoord;
+
+layout(location = 0) out vec2 v_Texcoord;
+layout(location = 1) flat out int v_TexIndex;
+layout(location = 2) out vec4 v_Shading;
+
+// Object state (see struct gpu_renderable)
+struct Renderable
+{
+    vec4 pos_offset;
+    vec4 origin_rot;
+    vec4 size_scale_flip;
+    vec4 shading;
+    vec2 tex_offset;
+    int tex_index;
+    uint cull;
+    vec4 bounds;
+    uint index_count;
+    uint first_index;
+    int vertex_offset;
+    uint pad;
+};
+
+layout(std430, set = 1, binding = 0) readonly buffer Renderables
+{
+    Renderable objs[];
+};
+
+// Per-frame uniforms (see struct frame_uniforms)
+layout(set = 0, binding = 2) uniform frame_uniforms
+{
+    // View-projection matrix
+    mat4 vp;
+} u_Frame;
+
+void main()
+{
+    // Each indirect draw's first instance is the index of its object
+    Renderable o = objs[gl_InstanceIndex];
+    float scale = o.size_scale_flip.z;
+    float flip = o.size_scale_flip.w;
+
+    // Place the quad (or the object's own vertices)
+    vec3 p = vec3(
+        o.origin_rot.xy + a_Position.xy * o.size_scale_flip.xy,
+        o.origin_rot.z + a_Position.z);
+
+    // Rotate, then flip (Y is always flipped) and scale
+    float r = radians(o.origin_rot.w);
+    p.xy = vec2(
+        p.x * cos(r) - p.y * sin(r),
+        p.x * sin(r) + p.y * cos(r));
+    p.xy *= vec2(flip, -1.0) * scale;
+
+    // Move to object position
+    p.xy += o.pos_offset.xy + vec2(o.pos_offset.z * flip, -o.pos_offset.w);
+
+    gl_Position = u_Frame.vp * vec4(p, 1.0);
+    v_Texcoord = a_Texcoord + o.tex_offset;
+    v_Shading = o.shading;
+    v_TexIndex = o.tex_index;
+}
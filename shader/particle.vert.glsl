@@ -9,12 +9,12 @@ layout(location = 0) out vec2 v_Texcoord;
 layout(location = 1) out vec4 v_VertexColour;
 layout(location = 2) flat out uint v_TexIndex;
 
-// Push constants block
-layout(push_constant) uniform constants
+// Per-frame uniforms (see struct frame_uniforms)
+layout(set = 0, binding = 2) uniform frame_uniforms
 {
-    // Model-view-projection matrix
-    mat4 mvp;
-} pconsts;
+    // View-projection matrix
+    mat4 vp;
+} u_Frame;
 
 // Embed the texture coordinates because we only use this shader for drawing
 // quads
@@ -29,7 +29,8 @@ const vec2 texcoords[4] = vec2[]
 void main()
 {
     v_Texcoord = texcoords[gl_VertexIndex % 4];
-    gl_Position = pconsts.mvp * vec4(a_Position, 0.0, 1.0);
+    // Y is flipped, as with every other object
+    gl_Position = u_Frame.vp * vec4(a_Position.x, -a_Position.y, 0.0, 1.0);
     v_VertexColour = a_VertexColour;
     v_TexIndex = a_TexIndex;
 }
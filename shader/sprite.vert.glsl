@@ -0,0 +1,50 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec3 a_Position;
+layout(location = 1) in vec2 a_Texcoord;
+
+// Per-instance attributes (see struct sprite_instance)
+layout(location = 2) in vec4 i_PosOffset;
+layout(location = 3) in vec4 i_OriginRot;
+layout(location = 4) in vec4 i_SizeScaleFlip;
+layout(location = 5) in vec4 i_Shading;
+layout(location = 6) in vec2 i_TexOffset;
+layout(location = 7) in int i_TexIndex;
+
+layout(location = 0) out vec2 v_Texcoord;
+layout(location = 1) flat out int v_TexIndex;
+layout(location = 2) out vec4 v_Shading;
+
+// Per-frame uniforms (see struct frame_uniforms)
+layout(set = 0, binding = 2) uniform frame_uniforms
+{
+    // View-projection matrix
+    mat4 vp;
+} u_Frame;
+
+void main()
+{
+    float scale = i_SizeScaleFlip.z;
+    float flip = i_SizeScaleFlip.w;
+
+    // Place the unit quad
+    vec3 p = vec3(
+        i_OriginRot.xy + a_Position.xy * i_SizeScaleFlip.xy,
+        i_OriginRot.z + a_Position.z);
+
+    // Rotate, then flip (Y is always flipped) and scale
+    float r = radians(i_OriginRot.w);
+    p.xy = vec2(
+        p.x * cos(r) - p.y * sin(r),
+        p.x * sin(r) + p.y * cos(r));
+    p.xy *= vec2(flip, -1.0) * scale;
+
+    // Move to object position
+    p.xy += i_PosOffset.xy + vec2(i_PosOffset.z * flip, -i_PosOffset.w);
+
+    gl_Position = u_Frame.vp * vec4(p, 1.0);
+    v_Texcoord = a_Texcoord + i_TexOffset;
+    v_Shading = i_Shading;
+    v_TexIndex = i_TexIndex;
+}
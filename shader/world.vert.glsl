@@ -0,0 +1,54 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(location = 0) in vec3 a_Position;
+layout(location = 1) in vec2 a_Texcoord;
+layout(location = 2) in int a_TexIndex;
+layout(location = 3) in float a_Shade;
+
+layout(location = 0) out vec2 v_Texcoord;
+layout(location = 1) flat out int v_TexIndex;
+layout(location = 2) out vec4 v_Shading;
+
+// Per-frame uniforms (see struct frame_uniforms)
+layout(set = 0, binding = 2) uniform frame_uniforms
+{
+    // View-projection matrix
+    mat4 vp;
+} u_Frame;
+
+// Push constants block
+layout(push_constant) uniform constants
+{
+    // Object transform (see struct transform_2d)
+    vec4 pos_offset;
+    vec4 origin_rot;
+    vec4 size_scale_flip;
+} pconsts;
+
+void main()
+{
+    float scale = pconsts.size_scale_flip.z;
+    float flip = pconsts.size_scale_flip.w;
+
+    // Place the object's vertices (or the unit quad)
+    vec3 p = vec3(
+        pconsts.origin_rot.xy + a_Position.xy * pconsts.size_scale_flip.xy,
+        pconsts.origin_rot.z + a_Position.z);
+
+    // Rotate, then flip (Y is always flipped) and scale
+    float r = radians(pconsts.origin_rot.w);
+    p.xy = vec2(
+        p.x * cos(r) - p.y * sin(r),
+        p.x * sin(r) + p.y * cos(r));
+    p.xy *= vec2(flip, -1.0) * scale;
+
+    // Move to object position
+    p.xy += pconsts.pos_offset.xy +
+        vec2(pconsts.pos_offset.z * flip, -pconsts.pos_offset.w);
+
+    gl_Position = u_Frame.vp * vec4(p, 1.0);
+    v_Texcoord = a_Texcoord;
+    v_Shading = vec4(a_Shade, a_Shade, a_Shade, 1.0);
+    v_TexIndex = a_TexIndex;
+}
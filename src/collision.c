@@ -5,6 +5,17 @@
 #include "tagap_linedef.h"
 #include "renderer.h"
 
+// Number of linedefs tested at once by the batch collision kernel
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define COLLISION_SIMD_WIDTH 8
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define COLLISION_SIMD_WIDTH 4
+#else
+#define COLLISION_SIMD_WIDTH 1
+#endif
+
 /* Get leftmost point */
 static inline vec2s
 get_lmost(vec2s a, vec2s b) { return a.x < b.x ? a : b; }
@@ -21,140 +32,751 @@ get_tmost(vec2s a, vec2s b) { return a.y < b.y ? a : b; }
 static inline vec2s
 get_bmost(vec2s a, vec2s b) { return a.y < b.y ? b : a; }
 
+/*
+ * Linedef broadphase grid.  Each cell holds a packed copy of the geometry of
+ * the linedefs whose bounds overlap it, in ascending linedef order, padded
+ * out to the SIMD width with entries that never collide.
+ */
+static struct collision_grid
+{
+    vec2s origin;
+    f32 cell_size;
+    i32 w, h;
+
+    // Offset of each cell's block in the arrays below (w * h + 1 entries)
+    u32 *cell_start;
+
+    // Packed linedef geometry, and the linedef index of each entry
+    struct tagap_linedef_geom block;
+    u32 *indices;
+} grid;
+
+/* Entity values used for checking against each linedef */
+struct collision_probe
+{
+    vec2s pos;
+    f32 velo_gradient;
+    f32 max_radius, radius_y;
+    f32 size_x;
+
+    // Extents derived from the above
+    f32 y_lo, y_hi;
+    f32 x_lo, x_hi;
+};
+
+static void collision_probe_init(struct tagap_entity *,
+    struct collision_probe *);
+static inline void collision_check_linedef(const struct collision_probe *,
+    struct collision_result *, u32);
+static void collision_check_brute(struct tagap_entity *,
+    struct collision_result *);
+static void collision_check_block(const struct collision_probe *,
+    u32, u32, struct collision_result *, u32 *);
+
+/* Get padded bounds of a linedef, as used for grid insertion */
+static inline void
+collision_linedef_bounds(u32 i, vec2s *bmin, vec2s *bmax)
+{
+    const struct tagap_linedef_geom *g = &g_map->linedef_geom;
+    bmin->x = g->x_min[i];
+    bmax->x = g->x_max[i];
+    bmin->y = g->y_min[i];
+    bmax->y = g->y_max[i];
+
+    // Y-position of sloped lines is evaluated as gradient * x + shift, which
+    // can round slightly outside of the line's actual Y range.  Pad the bounds
+    // well beyond that error so the grid never misses a line that the
+    // brute-force path would hit
+    f32 pad = 1.0f;
+    if (!(g->flags[i] & LINEDEF_GEOM_VERTICAL_BIT))
+    {
+        pad += 1e-4f * (fabsf(bmin->y) + fabsf(bmax->y) +
+            fabsf(g->gradient[i]) * (fabsf(bmin->x) + fabsf(bmax->x)));
+    }
+    bmin->y -= pad;
+    bmax->y += pad;
+}
+
+/* Get grid cell column/row of a coordinate, clamped to the grid */
+static inline i32
+collision_grid_cell(f32 v, f32 origin, i32 count)
+{
+    f32 c = floorf((v - origin) / grid.cell_size);
+    if (!(c >= 0.0f)) return 0;
+    if (c >= (f32)(count - 1)) return count - 1;
+    return (i32)c;
+}
+
+/*
+ * Precompute linedef geometry and build the linedef grid; should be called
+ * after the level is loaded, as linedefs don't change after that
+ */
 void
-collision_check(struct tagap_entity *e, struct collision_result *c)
+collision_level_build(void)
 {
-    // For all moving entities:
-    // Check collision with all linedefs in the level
+    collision_level_free();
+
+    if (g_map->linedef_count <= 0) return;
+
+    // Get bounds of all the linedefs
+    struct tagap_linedef_geom *g = &g_map->linedef_geom;
+    vec2s world_min = { INFINITY, INFINITY },
+          world_max = { -INFINITY, -INFINITY };
     for (u32 i = 0; i < g_map->linedef_count; ++i)
     {
         struct tagap_linedef *l = &g_map->linedefs[i];
+        vec2s lmost = get_lmost(l->start, l->end),
+              rmost = get_rmost(l->start, l->end);
+
+        g->x_min[i] = lmost.x;
+        g->x_max[i] = rmost.x;
+        g->y_min[i] = min(l->start.y, l->end.y);
+        g->y_max[i] = max(l->start.y, l->end.y);
+
+        g->flags[i] = 0;
+        if (l->style == LINEDEF_STYLE_FLOOR ||
+            l->style == LINEDEF_STYLE_PLATE_FLOOR)
+        {
+            g->flags[i] |= LINEDEF_GEOM_FLOOR_BIT;
+        }
+        if (l->style == LINEDEF_STYLE_CEILING ||
+            l->style == LINEDEF_STYLE_PLATE_CEILING)
+        {
+            g->flags[i] |= LINEDEF_GEOM_CEILING_BIT;
+        }
+
+        if (lmost.x == rmost.x)
+        {
+            g->flags[i] |= LINEDEF_GEOM_VERTICAL_BIT;
+            g->gradient[i] = g->shift[i] = 0.0f;
+        }
+        else
+        {
+            g->gradient[i] = (rmost.y - lmost.y) / (rmost.x - lmost.x);
+            g->shift[i] = lmost.y - g->gradient[i] * lmost.x;
+        }
+
+        world_min.x = min(world_min.x, g->x_min[i]);
+        world_min.y = min(world_min.y, g->y_min[i]);
+        world_max.x = max(world_max.x, g->x_max[i]);
+        world_max.y = max(world_max.y, g->y_max[i]);
+    }
+
+    // Grow the cells on very large maps so the grid stays a sane size
+    grid.origin = world_min;
+    grid.cell_size = max(COLLISION_GRID_CELL_SIZE,
+        max(world_max.x - world_min.x, world_max.y - world_min.y) /
+            (f32)COLLISION_GRID_MAX_DIM);
+    grid.w = (i32)((world_max.x - world_min.x) / grid.cell_size) + 1;
+    grid.h = (i32)((world_max.y - world_min.y) / grid.cell_size) + 1;
 
-        // These radii are really dodgey (not 100% sure how they should be
-        // handled), but seems to work alright for now
-        f32 max_radius = max(e->info->offsets[OFFSET_SIZE].x,
-            e->info->offsets[OFFSET_SIZE].y);
-        f32 radius_y = 0.0f;
-        //if (e->info->offsets[OFFSET_SIZE].y > 0.0f)
-        //{
-            // Note we deliberately use X here (works much better for player)
-            radius_y = e->info->offsets[OFFSET_SIZE].x;
-#if 0
+    u32 cell_count = grid.w * grid.h;
+    grid.cell_start = calloc(cell_count + 1, sizeof(u32));
+
+    // First pass counts the linedefs in each cell
+    vec2s bmin, bmax;
+    for (u32 i = 0; i < g_map->linedef_count; ++i)
+    {
+        collision_linedef_bounds(i, &bmin, &bmax);
+        i32 x0 = collision_grid_cell(bmin.x, grid.origin.x, grid.w),
+            x1 = collision_grid_cell(bmax.x, grid.origin.x, grid.w),
+            y0 = collision_grid_cell(bmin.y, grid.origin.y, grid.h),
+            y1 = collision_grid_cell(bmax.y, grid.origin.y, grid.h);
+        for (i32 y = y0; y <= y1; ++y)
+        for (i32 x = x0; x <= x1; ++x)
+        {
+            ++grid.cell_start[y * grid.w + x + 1];
         }
-        else if (e->info->sprite_count)
+    }
+    for (u32 c = 0; c < cell_count; ++c)
+    {
+        // Pad each block so the kernel never needs a scalar tail
+        u32 n = grid.cell_start[c + 1];
+        n = (n + COLLISION_SIMD_WIDTH - 1) / COLLISION_SIMD_WIDTH *
+            COLLISION_SIMD_WIDTH;
+        grid.cell_start[c + 1] = grid.cell_start[c] + n;
+    }
+
+    // Padding entries are left zeroed; having no style flags set, they can
+    // never collide
+    u32 entry_count = max(grid.cell_start[cell_count], 1u);
+    grid.block = (struct tagap_linedef_geom)
+    {
+        .x_min = calloc(entry_count, sizeof(f32)),
+        .x_max = calloc(entry_count, sizeof(f32)),
+        .y_min = calloc(entry_count, sizeof(f32)),
+        .y_max = calloc(entry_count, sizeof(f32)),
+        .gradient = calloc(entry_count, sizeof(f32)),
+        .shift = calloc(entry_count, sizeof(f32)),
+        .flags = calloc(entry_count, sizeof(u32)),
+    };
+    grid.indices = calloc(entry_count, sizeof(u32));
+
+    // Second pass fills the cells.  Linedefs are visited in order, so each
+    // cell's block ends up sorted
+    u32 *fill = malloc(cell_count * sizeof(u32));
+    memcpy(fill, grid.cell_start, cell_count * sizeof(u32));
+    for (u32 i = 0; i < g_map->linedef_count; ++i)
+    {
+        collision_linedef_bounds(i, &bmin, &bmax);
+        i32 x0 = collision_grid_cell(bmin.x, grid.origin.x, grid.w),
+            x1 = collision_grid_cell(bmax.x, grid.origin.x, grid.w),
+            y0 = collision_grid_cell(bmin.y, grid.origin.y, grid.h),
+            y1 = collision_grid_cell(bmax.y, grid.origin.y, grid.h);
+        for (i32 y = y0; y <= y1; ++y)
+        for (i32 x = x0; x <= x1; ++x)
         {
-            radius_y = e->info->offsets[OFFSET_SIZE].x;
-            //radius_y = g_vulkan->textures[e->sprites[0]->tex].h / 2.0f;
-            //radius_y = 1;
+            u32 j = fill[y * grid.w + x]++;
+            grid.block.x_min[j] = g->x_min[i];
+            grid.block.x_max[j] = g->x_max[i];
+            grid.block.y_min[j] = g->y_min[i];
+            grid.block.y_max[j] = g->y_max[i];
+            grid.block.gradient[j] = g->gradient[i];
+            grid.block.shift[j] = g->shift[i];
+            grid.block.flags[j] = g->flags[i];
+            grid.indices[j] = i;
         }
+    }
+    free(fill);
+
+    LOG_INFO("[collision] built %dx%d linedef grid (cell size %.0f, "
+        "%u entries)",
+        grid.w, grid.h, grid.cell_size, grid.cell_start[cell_count]);
+}
+
+void
+collision_level_free(void)
+{
+    free(grid.cell_start);
+    free(grid.block.x_min);
+    free(grid.block.x_max);
+    free(grid.block.y_min);
+    free(grid.block.y_max);
+    free(grid.block.gradient);
+    free(grid.block.shift);
+    free(grid.block.flags);
+    free(grid.indices);
+    memset(&grid, 0, sizeof(struct collision_grid));
+}
+
+void
+collision_check(struct tagap_entity *e, struct collision_result *c)
+{
+    PROFILE_TIMER(PROFILE_TIMER_COLLISION);
+
+    if (!grid.cell_start)
+    {
+        collision_check_brute(e, c);
+        return;
+    }
+
+#ifdef COLLISION_VERIFY
+    // Make sure that the grid gives the exact same result as brute-force
+    struct collision_result c_brute = *c;
+    collision_check_brute(e, &c_brute);
 #endif
 
-        vec2s lmost = get_lmost(l->start, l->end),
-              rmost = get_rmost(l->start, l->end);
+    struct collision_probe p;
+    collision_probe_init(e, &p);
+
+    // Only need the linedefs in cells that could possibly be in reach
+    f32 reach = max(fabsf(e->info->offsets[OFFSET_SIZE].x),
+        fabsf(e->info->offsets[OFFSET_SIZE].y));
+    i32 x0 = collision_grid_cell(p.pos.x - reach, grid.origin.x, grid.w),
+        x1 = collision_grid_cell(p.pos.x + reach, grid.origin.x, grid.w),
+        y0 = collision_grid_cell(p.pos.y - reach, grid.origin.y, grid.h),
+        y1 = collision_grid_cell(p.pos.y + reach, grid.origin.y, grid.h);
+
+    // Brute-force takes the first floor in linedef order.  Each cell is in
+    // order, so this is the lowest index of each cell's first floor
+    u32 floor_index = UINT32_MAX;
+    for (i32 y = y0; y <= y1; ++y)
+    for (i32 x = x0; x <= x1; ++x)
+    {
+        u32 cell = y * grid.w + x;
+        collision_check_block(&p,
+            grid.cell_start[cell],
+            grid.cell_start[cell + 1],
+            c, &floor_index);
+    }
+    if (!c->below && floor_index != UINT32_MAX)
+    {
+        c->below = true;
+        c->floor_gradient = g_map->linedef_geom.gradient[floor_index];
+        c->floor_linedef = floor_index;
+    }
+
+#ifdef COLLISION_VERIFY
+    if (memcmp(c, &c_brute, sizeof(struct collision_result)) != 0)
+    {
+        LOG_ERROR("[collision] grid result differs from brute-force "
+            "for '%s' at %.2f %.2f",
+            e->info->name, e->position.x, e->position.y);
+    }
+#endif
+}
+
+/* Check collision against every linedef in the level */
+static void
+collision_check_brute(struct tagap_entity *e, struct collision_result *c)
+{
+    struct collision_probe p;
+    collision_probe_init(e, &p);
+
+    for (u32 i = 0; i < g_map->linedef_count; ++i)
+    {
+        collision_check_linedef(&p, c, i);
+    }
+}
 
-        /*
-         * Horizontal line checks
-         */
+static void
+collision_probe_init(struct tagap_entity *e, struct collision_probe *p)
+{
+    p->pos = e->position;
+
+    // These radii are really dodgey (not 100% sure how they should be
+    // handled), but seems to work alright for now
+    p->max_radius = max(e->info->offsets[OFFSET_SIZE].x,
+        e->info->offsets[OFFSET_SIZE].y);
+    // Note we deliberately use X here (works much better for player)
+    p->radius_y = e->info->offsets[OFFSET_SIZE].x;
+    p->size_x = e->info->offsets[OFFSET_SIZE].x;
+
+    p->y_lo = p->pos.y - p->radius_y;
+    p->y_hi = p->pos.y + p->max_radius;
+    p->x_lo = p->pos.x - p->size_x;
+    p->x_hi = p->pos.x + p->size_x;
+
+    // Use gradient of velocity to see if we get a collision
+    // (allows us to come in from underneath floors)
+    if (e->velo.x != 0.0f)
+    {
+        p->velo_gradient = e->velo.y / fabs(e->velo.x);
+    }
+    else
+    {
+        p->velo_gradient = e->velo.y;
+    }
+}
+
+/* Check collision of entity against a single linedef */
+static inline void
+collision_check_linedef(
+    const struct collision_probe *p,
+    struct collision_result *c,
+    u32 i)
+{
+    const struct tagap_linedef_geom *g = &g_map->linedef_geom;
+    const u32 flags = g->flags[i];
+
+    /*
+     * Horizontal line checks
+     */
+    if (!(flags & LINEDEF_GEOM_VERTICAL_BIT))
+    {
         // Check that our position is in the range of the line
-        if (e->position.x >= lmost.x &&
-            e->position.x <= rmost.x)
+        if (p->pos.x < g->x_min[i] || p->pos.x > g->x_max[i]) return;
+
+        // Get Y-position of line at the entity's point
+        f32 y_line = g->gradient[i] * p->pos.x + g->shift[i];
+
+        /* Floor collision check */
+        if ((flags & LINEDEF_GEOM_FLOOR_BIT) &&
+            !c->below &&
+            p->velo_gradient <= g->gradient[i] &&
+            p->y_lo <= y_line &&
+            p->pos.y >= y_line)
         {
-            // Get Y-position of line at the entity's point
-            f32 gradient = (rmost.y - lmost.y) /
-                (rmost.x - lmost.x);
-            f32 shift = lmost.y - gradient * lmost.x;
-            f32 y_line = gradient * e->position.x + shift;
-
-            // Use gradient of velocity to see if we get a collision
-            // (allows us to come in from underneath floors)
-            f32 velo_gradient;
-            if (e->velo.x != 0.0f)
-            {
-                //LOG_DBUG("%.2f vs %.2f", e->velo.y / e->velo.x, gradient);
-                velo_gradient = e->velo.y / fabs(e->velo.x);
-            }
-            else
-            {
-                velo_gradient = e->velo.y;
-            }
+            c->below = true;
+            c->floor_gradient = g->gradient[i];
+            c->floor_linedef = i;
+            return;
+        }
+
+        /* Ceiling collision check */
+        if ((flags & LINEDEF_GEOM_CEILING_BIT) &&
+            !c->above &&
+            p->y_hi >= y_line &&
+            p->pos.y <= y_line)
+        {
+            c->above = true;
+        }
+        return;
+    }
+
+    /*
+     * Vertical line (wall) checks
+     */
+    // Make sure we are in a Y range capable of colliding with the line
+    if (p->pos.y > g->y_max[i] ||
+        p->y_hi < g->y_min[i])
+    {
+        return;
+    }
+
+    f32 line_x = g->x_min[i];
+
+    // Right-facing wall.  We check if the player is colliding from right
+    if ((flags & LINEDEF_GEOM_CEILING_BIT) &&
+        !c->left &&
+        p->x_lo < line_x &&
+        p->pos.x >= line_x)
+    {
+        c->left = true;
+        return;
+    }
 
-            /* Floor collision check */
-            if ((l->style == LINEDEF_STYLE_FLOOR ||
-                    l->style == LINEDEF_STYLE_PLATE_FLOOR) &&
-                !c->below &&
-                //e->velo.y <= 0.0f &&
-                velo_gradient <= gradient &&
-                e->position.y - radius_y <= y_line &&
-                e->position.y >= y_line)
+    // Left-facing wall.  We check if the player is colliding from left
+    if ((flags & LINEDEF_GEOM_FLOOR_BIT) &&
+        !c->right &&
+        p->x_hi > line_x &&
+        p->pos.x <= line_x)
+    {
+        c->right = true;
+    }
+}
+
+/*
+ * Batch collision kernel; tests the probe against grid entries [first, last)
+ * several at a time.  Each linedef can only produce one kind of collision
+ * (determined by its style and orientation), so the ceiling and wall flags
+ * are simply OR'd together.  The lowest index of any floor that was hit is
+ * written to floor_index, leaving it to the caller to apply it.
+ */
+#if COLLISION_SIMD_WIDTH == 8
+static void
+collision_check_block(
+    const struct collision_probe *p,
+    u32 first,
+    u32 last,
+    struct collision_result *c,
+    u32 *floor_index)
+{
+    const struct tagap_linedef_geom *g = &grid.block;
+    const __m256 px = _mm256_set1_ps(p->pos.x),
+                 py = _mm256_set1_ps(p->pos.y),
+                 vg = _mm256_set1_ps(p->velo_gradient),
+                 y_lo = _mm256_set1_ps(p->y_lo),
+                 y_hi = _mm256_set1_ps(p->y_hi),
+                 x_lo = _mm256_set1_ps(p->x_lo),
+                 x_hi = _mm256_set1_ps(p->x_hi);
+    const __m256i floor_bit = _mm256_set1_epi32(LINEDEF_GEOM_FLOOR_BIT),
+                  ceil_bit = _mm256_set1_epi32(LINEDEF_GEOM_CEILING_BIT),
+                  vert_bit = _mm256_set1_epi32(LINEDEF_GEOM_VERTICAL_BIT);
+
+    for (u32 j = first; j < last; j += 8)
+    {
+        __m256 x_min = _mm256_loadu_ps(&g->x_min[j]),
+               x_max = _mm256_loadu_ps(&g->x_max[j]),
+               grad = _mm256_loadu_ps(&g->gradient[j]),
+               shift = _mm256_loadu_ps(&g->shift[j]);
+        __m256i flags = _mm256_loadu_si256((const __m256i *)&g->flags[j]);
+        __m256 is_floor = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+                _mm256_and_si256(flags, floor_bit), floor_bit)),
+               is_ceil = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+                _mm256_and_si256(flags, ceil_bit), ceil_bit)),
+               is_vert = _mm256_castsi256_ps(_mm256_cmpeq_epi32(
+                _mm256_and_si256(flags, vert_bit), vert_bit));
+
+        // Horizontal lines
+        __m256 in_x = _mm256_andnot_ps(is_vert, _mm256_and_ps(
+            _mm256_cmp_ps(px, x_min, _CMP_GE_OQ),
+            _mm256_cmp_ps(px, x_max, _CMP_LE_OQ)));
+        __m256 y_line = _mm256_add_ps(_mm256_mul_ps(grad, px), shift);
+        __m256 hit_floor = _mm256_and_ps(_mm256_and_ps(in_x, is_floor),
+            _mm256_and_ps(_mm256_cmp_ps(vg, grad, _CMP_LE_OQ),
+                _mm256_and_ps(_mm256_cmp_ps(y_lo, y_line, _CMP_LE_OQ),
+                    _mm256_cmp_ps(py, y_line, _CMP_GE_OQ))));
+        __m256 hit_ceil = _mm256_and_ps(_mm256_and_ps(in_x, is_ceil),
+            _mm256_and_ps(_mm256_cmp_ps(y_hi, y_line, _CMP_GE_OQ),
+                _mm256_cmp_ps(py, y_line, _CMP_LE_OQ)));
+
+        // Vertical lines
+        __m256 in_y = _mm256_and_ps(is_vert, _mm256_and_ps(
+            _mm256_cmp_ps(py, _mm256_loadu_ps(&g->y_max[j]), _CMP_NGT_UQ),
+            _mm256_cmp_ps(y_hi, _mm256_loadu_ps(&g->y_min[j]),
+                _CMP_NLT_UQ)));
+        __m256 hit_left = _mm256_and_ps(_mm256_and_ps(in_y, is_ceil),
+            _mm256_and_ps(_mm256_cmp_ps(x_lo, x_min, _CMP_LT_OQ),
+                _mm256_cmp_ps(px, x_min, _CMP_GE_OQ)));
+        __m256 hit_right = _mm256_and_ps(_mm256_and_ps(in_y, is_floor),
+            _mm256_and_ps(_mm256_cmp_ps(x_hi, x_min, _CMP_GT_OQ),
+                _mm256_cmp_ps(px, x_min, _CMP_LE_OQ)));
+
+        i32 floor_mask = _mm256_movemask_ps(hit_floor);
+        if (floor_mask)
+        {
+            *floor_index = min(*floor_index,
+                grid.indices[j + __builtin_ctz(floor_mask)]);
+        }
+        c->above |= _mm256_movemask_ps(hit_ceil) != 0;
+        c->left |= _mm256_movemask_ps(hit_left) != 0;
+        c->right |= _mm256_movemask_ps(hit_right) != 0;
+    }
+}
+#elif COLLISION_SIMD_WIDTH == 4
+static void
+collision_check_block(
+    const struct collision_probe *p,
+    u32 first,
+    u32 last,
+    struct collision_result *c,
+    u32 *floor_index)
+{
+    const struct tagap_linedef_geom *g = &grid.block;
+    const __m128 px = _mm_set1_ps(p->pos.x),
+                 py = _mm_set1_ps(p->pos.y),
+                 vg = _mm_set1_ps(p->velo_gradient),
+                 y_lo = _mm_set1_ps(p->y_lo),
+                 y_hi = _mm_set1_ps(p->y_hi),
+                 x_lo = _mm_set1_ps(p->x_lo),
+                 x_hi = _mm_set1_ps(p->x_hi);
+    const __m128i floor_bit = _mm_set1_epi32(LINEDEF_GEOM_FLOOR_BIT),
+                  ceil_bit = _mm_set1_epi32(LINEDEF_GEOM_CEILING_BIT),
+                  vert_bit = _mm_set1_epi32(LINEDEF_GEOM_VERTICAL_BIT);
+
+    for (u32 j = first; j < last; j += 4)
+    {
+        __m128 x_min = _mm_loadu_ps(&g->x_min[j]),
+               x_max = _mm_loadu_ps(&g->x_max[j]),
+               grad = _mm_loadu_ps(&g->gradient[j]),
+               shift = _mm_loadu_ps(&g->shift[j]);
+        __m128i flags = _mm_loadu_si128((const __m128i *)&g->flags[j]);
+        __m128 is_floor = _mm_castsi128_ps(_mm_cmpeq_epi32(
+                _mm_and_si128(flags, floor_bit), floor_bit)),
+               is_ceil = _mm_castsi128_ps(_mm_cmpeq_epi32(
+                _mm_and_si128(flags, ceil_bit), ceil_bit)),
+               is_vert = _mm_castsi128_ps(_mm_cmpeq_epi32(
+                _mm_and_si128(flags, vert_bit), vert_bit));
+
+        // Horizontal lines
+        __m128 in_x = _mm_andnot_ps(is_vert, _mm_and_ps(
+            _mm_cmpge_ps(px, x_min),
+            _mm_cmple_ps(px, x_max)));
+        __m128 y_line = _mm_add_ps(_mm_mul_ps(grad, px), shift);
+        __m128 hit_floor = _mm_and_ps(_mm_and_ps(in_x, is_floor),
+            _mm_and_ps(_mm_cmple_ps(vg, grad),
+                _mm_and_ps(_mm_cmple_ps(y_lo, y_line),
+                    _mm_cmpge_ps(py, y_line))));
+        __m128 hit_ceil = _mm_and_ps(_mm_and_ps(in_x, is_ceil),
+            _mm_and_ps(_mm_cmpge_ps(y_hi, y_line),
+                _mm_cmple_ps(py, y_line)));
+
+        // Vertical lines
+        __m128 in_y = _mm_and_ps(is_vert, _mm_and_ps(
+            _mm_cmpngt_ps(py, _mm_loadu_ps(&g->y_max[j])),
+            _mm_cmpnlt_ps(y_hi, _mm_loadu_ps(&g->y_min[j]))));
+        __m128 hit_left = _mm_and_ps(_mm_and_ps(in_y, is_ceil),
+            _mm_and_ps(_mm_cmplt_ps(x_lo, x_min),
+                _mm_cmpge_ps(px, x_min)));
+        __m128 hit_right = _mm_and_ps(_mm_and_ps(in_y, is_floor),
+            _mm_and_ps(_mm_cmpgt_ps(x_hi, x_min),
+                _mm_cmple_ps(px, x_min)));
+
+        i32 floor_mask = _mm_movemask_ps(hit_floor);
+        if (floor_mask)
+        {
+            *floor_index = min(*floor_index,
+                grid.indices[j + __builtin_ctz(floor_mask)]);
+        }
+        c->above |= _mm_movemask_ps(hit_ceil) != 0;
+        c->left |= _mm_movemask_ps(hit_left) != 0;
+        c->right |= _mm_movemask_ps(hit_right) != 0;
+    }
+}
+#else
+static void
+collision_check_block(
+    const struct collision_probe *p,
+    u32 first,
+    u32 last,
+    struct collision_result *c,
+    u32 *floor_index)
+{
+    const struct tagap_linedef_geom *g = &grid.block;
+
+    for (u32 j = first; j < last; ++j)
+    {
+        const u32 flags = g->flags[j];
+
+        if (!(flags & LINEDEF_GEOM_VERTICAL_BIT))
+        {
+            if (p->pos.x < g->x_min[j] || p->pos.x > g->x_max[j]) continue;
+
+            f32 y_line = g->gradient[j] * p->pos.x + g->shift[j];
+            if ((flags & LINEDEF_GEOM_FLOOR_BIT) &&
+                p->velo_gradient <= g->gradient[j] &&
+                p->y_lo <= y_line &&
+                p->pos.y >= y_line)
             {
-                c->below = true;
-                c->floor_gradient = gradient;
-                c->floor_shift = shift;
-                continue;
+                *floor_index = min(*floor_index, grid.indices[j]);
             }
-
-            /* Ceiling collision check */
-            if ((l->style == LINEDEF_STYLE_CEILING ||
-                    l->style == LINEDEF_STYLE_PLATE_CEILING) &&
-                !c->above &&
-                e->position.y + max_radius >= y_line &&
-                e->position.y <= y_line)
+            if ((flags & LINEDEF_GEOM_CEILING_BIT) &&
+                p->y_hi >= y_line &&
+                p->pos.y <= y_line)
             {
                 c->above = true;
-                continue;
             }
+            continue;
         }
 
-        /*
-         * Vertical line (wall) checks
-         */
-        // Make sure that the lines we are looking are indeed vertical and that
-        // we are in a Y range capable of colling with them
-        if (!(lmost.x == rmost.x)) continue;
-        f32 line_y_max, line_y_min;
-        if (l->start.y < l->end.y)
+        if (p->pos.y > g->y_max[j] || p->y_hi < g->y_min[j]) continue;
+
+        if ((flags & LINEDEF_GEOM_CEILING_BIT) &&
+            p->x_lo < g->x_min[j] &&
+            p->pos.x >= g->x_min[j])
         {
-            line_y_max = l->end.y;
-            line_y_min = l->start.y;
+            c->left = true;
         }
-        else
+        if ((flags & LINEDEF_GEOM_FLOOR_BIT) &&
+            p->x_hi > g->x_min[j] &&
+            p->pos.x <= g->x_min[j])
         {
-            line_y_max = l->start.y;
-            line_y_min = l->end.y;
+            c->right = true;
         }
-        if (e->position.y > line_y_max ||
-            e->position.y + max_radius < line_y_min)
+    }
+}
+#endif
+
+/*
+ * Get intersection of segment from 'from' to 'from + ray' with a linedef, as
+ * a fraction along the segment.  Returns infinity if they don't intersect
+ */
+static inline f32
+collision_trace_linedef(vec2s from, vec2s ray, const struct tagap_linedef *l)
+{
+    vec2s s = { l->end.x - l->start.x, l->end.y - l->start.y };
+    f32 denom = ray.x * s.y - ray.y * s.x;
+    if (denom == 0.0f)
+    {
+        // Parallel
+        return INFINITY;
+    }
+
+    vec2s q = { l->start.x - from.x, l->start.y - from.y };
+    f32 t = (q.x * s.y - q.y * s.x) / denom,
+        u = (q.x * ray.y - q.y * ray.x) / denom;
+    if (t < 0.0f || t > 1.0f || u < 0.0f || u > 1.0f) return INFINITY;
+    return t;
+}
+
+/* Clip segment fraction range [t0, t1] against slab [lo, hi] on one axis */
+static inline bool
+collision_trace_clip(f32 from, f32 ray, f32 lo, f32 hi, f32 *t0, f32 *t1)
+{
+    if (ray == 0.0f) return from >= lo && from <= hi;
+
+    f32 ta = (lo - from) / ray,
+        tb = (hi - from) / ray;
+    *t0 = max(*t0, min(ta, tb));
+    *t1 = min(*t1, max(ta, tb));
+    return *t0 <= *t1;
+}
+
+/*
+ * Get nearest linedef hit along the segment from 'from' to 'from + ray', only
+ * visiting the grid cells that the segment crosses.  Returns the hit as a
+ * fraction along the segment, or infinity if nothing was hit
+ */
+static f32
+collision_trace_linedefs(vec2s from, vec2s ray)
+{
+    f32 best = INFINITY;
+    if (!grid.cell_start) return best;
+
+    // Clip the segment to the grid (all linedefs lie inside it)
+    f32 t0 = 0.0f, t1 = 1.0f;
+    if (!collision_trace_clip(from.x, ray.x,
+            grid.origin.x, grid.origin.x + grid.w * grid.cell_size,
+            &t0, &t1) ||
+        !collision_trace_clip(from.y, ray.y,
+            grid.origin.y, grid.origin.y + grid.h * grid.cell_size,
+            &t0, &t1))
+    {
+        return best;
+    }
+
+    // Set up the DDA walk from the cell that the clipped segment starts in
+    i32 cx = collision_grid_cell(from.x + ray.x * t0, grid.origin.x, grid.w),
+        cy = collision_grid_cell(from.y + ray.y * t0, grid.origin.y, grid.h);
+    i32 step_x = sign(ray.x), step_y = sign(ray.y);
+
+    // Fraction at which the segment crosses into the next column/row, and the
+    // fraction needed to cross a whole cell
+    f32 t_next_x = INFINITY, t_delta_x = INFINITY,
+        t_next_y = INFINITY, t_delta_y = INFINITY;
+    if (step_x)
+    {
+        f32 edge = grid.origin.x + (cx + (step_x > 0)) * grid.cell_size;
+        t_next_x = (edge - from.x) / ray.x;
+        t_delta_x = grid.cell_size / fabsf(ray.x);
+    }
+    if (step_y)
+    {
+        f32 edge = grid.origin.y + (cy + (step_y > 0)) * grid.cell_size;
+        t_next_y = (edge - from.y) / ray.y;
+        t_delta_y = grid.cell_size / fabsf(ray.y);
+    }
+
+    for (;;)
+    {
+        u32 cell = cy * grid.w + cx;
+        for (u32 j = grid.cell_start[cell]; j < grid.cell_start[cell + 1]; ++j)
         {
-            continue;
+            // Skips padding entries too
+            if (!(grid.block.flags[j] &
+                (LINEDEF_GEOM_FLOOR_BIT | LINEDEF_GEOM_CEILING_BIT)))
+            {
+                continue;
+            }
+
+            // Plates are thin platforms that can be jumped through, so let
+            // traces through them as well
+            struct tagap_linedef *l = &g_map->linedefs[grid.indices[j]];
+            if (l->style == LINEDEF_STYLE_PLATE_FLOOR ||
+                l->style == LINEDEF_STYLE_PLATE_CEILING)
+            {
+                continue;
+            }
+
+            best = min(best, collision_trace_linedef(from, ray, l));
         }
 
-        f32 line_x = lmost.x;
+        // Done once the nearest hit is within the cells already walked, or
+        // the segment ends in this cell
+        f32 t_exit = min(t_next_x, t_next_y);
+        if (best <= t_exit || t_exit > t1) break;
 
-        // Right-facing wall.  We check if the player is colliding from right
-        if ((l->style == LINEDEF_STYLE_CEILING ||
-                l->style == LINEDEF_STYLE_PLATE_CEILING) &&
-            !c->left &&
-            e->position.x - e->info->offsets[OFFSET_SIZE].x < line_x &&
-            e->position.x >= line_x)
+        if (t_next_x < t_next_y)
         {
-            c->left = true;
-            continue;
+            cx += step_x;
+            t_next_x += t_delta_x;
+            if (cx < 0 || cx >= grid.w) break;
         }
-
-        // Left-facing wall.  We check if the player is colliding from left
-        if ((l->style == LINEDEF_STYLE_FLOOR ||
-                l->style == LINEDEF_STYLE_PLATE_FLOOR) &&
-            !c->right &&
-            e->position.x + e->info->offsets[OFFSET_SIZE].x > line_x &&
-            e->position.x <= line_x)
+        else
         {
-            c->right = true;
-            continue;
+            cy += step_y;
+            t_next_y += t_delta_y;
+            if (cy < 0 || cy >= grid.h) break;
         }
     }
+    return best;
 }
 
-/* Perform 'trace' collision check */
+/*
+ * Only the level's own entities can be shot; temporary and pooled ones
+ * (effects, debris, projectiles) let traces through
+ */
+static bool
+collision_can_be_shot(const struct tagap_entity *e)
+{
+    return e >= g_map->entities && e < g_map->entities + g_map->entity_count;
+}
+
+/*
+ * Perform 'trace' collision check; gets the nearest hit against either the
+ * level linedefs or entities
+ */
 void
 collision_check_trace(
     struct tagap_entity *ignore_e,
@@ -163,21 +785,55 @@ collision_check_trace(
     f32 range,
     struct collision_trace_result *result)
 {
-    u32 i;
+    PROFILE_TIMER(PROFILE_TIMER_COLLISION);
+
     result->hit = false;
 
+    // Linedef hits are found as a fraction of the trace and scaled back up by
+    // the range, which would give NaN for an empty trace (which can't hit
+    // anything anyway)
+    if (!(range > 0.0f)) return;
+
     f32 tgrad = tanf(glm_rad(angle));
     f32 x_dir = (angle > 90.0f && angle < 270.0f) ? -1.0f : 1.0f;
+    vec2s dir = { cosf(glm_rad(angle)), sinf(glm_rad(angle)) };
+    vec2s ray = glms_vec2_scale(dir, range);
+
+    // Check for linedef collisions first; entities need to be closer than
+    // this to be hit
+    f32 best_dist = collision_trace_linedefs(from, ray) * range;
+    if (best_dist <= range)
+    {
+        result->hit = true;
+        result->point = glms_vec2_add(from,
+            glms_vec2_scale(dir, best_dist));
+    }
+
+    // Only entities in the box swept by the trace (plus the hit radius) can
+    // be hit
+    static const f32 radius_y = 96.0f;
+    f32 end_x = from.x + x_dir * range,
+        end_y = tgrad * (end_x - from.x) + from.y;
+    vec2s bmin =
+    {
+        min(from.x, end_x),
+        max(from.y - range, min(from.y, end_y) - radius_y),
+    };
+    vec2s bmax =
+    {
+        max(from.x, end_x),
+        min(from.y + range, max(from.y, end_y) + radius_y),
+    };
+    struct tagap_entity *nearby[COLLISION_TRACE_MAX_ENTITIES];
+    u32 count = entity_hash_query_aabb(bmin, bmax, collision_can_be_shot,
+        nearby, COLLISION_TRACE_MAX_ENTITIES);
 
     // Check for entity collisions
-    for (i = 0; i < g_map->entity_count; ++i)
+    for (u32 i = 0; i < count; ++i)
     {
-        struct tagap_entity *e = &g_map->entities[i];
-        if (!e->active) continue;
+        struct tagap_entity *e = nearby[i];
         if (e == ignore_e) continue;
 
-        f32 radius_x = 96.0f, radius_y = 96.0f;
-
         // Check range
         if (glms_vec2_distance2(from, e->position) > range * range) continue;
 
@@ -195,88 +851,21 @@ collision_check_trace(
 
         // Get trace line Y point at entity location
         f32 y_e = tgrad * (e->position.x - from.x) + from.y;
-        //LOG_DBUG("f:[%.2f %.2f] e:[%.2f %.2f] t:[%.2f %.2f] (%s)",
-        //    from.x, from.y,
-        //    e->position.x, e->position.y,
-        //    e->position.x, y_e,
-        //    e->info->name);
         if (y_e > e->position.y + radius_y ||
             y_e < e->position.y - radius_y)
         {
             continue;
         }
-        //LOG_DBUG("%.2f (%.2f)", y_e, e->position.y);
 
-        // Collided with entity
+        // Collided with entity; keep it if it's the nearest hit so far
         vec2s point;
         point.x = e->position.x;
         point.y = y_e;
-        result->point = point;
-        result->hit = true;
-        LOG_DBUG("%.2f %.2f COLLIDE (e) (%s)", point.x, point.y, e->info->name);
-        return;
-    }
-#if 0
-    vec2s lmost, rmost, tmost, bmost;
-
-    // Check collisions for all linedefs in the level
-    for (i = 0; i < g_map->linedef_count; ++i)
-    {
-        struct tagap_linedef *l = &g_map->linedefs[i];
-
-        lmost = get_lmost(l->start, l->end),
-        rmost = get_rmost(l->start, l->end),
-        tmost = get_tmost(l->start, l->end),
-        bmost = get_bmost(l->start, l->end);
-
-        // We need to get Y-position at each of the linedef's endpoint's, and
-        // check if they lie in the line's range
-
-        f32 lgrad = (rmost.y - lmost.y) / (rmost.x - lmost.x);
-        if (rmost.x == lmost.x)
-        {
-            // Verticel line
-            lgrad = 0.0f;
-        }
-        if (tgrad >= fabs(lgrad))
-        {
-            // Lines cannot intersect if the gradient is too large, as we only
-            // allow intersection from "above" the linedef (i.e. smaller
-            // and non-parallel gradient)
-            continue;
-        }
+        f32 dist = (point.x - from.x) * dir.x + (point.y - from.y) * dir.y;
+        if (dist >= best_dist) continue;
 
-        // y = m(x - x2) + y2
-        f32 y_l = tgrad * (from.x - lmost.x) + from.y,
-            y_r = tgrad * (from.x - rmost.x) + from.y;
-        f32 y_min = min(y_l, y_r),
-            y_max = min(y_l, y_r);
-
-        // Skip if the trace line does not lie within the linedef's range of
-        // Y-values
-        if (y_min < bmost.y || y_max > tmost.y)
-        {
-            continue;
-        }
-
-        // These lines should produce a collision.  Calculate collision point
-        result->hit = true;
-
-        // Find intersection of trace line and linedef equations
-        // mx + c = mx + c
-        // grad_t * x + from_y = grad_l * x + c_l
-        // grad_t * x - grad_l * x = c_l - from_y
-        // x = (c_l - from_y) / (grad_t - grad_l)
-
-        // c_linedef = y - mx
-        f32 c_linedef = lmost.y - lgrad * lmost.x;
-
-        vec2s point;
-        point.x = (c_linedef - from.y) / (tgrad - lgrad);
-        point.y = tgrad * point.x + from.y;
+        best_dist = dist;
         result->point = point;
-        LOG_DBUG("%.2f %.2f COLLIDE t:%.2f l:%.2f", point.x, point.y, tgrad, lgrad);
-        return;
+        result->hit = true;
     }
-#endif
 }
@@ -9,13 +9,26 @@ struct tagap_entity;
  * Collision detection code
  */
 
+// Size of linedef broadphase grid cells, and max cells along each axis
+#define COLLISION_GRID_CELL_SIZE 256.0f
+#define COLLISION_GRID_MAX_DIM 512
+
+// Define COLLISION_VERIFY to check every grid result against a brute-force
+// scan of all linedefs (slow; logs any differences)
+
+// Max entities considered by a single trace
+#define COLLISION_TRACE_MAX_ENTITIES 256
+
 struct collision_result
 {
     bool above;
     bool left;
     bool right;
     bool below;
-    f32 floor_gradient, floor_shift;
+    f32 floor_gradient;
+
+    // Index of the linedef we are standing on (if below is set)
+    i32 floor_linedef;
 };
 
 struct collision_trace_result
@@ -24,6 +37,8 @@ struct collision_trace_result
     vec2s point;
 };
 
+void collision_level_build(void);
+void collision_level_free(void);
 void collision_check(struct tagap_entity *, struct collision_result *);
 void collision_check_trace(struct tagap_entity *,
     vec2s, f32, f32, struct collision_trace_result *);
@@ -0,0 +1,179 @@
+#include "pch.h"
+#include "entity_hash.h"
+#include "tagap.h"
+#include "tagap_entity.h"
+
+// Each bucket is a linked list through the entities themselves
+static struct tagap_entity *buckets[ENTITY_HASH_BUCKET_COUNT];
+
+/* Get cell coordinate of a position */
+static inline i32
+entity_hash_cell(f32 v)
+{
+    f32 c = floorf(v / ENTITY_HASH_CELL_SIZE);
+    if (!(c > -ENTITY_HASH_MAX_CELL)) return -ENTITY_HASH_MAX_CELL;
+    if (c > ENTITY_HASH_MAX_CELL) return ENTITY_HASH_MAX_CELL;
+    return (i32)c;
+}
+
+static inline u32
+entity_hash_bucket(i32 x, i32 y)
+{
+    return (((u32)x * 73856093u) ^ ((u32)y * 19349663u)) &
+        (ENTITY_HASH_BUCKET_COUNT - 1);
+}
+
+static void
+entity_hash_remove(struct tagap_entity *e)
+{
+    if (e->hash.prev)
+    {
+        e->hash.prev->hash.next = e->hash.next;
+    }
+    else
+    {
+        buckets[entity_hash_bucket(e->hash.cell_x, e->hash.cell_y)] =
+            e->hash.next;
+    }
+    if (e->hash.next) e->hash.next->hash.prev = e->hash.prev;
+
+    e->hash.next = e->hash.prev = NULL;
+    e->hash.inserted = false;
+}
+
+static void
+entity_hash_insert(struct tagap_entity *e, i32 x, i32 y)
+{
+    struct tagap_entity **head = &buckets[entity_hash_bucket(x, y)];
+
+    e->hash.cell_x = x;
+    e->hash.cell_y = y;
+    e->hash.prev = NULL;
+    e->hash.next = *head;
+    if (*head) (*head)->hash.prev = e;
+    *head = e;
+    e->hash.inserted = true;
+}
+
+/*
+ * Forget all entities; used when the level is reset, as the entities are
+ * about to be thrown away
+ */
+void
+entity_hash_clear(void)
+{
+    memset(buckets, 0, sizeof(buckets));
+}
+
+/*
+ * Update the entity's place in the hash after it has moved or its activity
+ * changed.  Inactive entities are removed
+ */
+void
+entity_hash_update(struct tagap_entity *e)
+{
+    if (!e->active)
+    {
+        if (e->hash.inserted) entity_hash_remove(e);
+        return;
+    }
+
+    i32 x = entity_hash_cell(e->position.x),
+        y = entity_hash_cell(e->position.y);
+    if (e->hash.inserted)
+    {
+        // Nothing to do if we are still in the same cell
+        if (e->hash.cell_x == x && e->hash.cell_y == y) return;
+
+        entity_hash_remove(e);
+    }
+    entity_hash_insert(e, x, y);
+}
+
+/*
+ * Get active entities with positions inside of the given box that pass the
+ * filter.  Writes up to 'out_max' entities to 'out' and returns the count
+ */
+u32
+entity_hash_query_aabb(
+    vec2s bmin,
+    vec2s bmax,
+    entity_hash_filter filter,
+    struct tagap_entity **out,
+    u32 out_max)
+{
+    u32 count = 0;
+    i32 x0 = entity_hash_cell(bmin.x), x1 = entity_hash_cell(bmax.x),
+        y0 = entity_hash_cell(bmin.y), y1 = entity_hash_cell(bmax.y);
+
+    // Faster to just check every bucket if the box is huge
+    if ((i64)(x1 - x0 + 1) * (i64)(y1 - y0 + 1) > ENTITY_HASH_BUCKET_COUNT)
+    {
+        for (u32 b = 0; b < ENTITY_HASH_BUCKET_COUNT; ++b)
+        {
+            for (struct tagap_entity *e = buckets[b]; e; e = e->hash.next)
+            {
+                if (e->position.x < bmin.x || e->position.x > bmax.x ||
+                    e->position.y < bmin.y || e->position.y > bmax.y ||
+                    (filter && !filter(e)))
+                {
+                    continue;
+                }
+                if (count >= out_max) return count;
+                out[count++] = e;
+            }
+        }
+        return count;
+    }
+
+    for (i32 y = y0; y <= y1; ++y)
+    for (i32 x = x0; x <= x1; ++x)
+    {
+        for (struct tagap_entity *e = buckets[entity_hash_bucket(x, y)];
+            e;
+            e = e->hash.next)
+        {
+            // Other cells can share the bucket; only take entities in this
+            // one so that none are returned twice
+            if (e->hash.cell_x != x || e->hash.cell_y != y) continue;
+
+            if (e->position.x < bmin.x || e->position.x > bmax.x ||
+                e->position.y < bmin.y || e->position.y > bmax.y ||
+                (filter && !filter(e)))
+            {
+                continue;
+            }
+            if (count >= out_max) return count;
+            out[count++] = e;
+        }
+    }
+    return count;
+}
+
+/*
+ * Get active entities within radius of a point (same as above)
+ */
+u32
+entity_hash_query_radius(
+    vec2s centre,
+    f32 radius,
+    entity_hash_filter filter,
+    struct tagap_entity **out,
+    u32 out_max)
+{
+    u32 count = entity_hash_query_aabb(
+        (vec2s) { centre.x - radius, centre.y - radius },
+        (vec2s) { centre.x + radius, centre.y + radius },
+        filter, out, out_max);
+
+    // Remove the ones in the corners of the box
+    u32 kept = 0;
+    for (u32 i = 0; i < count; ++i)
+    {
+        if (glms_vec2_distance2(centre, out[i]->position) < radius * radius)
+        {
+            out[kept++] = out[i];
+        }
+    }
+    return kept;
+}
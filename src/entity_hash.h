@@ -0,0 +1,30 @@
+#ifndef ENTITY_HASH_H
+#define ENTITY_HASH_H
+
+struct tagap_entity;
+
+/*
+ * entity_hash.h
+ *
+ * Spatial hash of active entities, for proximity queries.  Entities are kept
+ * in it by calling entity_hash_update whenever they move or change activity.
+ */
+
+#define ENTITY_HASH_CELL_SIZE 128.0f
+#define ENTITY_HASH_BUCKET_COUNT 1024
+
+// Limits cell coordinates of entities that fly off into nowhere
+#define ENTITY_HASH_MAX_CELL 1000000
+
+// Decides whether a query returns an entity (NULL returns all of them).
+// Filtering in the query keeps unwanted entities from using up its output
+typedef bool (*entity_hash_filter)(const struct tagap_entity *);
+
+void entity_hash_clear(void);
+void entity_hash_update(struct tagap_entity *);
+u32 entity_hash_query_aabb(vec2s, vec2s, entity_hash_filter,
+    struct tagap_entity **, u32);
+u32 entity_hash_query_radius(vec2s, f32, entity_hash_filter,
+    struct tagap_entity **, u32);
+
+#endif
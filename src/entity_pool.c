@@ -1,6 +1,7 @@
 #include "pch.h"
 #include "entity_pool.h"
 #include "tagap.h"
+#include "intern.h"
 #include "tagap_entity.h"
 
 static struct entity_pool
@@ -35,22 +36,14 @@ entity_pool_init(void)
         if (pools[i].name[0] == '\0') continue;
 
         // Get the info of the entity that we want to pool
-        struct tagap_entity_info *info = NULL;
-        for (u32 e = 0; e < g_level->entity_info_count; ++e)
-        {
-            struct tagap_entity_info *ei = &g_level->entity_infos[e];
-            if (strcmp(ei->name, pools[i].name) == 0)
-            {
-                info = ei;
-                ei->pool_id = i;
-                break;
-            }
-        }
-        if (!info)
+        i32 index = intern_map_find(g_level->entity_names, pools[i].name);
+        if (index < 0)
         {
             LOG_WARN("[entity_pool] pool '%s' has no entities", pools[i].name);
             continue;
         }
+        struct tagap_entity_info *info = &g_level->entity_infos[index];
+        info->pool_id = i;
 
         pools[i].e = calloc(pools[i].limit, sizeof(struct tagap_entity));
 
@@ -86,6 +79,8 @@ entity_pool_deinit(void)
 void
 entity_pool_update(void)
 {
+    PROFILE_ZONE("entity_pool_update");
+
     for (u32 i = 1; i < POOL_ID_COUNT; ++i)
     {
         // Skip unused pools
@@ -10,9 +10,8 @@ struct tagap_entity_info;
  * explicitly specifying what entities we want to be pooled, the most obvious
  * example being weapon projectiles.
  *
- * TODO: instanced rendering for these sorts of things, e.g. for flames. Should
- *       be fairly straightforward once a particle system is implemented (which
- *       should definitely use batch rendering/instancing).
+ * Pooled entities' sprites are quads without depth testing, so the renderer
+ * draws them instanced (see SHADER_SPRITE), e.g. all flames in one call.
  */
 
 enum entity_pool_id
@@ -2,80 +2,97 @@
 #include "vulkan_renderer.h"
 #include "index_buffer.h"
 
-i32
-ib_new(struct ibuffer *ib, const void *indices, size_t size)
+// Shared buffer that all indices live in
+static struct
 {
-    memset(ib, 0, sizeof(struct ibuffer));
+    VkBuffer buf;
+    VmaAllocation alloc;
+    size_t size, used;
 
-    /*
-     * Create staging buffer for transfer of index data
-     */
-    //LOG_DBUG("[vulkan] creating staging buffer");
-    VkBuffer staging_buf;
-    VmaAllocation staging_buf_alloc;
-    if (vulkan_create_buffer(
-        (VkDeviceSize)size,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
-        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
-            VMA_ALLOCATION_CREATE_MAPPED_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        &staging_buf, &staging_buf_alloc) < 0)
-    {
-        LOG_ERROR("[ibuffer] failed to create staging buffer");
-        return -1;
-    }
+    // Where the current level's indices start
+    size_t mark;
+} heap;
 
-    /*
-     * Map index data into staging buffer
-     */
-    void *data;
-    vmaMapMemory(g_vulkan->vma, staging_buf_alloc, &data);
-    memcpy(data, indices, size);
-    vmaUnmapMemory(g_vulkan->vma, staging_buf_alloc);
+/* Create the shared index heap */
+i32
+ib_heap_init(size_t size)
+{
+    memset(&heap, 0, sizeof(heap));
+    if (g_vulkan->headless) return 0;
 
-    /*
-     * Create index buffer.
-     * We specify that it's used as destination of transfer, and as an index
-     * buffer
-     */
-    //LOG_DBUG("[vulkan] creating index buffer");
     if (vulkan_create_buffer(
         (VkDeviceSize)size,
         VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
         VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
         0,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        &ib->vk_buffer, &ib->vma_alloc) < 0)
+        &heap.buf, &heap.alloc) < 0)
     {
-        LOG_ERROR("[ibuffer] failed to create index buffer");
-        goto fail;
+        LOG_ERROR("[ibuffer] failed to create index heap");
+        return -1;
     }
+    heap.size = size;
+    return 0;
+}
 
-    // Copy staging buffer to index buffer
-    if (vulkan_copy_buffer(staging_buf, ib->vk_buffer, size) < 0)
+void
+ib_heap_deinit(void)
+{
+    if (g_vulkan->headless) return;
+    vmaDestroyBuffer(g_vulkan->vma, heap.buf, heap.alloc);
+    memset(&heap, 0, sizeof(heap));
+}
+
+/* Keep everything allocated so far when the heap is reset */
+void
+ib_heap_mark(void) { heap.mark = heap.used; }
+
+/* Free every index buffer allocated since the mark at once */
+void
+ib_heap_reset(void) { heap.used = heap.mark; }
+
+/* Buffer that the heap's indexs are in (for binding all of them at once) */
+VkBuffer
+ib_heap_buffer(void) { return heap.buf; }
+
+i32
+ib_new(struct ibuffer *ib, const void *indices, size_t size)
+{
+    memset(ib, 0, sizeof(struct ibuffer));
+
+    if (g_vulkan->headless)
     {
-        LOG_ERROR("[ibuffer] failed to copy staging buffer to index buffer");
-        goto fail;
+        // Still keep the counts so that objects look the same as usual
+        ib->size = size;
+        ib->index_count = size / sizeof(ib_type);
+        return 0;
     }
 
-    // Free the staging buffer as we no longer need it
-    vmaDestroyBuffer(g_vulkan->vma, staging_buf, staging_buf_alloc);
+    size_t offset = heap.used;
+    if (offset + size > heap.size)
+    {
+        LOG_ERROR("[ibuffer] index heap (%zu bytes) is full", heap.size);
+        return -1;
+    }
+
+    // Queue the index data to be copied in along with the rest of the batch
+    if (vulkan_upload_buffer(heap.buf, offset, indices, size) < 0)
+    {
+        LOG_ERROR("[ibuffer] failed to upload index data");
+        return -1;
+    }
+    heap.used = offset + size;
 
+    ib->vk_buffer = heap.buf;
     ib->size = size;
     ib->index_count = size / sizeof(ib_type);
-    ib->first_index = 0;
+    ib->first_index = offset / sizeof(ib_type);
 
     return 0;
-
-fail:
-    vmaDestroyBuffer(g_vulkan->vma, staging_buf, staging_buf_alloc);
-    return -1;
 }
 
 void
 ib_free(struct ibuffer *ib)
 {
-    vmaDestroyBuffer(g_vulkan->vma, ib->vk_buffer, ib->vma_alloc);
+    // Indices are only freed with the rest of the heap
 }
@@ -6,6 +6,10 @@
 typedef u16 ib_type;
 static const VkIndexType IB_VKTYPE = VK_INDEX_TYPE_UINT16;
 
+/*
+ * Index buffer.  Like vertices, indices are suballocated from one shared
+ * heap buffer
+ */
 struct ibuffer
 {
     // Vulkan index buffer and memory handles
@@ -18,6 +22,15 @@ struct ibuffer
     u32 first_index;
 };
 
+// Size of the shared heap that indices are allocated from
+#define IB_HEAP_SIZE (2 * 1024 * 1024)
+
+i32 ib_heap_init(size_t);
+void ib_heap_deinit(void);
+void ib_heap_mark(void);
+void ib_heap_reset(void);
+VkBuffer ib_heap_buffer(void);
+
 i32 ib_new(struct ibuffer *, const void *, size_t);
 void ib_free(struct ibuffer *);
 
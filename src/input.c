@@ -0,0 +1,192 @@
+#include "pch.h"
+#include "tagap.h"
+#include "input.h"
+
+struct input_file_header
+{
+    char magic[4];
+    u32 version;
+    u64 seed;
+    char map_path[sizeof(g_state.l.map_path)];
+};
+
+// Ticks with identical inputs are stored as a single run
+struct input_run
+{
+    u16 repeat;
+    struct input_state s;
+};
+
+static enum input_mode mode;
+static FILE *fp;
+
+// Latest inputs from the keyboard/mouse
+static struct input_state live;
+
+// Run currently being written/read
+static struct input_run run;
+
+static void
+input_flush_run(void)
+{
+    if (!run.repeat) return;
+    if (fwrite(&run, sizeof(struct input_run), 1, fp) != 1)
+    {
+        LOG_WARN("[input] failed to write to recording");
+    }
+    run.repeat = 0;
+}
+
+/*
+ * Set up the input source, and seed the game's RNG.  When replaying, the map
+ * path and seed are taken from the recording
+ */
+i32
+input_init(enum input_mode m, const char *path)
+{
+    mode = m;
+    memset(&live, 0, sizeof(struct input_state));
+    memset(&run, 0, sizeof(struct input_run));
+
+    struct input_file_header header;
+    memset(&header, 0, sizeof(struct input_file_header));
+
+    switch (mode)
+    {
+    case INPUT_MODE_LIVE:
+        rng_seed(&g_state.rng, NOW_NS());
+        return 0;
+
+    case INPUT_MODE_RECORD:
+        if (!(fp = fopen(path, "wb")))
+        {
+            LOG_ERROR("[input] failed to open '%s' for recording", path);
+            return -1;
+        }
+
+        memcpy(header.magic, INPUT_FILE_MAGIC, sizeof(header.magic));
+        header.version = INPUT_FILE_VERSION;
+        header.seed = NOW_NS();
+        strcpy(header.map_path, g_state.l.map_path);
+        if (fwrite(&header, sizeof(struct input_file_header), 1, fp) != 1)
+        {
+            LOG_ERROR("[input] failed to write recording header");
+            goto fail;
+        }
+        LOG_INFO("[input] recording inputs to '%s'", path);
+        break;
+
+    case INPUT_MODE_REPLAY:
+        if (!(fp = fopen(path, "rb")))
+        {
+            LOG_ERROR("[input] failed to open recording '%s'", path);
+            return -1;
+        }
+
+        if (fread(&header, sizeof(struct input_file_header), 1, fp) != 1 ||
+            memcmp(header.magic, INPUT_FILE_MAGIC, sizeof(header.magic)) != 0)
+        {
+            LOG_ERROR("[input] '%s' is not an input recording", path);
+            goto fail;
+        }
+        if (header.version != INPUT_FILE_VERSION)
+        {
+            LOG_ERROR("[input] recording '%s' has version %u (expected %u)",
+                path, header.version, INPUT_FILE_VERSION);
+            goto fail;
+        }
+        header.map_path[sizeof(header.map_path) - 1] = '\0';
+        strcpy(g_state.l.map_path, header.map_path);
+        LOG_INFO("[input] replaying inputs from '%s' on map '%s'",
+            path, header.map_path);
+        break;
+    }
+
+    rng_seed(&g_state.rng, header.seed);
+    return 0;
+
+fail:
+    fclose(fp);
+    fp = NULL;
+    return -1;
+}
+
+void
+input_deinit(void)
+{
+    if (!fp) return;
+    if (mode == INPUT_MODE_RECORD) input_flush_run();
+    fclose(fp);
+    fp = NULL;
+}
+
+/* Read current keyboard/mouse state */
+void
+input_sample(void)
+{
+    const u8 *kb = SDL_GetKeyboardState(NULL);
+    i32 mouse_x, mouse_y;
+    u32 m = SDL_GetMouseState(&mouse_x, &mouse_y);
+
+    u16 b = 0;
+    if (kb[SDL_SCANCODE_A]) b |= INPUT_LEFT_BIT;
+    if (kb[SDL_SCANCODE_D]) b |= INPUT_RIGHT_BIT;
+    if (kb[SDL_SCANCODE_S]) b |= INPUT_DOWN_BIT;
+    if (kb[SDL_SCANCODE_W]) b |= INPUT_UP_BIT;
+    if (m & SDL_BUTTON(1)) b |= INPUT_FIRE_BIT;
+    if (kb[SDL_SCANCODE_H]) b |= INPUT_DEBUG_LEFT_BIT;
+    if (kb[SDL_SCANCODE_J]) b |= INPUT_DEBUG_DOWN_BIT;
+    if (kb[SDL_SCANCODE_K]) b |= INPUT_DEBUG_UP_BIT;
+    if (kb[SDL_SCANCODE_L]) b |= INPUT_DEBUG_RIGHT_BIT;
+
+    live.buttons = b;
+    live.mouse_x = clamp(mouse_x, INT16_MIN, INT16_MAX);
+    live.mouse_y = clamp(mouse_y, INT16_MIN, INT16_MAX);
+}
+
+/* Scrolling is kept until a tick has seen it */
+void
+input_add_scroll(i32 amount)
+{
+    live.scroll = clamp(live.scroll + amount, INT16_MIN, INT16_MAX);
+}
+
+/*
+ * Get inputs for the next tick.  Returns -1 once a replay has run out of
+ * inputs
+ */
+i32
+input_tick(struct input_state *out)
+{
+    if (mode == INPUT_MODE_REPLAY)
+    {
+        if (!run.repeat &&
+            (fread(&run, sizeof(struct input_run), 1, fp) != 1 ||
+             !run.repeat))
+        {
+            LOG_INFO("[input] end of replay after %" PRIu64 " ticks",
+                g_state.tick);
+            return -1;
+        }
+        --run.repeat;
+        *out = run.s;
+        return 0;
+    }
+
+    *out = live;
+    live.scroll = 0;
+
+    if (mode == INPUT_MODE_RECORD)
+    {
+        // Start a new run if the inputs changed
+        if (run.repeat == UINT16_MAX ||
+            (run.repeat &&
+             memcmp(&run.s, out, sizeof(struct input_state)) != 0))
+        {
+            input_flush_run();
+        }
+        if (!run.repeat) run.s = *out;
+        ++run.repeat;
+    }
+    return 0;
+}
@@ -0,0 +1,58 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include "types.h"
+
+/*
+ * input.h
+ *
+ * Player inputs as seen by the game simulation.  Inputs are sampled once per
+ * tick, and can be recorded to a file together with the RNG seed so that a
+ * session can be replayed exactly (e.g. for benchmarking).
+ */
+
+#define INPUT_FILE_MAGIC "TGIR"
+#define INPUT_FILE_VERSION 1
+
+enum input_button_bit
+{
+    INPUT_LEFT_BIT = 1,
+    INPUT_RIGHT_BIT = 2,
+    INPUT_DOWN_BIT = 4,
+    INPUT_UP_BIT = 8,
+    INPUT_FIRE_BIT = 16,
+
+    // Debug movement controls
+    INPUT_DEBUG_LEFT_BIT = 32,
+    INPUT_DEBUG_DOWN_BIT = 64,
+    INPUT_DEBUG_UP_BIT = 128,
+    INPUT_DEBUG_RIGHT_BIT = 256,
+};
+
+enum input_mode
+{
+    // Inputs come from the keyboard/mouse
+    INPUT_MODE_LIVE,
+
+    // Same as live, but each tick is written to a file
+    INPUT_MODE_RECORD,
+
+    // Inputs are read from a recorded file
+    INPUT_MODE_REPLAY,
+};
+
+// Inputs for a single tick.  This is also the on-disk format
+struct input_state
+{
+    u16 buttons;
+    i16 scroll;
+    i16 mouse_x, mouse_y;
+};
+
+i32 input_init(enum input_mode, const char *);
+void input_deinit(void);
+void input_sample(void);
+void input_add_scroll(i32);
+i32 input_tick(struct input_state *);
+
+#endif
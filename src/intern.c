@@ -0,0 +1,79 @@
+#include "pch.h"
+#include "intern.h"
+
+struct intern_entry
+{
+    u32 hash;
+    u32 offset;
+};
+
+// Entry 0 is unused so that 0 can mean "no string"
+static struct intern_entry entries[INTERN_MAX];
+static u32 entry_count = 1;
+
+// Hash table of handles into the entry list
+static intern_id table[INTERN_TABLE_SIZE];
+
+static char pool[INTERN_POOL_SIZE];
+static u32 pool_used = 0;
+
+/*
+ * Find the table slot that holds the string, or the empty slot where it
+ * would go
+ */
+static inline u32
+intern_slot(const char *s, u32 hash)
+{
+    for (u32 i = hash;; ++i)
+    {
+        i &= INTERN_TABLE_SIZE - 1;
+        intern_id id = table[i];
+        if (!id) return i;
+        if (entries[id].hash == hash &&
+            strcmp(&pool[entries[id].offset], s) == 0)
+        {
+            return i;
+        }
+    }
+}
+
+/* Get handle of a string, interning it if it is new */
+intern_id
+intern(const char *s)
+{
+    u32 hash = hash_str(s);
+    u32 slot = intern_slot(s, hash);
+    if (table[slot]) return table[slot];
+
+    size_t len = strlen(s) + 1;
+    if (entry_count >= INTERN_MAX || pool_used + len > INTERN_POOL_SIZE)
+    {
+        LOG_ERROR("[intern] out of space interning '%s'", s);
+        return 0;
+    }
+
+    intern_id id = entry_count++;
+    entries[id] = (struct intern_entry)
+    {
+        .hash = hash,
+        .offset = pool_used,
+    };
+    memcpy(&pool[pool_used], s, len);
+    pool_used += len;
+
+    table[slot] = id;
+    return id;
+}
+
+/* Get handle of a string without interning it; 0 if it is not interned */
+intern_id
+intern_find(const char *s)
+{
+    return table[intern_slot(s, hash_str(s))];
+}
+
+const char *
+intern_str(intern_id id)
+{
+    return &pool[entries[id].offset];
+}
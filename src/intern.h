@@ -0,0 +1,55 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include "types.h"
+
+/*
+ * intern.h
+ *
+ * String interning.  Each distinct string is stored once and given a small
+ * integer handle, so that name registries (entities, themes, sprites) can map
+ * names to their entries with a single hash lookup.
+ */
+
+// Handle to an interned string; 0 is never a valid handle
+typedef u32 intern_id;
+
+// Maximum number of distinct strings
+#define INTERN_MAX 4096
+
+// Size of hash table (must be a power of two, and larger than INTERN_MAX)
+#define INTERN_TABLE_SIZE 8192
+
+// Bytes of storage for the strings themselves
+#define INTERN_POOL_SIZE (INTERN_MAX * 32)
+
+intern_id intern(const char *);
+intern_id intern_find(const char *);
+const char *intern_str(intern_id);
+
+/*
+ * Maps interned names to indices into a registry.  The first entry added for
+ * a name is kept, matching the old first-match linear searches
+ */
+struct intern_map
+{
+    // Index + 1 of the entry for each handle; 0 if there is none
+    i32 index[INTERN_MAX];
+};
+
+static inline void
+intern_map_add(struct intern_map *m, const char *name, i32 index)
+{
+    intern_id id = intern(name);
+    if (id && !m->index[id]) m->index[id] = index + 1;
+}
+
+// Returns index of entry with given name, or -1 if there is none
+static inline i32
+intern_map_find(const struct intern_map *m, const char *name)
+{
+    intern_id id = intern_find(name);
+    return id ? m->index[id] - 1 : -1;
+}
+
+#endif
@@ -0,0 +1,212 @@
+#include "pch.h"
+#include "jobs.h"
+
+#include <pthread.h>
+
+static pthread_t threads[JOBS_MAX_THREADS];
+static u32 thread_count = 0;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t wake = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done = PTHREAD_COND_INITIALIZER;
+static bool quit = false;
+
+// Jobs currently being run
+static struct
+{
+    job_func func;
+    void *user;
+    u32 count;
+
+    // Next job to take, and jobs not yet finished
+    u32 next, remaining;
+
+    // Bumped for each new batch so workers can tell it apart from the last
+    u64 gen;
+
+    // Workers currently looking at this batch
+    u32 active;
+} batch;
+
+// Queue of jobs that nobody waits on directly
+static struct
+{
+    job_func func;
+    u32 index;
+    void *user;
+} async_jobs[JOBS_ASYNC_MAX];
+static u32 async_head = 0, async_count = 0;
+
+// Queued plus running async jobs
+static u32 async_pending = 0;
+
+/* Take jobs from the batch until there are none left */
+static void
+jobs_run_batch(job_func func, void *user, u32 count)
+{
+    for (;;)
+    {
+        u32 i = __atomic_fetch_add(&batch.next, 1, __ATOMIC_RELAXED);
+        if (i >= count) break;
+
+        func(i, user);
+        if (__atomic_sub_fetch(&batch.remaining, 1, __ATOMIC_ACQ_REL) == 0)
+        {
+            pthread_mutex_lock(&lock);
+            pthread_cond_broadcast(&done);
+            pthread_mutex_unlock(&lock);
+        }
+    }
+}
+
+static void *
+jobs_worker(void *arg)
+{
+    u64 seen_gen = 0;
+    pthread_mutex_lock(&lock);
+    for (;;)
+    {
+        while (!quit && batch.gen == seen_gen && !async_count)
+        {
+            pthread_cond_wait(&wake, &lock);
+        }
+        if (quit) break;
+
+        // Batches come first, as the caller is blocked on them
+        if (batch.gen == seen_gen)
+        {
+            job_func func = async_jobs[async_head].func;
+            u32 index = async_jobs[async_head].index;
+            void *user = async_jobs[async_head].user;
+            async_head = (async_head + 1) % JOBS_ASYNC_MAX;
+            --async_count;
+            pthread_mutex_unlock(&lock);
+
+            func(index, user);
+
+            pthread_mutex_lock(&lock);
+            if (--async_pending == 0) pthread_cond_broadcast(&done);
+            continue;
+        }
+
+        seen_gen = batch.gen;
+        job_func func = batch.func;
+        void *user = batch.user;
+        u32 count = batch.count;
+        ++batch.active;
+        pthread_mutex_unlock(&lock);
+
+        jobs_run_batch(func, user, count);
+
+        pthread_mutex_lock(&lock);
+        if (--batch.active == 0) pthread_cond_broadcast(&done);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+/* Start the worker threads; one fewer than there are CPUs */
+void
+jobs_init(void)
+{
+    i64 cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    u32 want = (u32)clamp(cpus - 1, (i64)0, (i64)JOBS_MAX_THREADS);
+
+    quit = false;
+    for (thread_count = 0; thread_count < want; ++thread_count)
+    {
+        if (pthread_create(&threads[thread_count], NULL, jobs_worker, NULL))
+        {
+            LOG_WARN("[jobs] failed to create worker thread");
+            break;
+        }
+    }
+    LOG_INFO("[jobs] started %u worker threads", thread_count);
+}
+
+void
+jobs_deinit(void)
+{
+    jobs_wait();
+
+    pthread_mutex_lock(&lock);
+    quit = true;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+
+    for (u32 i = 0; i < thread_count; ++i) pthread_join(threads[i], NULL);
+    thread_count = 0;
+}
+
+/*
+ * Run func for each index in [0, count), spread over the workers and the
+ * calling thread.  Returns once all of them have finished
+ */
+void
+jobs_parallel_for(u32 count, job_func func, void *user)
+{
+    if (!count) return;
+    if (!thread_count)
+    {
+        for (u32 i = 0; i < count; ++i) func(i, user);
+        return;
+    }
+
+    // Workers that woke late for the last batch may still be holding it
+    pthread_mutex_lock(&lock);
+    while (batch.active) pthread_cond_wait(&done, &lock);
+
+    batch.func = func;
+    batch.user = user;
+    batch.count = count;
+    batch.next = 0;
+    batch.remaining = count;
+    ++batch.gen;
+    pthread_cond_broadcast(&wake);
+    pthread_mutex_unlock(&lock);
+
+    jobs_run_batch(func, user, count);
+
+    // Wait for the other jobs, and for the workers to let go of the batch
+    pthread_mutex_lock(&lock);
+    while (__atomic_load_n(&batch.remaining, __ATOMIC_ACQUIRE) ||
+        batch.active)
+    {
+        pthread_cond_wait(&done, &lock);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/*
+ * Queue func to be run with the given index on a worker, without waiting for
+ * it.  Runs it straight away if there are no workers (or the queue is full)
+ */
+void
+jobs_async(job_func func, u32 index, void *user)
+{
+    pthread_mutex_lock(&lock);
+    if (!thread_count || async_count == JOBS_ASYNC_MAX)
+    {
+        pthread_mutex_unlock(&lock);
+        func(index, user);
+        return;
+    }
+
+    u32 i = (async_head + async_count) % JOBS_ASYNC_MAX;
+    async_jobs[i].func = func;
+    async_jobs[i].index = index;
+    async_jobs[i].user = user;
+    ++async_count;
+    ++async_pending;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+/* Wait for all queued async jobs to finish */
+void
+jobs_wait(void)
+{
+    pthread_mutex_lock(&lock);
+    while (async_pending) pthread_cond_wait(&done, &lock);
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,29 @@
+#ifndef JOBS_H
+#define JOBS_H
+
+#include "types.h"
+
+/*
+ * jobs.h
+ *
+ * Pool of worker threads for splitting work into independent jobs.  If the
+ * pool has not been started, jobs simply run on the calling thread.  Jobs
+ * can either be run as a batch that the caller waits on (jobs_parallel_for),
+ * or queued to run in the background (jobs_async).
+ */
+
+#define JOBS_MAX_THREADS 15
+
+// Most background jobs that can be queued at once
+#define JOBS_ASYNC_MAX 256
+
+// Run for each job; given the job index
+typedef void (*job_func)(u32, void *);
+
+void jobs_init(void);
+void jobs_deinit(void);
+void jobs_parallel_for(u32, job_func, void *);
+void jobs_async(job_func, u32, void *);
+void jobs_wait(void);
+
+#endif
@@ -1,17 +1,26 @@
 #include "pch.h"
 #include "renderer.h"
 #include "tagap.h"
+#include "jobs.h"
 
 struct tagap g_state;
 
-static i32 foreach_in_dir(const char *, i32(*)(const char *));
+// Command-line options
+struct options
+{
+    const char *map_path;
+    enum input_mode input_mode;
+    const char *input_path;
+
+    // Number of frames to profile before quitting (0 to not quit)
+    u32 profile_frames;
+};
+
+static i32 parse_args(i32, char **, struct options *);
 
 i32
 main (i32 argc, char **argv)
 {
-    (void)argc;
-    (void)argv;
-
     setlocale(LC_NUMERIC, "");
 
     LOG_INFO("Starting TAGAP ...");
@@ -23,15 +32,35 @@ main (i32 argc, char **argv)
     memset(&g_state, 0, sizeof(struct tagap));
     g_state.type = GAME_STATE_BOOT;
     vulkan_renderer_init_state();
+
+    struct options opts =
+    {
+        //.map_path = TAGAP_SCRIPT_DIR "/maps/Level_1-Bb.map",
+        .map_path = TAGAP_SCRIPT_DIR "/maps/Level_1-A.map",
+        .input_mode = INPUT_MODE_LIVE,
+    };
+    if (parse_args(argc, argv, &opts) < 0) return -1;
+
+    // Note that replays replace the map path with the recorded one
+    strcpy(g_state.l.map_path, opts.map_path);
+    if (input_init(opts.input_mode, opts.input_path) < 0) return -1;
+
     if (sfx_init() < 0)
     {
         LOG_ERROR("[fatal] failed to initialise the sound engine");
     }
 
     level_init();
+    jobs_init();
 
-    //strcpy(g_state.l.map_path, TAGAP_SCRIPT_DIR "/maps/Level_1-Bb.map");
-    strcpy(g_state.l.map_path, TAGAP_SCRIPT_DIR "/maps/Level_1-A.map");
+    SDL_Window *win_handle = NULL;
+    if (g_vulkan->headless)
+    {
+        // No window or inputs at all
+        LOG_INFO("Running headless");
+        if (renderer_init(NULL) < 0) goto game_quit;
+        goto game_loop;
+    }
 
     // Set up SDL window
     if (SDL_Init(SDL_INIT_VIDEO) < 0)
@@ -39,7 +68,7 @@ main (i32 argc, char **argv)
         LOG_ERROR("[fatal] failed to initialise SDL");
         return -1;
     }
-    SDL_Window *win_handle = SDL_CreateWindow(
+    win_handle = SDL_CreateWindow(
         "TAGAP Clone",
         SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED,
         WIDTH, HEIGHT,
@@ -56,15 +85,32 @@ main (i32 argc, char **argv)
     // Initialise renderer
     if (renderer_init(win_handle) < 0) goto game_quit;
 
+game_loop:
     SDL_Event event;
-    for (;;)
+    for (u32 frame_count = 0;; ++frame_count)
     {
+#ifndef PROFILE_DISABLE
+        // Stop once enough frames have been captured
+        if (opts.profile_frames && frame_count == opts.profile_frames)
+        {
+            profile_dump(PROFILE_DUMP_PATH);
+            goto game_quit;
+        }
+#endif
+        PROFILE_ZONE("frame");
+
         g_state.now = NOW_NS();
         u64 frame_delta = g_state.now - g_state.last_frame;
         g_state.last_frame = g_state.now;
-        g_state.dt = (f64)frame_delta / NS_PER_SECOND;
+        g_state.frame_dt = (f64)frame_delta / NS_PER_SECOND;
 
-        g_state.mouse_scroll = 0;
+        if (g_vulkan->headless)
+        {
+            // Nothing to wait on, so run exactly one tick per loop, as fast
+            // as we can
+            g_state.frame_dt = TICK_DT;
+            goto game_update;
+        }
 
         // Poll inputs
         static bool buttons[4] = { 0, 0, 0, 0 };
@@ -81,6 +127,9 @@ main (i32 argc, char **argv)
                 case SDLK_j: buttons[1] = 1; break;
                 case SDLK_k: buttons[2] = 1; break;
                 case SDLK_l: buttons[3] = 1; break;
+#ifndef PROFILE_DISABLE
+                case SDLK_F12: profile_dump(PROFILE_DUMP_PATH); break;
+#endif
                 default: break;
                 }
             } break;
@@ -97,9 +146,10 @@ main (i32 argc, char **argv)
             } break;
 
             // Mouse scrollwheel
+            // (kept until a tick has seen it)
             case SDL_MOUSEWHEEL:
             {
-                g_state.mouse_scroll = event.wheel.y;
+                input_add_scroll(event.wheel.y);
             } break;
 
             case SDL_QUIT:
@@ -121,12 +171,16 @@ main (i32 argc, char **argv)
             case 3: cam_add.x += v * CAM_MOVE_SPEED; break;
             }
         }
-        g_state.cam_pos = glms_vec3_add(g_state.cam_pos, cam_add);
+        if (opts.input_mode == INPUT_MODE_LIVE)
+        {
+            // (isn't recorded, and would throw off the aim in replays)
+            g_state.cam_pos = glms_vec3_add(g_state.cam_pos, cam_add);
+        }
 
         // Get inputs
-        g_state.kb_state = SDL_GetKeyboardState(NULL);
-        g_state.m_state = SDL_GetMouseState(&g_state.mouse_x, &g_state.mouse_y);
+        input_sample();
 
+game_update:
         // Main state machine loop
         switch (g_state.type)
         {
@@ -135,7 +189,7 @@ main (i32 argc, char **argv)
             LOG_INFO("Running boot state ...");
 
             // Load the main game scripts
-            foreach_in_dir(TAGAP_SCRIPT_DIR "/game", tagap_script_run);
+            tagap_script_run_dir(TAGAP_SCRIPT_DIR "/game");
 
             // Boot to menu state
             // TODO...
@@ -149,7 +203,7 @@ main (i32 argc, char **argv)
         case GAME_STATE_LEVEL_LOAD:
             // Reset current level state
             level_reset();
-            vulkan_level_begin();
+            renderer_level_begin();
 
             // Load the level that is in the current level state
             if (level_load(g_state.l.map_path) < 0)
@@ -174,11 +228,43 @@ main (i32 argc, char **argv)
                 // Don't update on first frame because the deltatime is still
                 // out of whack
                 first_frame = false;
+                g_state.cam_pos_prev = g_state.cam_pos;
+                renderer_begin_tick();
                 break;
             }
 
-            // Update the level
-            level_update();
+            // Run as many fixed ticks as fit in the time that has passed
+            g_state.tick_accum += g_state.frame_dt;
+            g_state.dt = TICK_DT;
+            for (u32 ticks = 0; g_state.tick_accum >= TICK_DT; ++ticks)
+            {
+                if (ticks == MAX_TICKS_PER_FRAME)
+                {
+                    // Too far behind to catch up; just drop the time
+                    g_state.tick_accum = 0.0;
+                    break;
+                }
+
+                // Keep previous state around to interpolate from
+                g_state.cam_pos_prev = g_state.cam_pos;
+                renderer_begin_tick();
+
+                // Get this tick's inputs (stops once a replay is finished)
+                if (input_tick(&g_state.input) < 0) goto game_quit;
+
+                // Update the level
+                level_update();
+
+                g_state.tick_accum -= TICK_DT;
+                ++g_state.tick;
+                g_state.sim_now = g_state.tick * NS_PER_SECOND / TICK_RATE;
+            }
+            if (g_state.max_ticks && g_state.tick >= g_state.max_ticks)
+            {
+                LOG_INFO("Ran %" PRIu64 " ticks, quitting", g_state.tick);
+                goto game_quit;
+            }
+            g_state.tick_alpha = (f32)(g_state.tick_accum / TICK_DT);
 
             // Update status line
             if (g_state.now - g_state.last_sec > NS_PER_SECOND)
@@ -186,8 +272,8 @@ main (i32 argc, char **argv)
                 g_state.last_sec = g_state.now;
                 printf("status: %d fps, %.3f delta, %d draw cmds %d tex %d tmpe"
                     "    \r",
-                    (i32)floor(1.0d / g_state.dt),
-                    g_state.dt,
+                    (i32)floor(1.0d / g_state.frame_dt),
+                    g_state.frame_dt,
                     g_state.draw_calls,
                     g_vulkan->tex_used,
                     g_map->tmp_entity_count);
@@ -201,11 +287,19 @@ main (i32 argc, char **argv)
         // Render this frame
         if (g_state.type == GAME_STATE_LEVEL)
         {
-            renderer_render(&g_state.cam_pos);
+            // Draw between the last two ticks so movement is smooth
+            // regardless of framerate
+            vec3s cam_pos = glms_vec3_lerp(
+                g_state.cam_pos_prev,
+                g_state.cam_pos,
+                g_state.tick_alpha);
+            renderer_render(&cam_pos);
         }
     }
 game_quit:
 
+    input_deinit();
+    jobs_deinit();
     level_deinit();
     sfx_deinit();
     renderer_deinit();
@@ -217,37 +311,62 @@ game_quit:
     return 0;
 }
 
+/* Handle command-line options */
 static i32
-foreach_in_dir(const char *path, i32(*func)(const char *))
+parse_args(i32 argc, char **argv, struct options *opts)
 {
-    struct dirent *dp;
-    DIR *dfd;
-
-    if (!(dfd = opendir(path)))
-    {
-        LOG_ERROR("[foreach_in_dir] cannot open directory '%s'", path);
-        return -1;
-    }
-
-    char filename[512];
-    for (; (dp = readdir(dfd)) != NULL;)
+    for (i32 i = 1; i < argc; ++i)
     {
-        struct stat stbuf;
-        sprintf(filename, "%s/%s", path, dp->d_name);
-        if (stat(filename, &stbuf) == -1)
+        if (strcmp(argv[i], "--headless") == 0)
         {
-            LOG_WARN("[foreach_in_dir] cannot stat file '%s'", filename);
-            continue;
+            // Simulate without a window or GPU
+            g_vulkan->headless = true;
         }
-
-        if ((stbuf.st_mode & S_IFMT) == S_IFDIR)
+        else if (strcmp(argv[i], "--gpu-cull") == 0)
         {
-            // Skip directories
-            continue;
+            // Cull and draw objects from a compute pass
+            g_vulkan->gpu_driven = true;
+        }
+        else if (strcmp(argv[i], "--ticks") == 0 && i + 1 < argc)
+        {
+            // Quit after running this many ticks
+            g_state.max_ticks = strtoull(argv[++i], NULL, 10);
+        }
+        else if (strcmp(argv[i], "--map") == 0 && i + 1 < argc)
+        {
+            opts->map_path = argv[++i];
+            if (strlen(opts->map_path) >= sizeof(g_state.l.map_path))
+            {
+                LOG_ERROR("map path '%s' is too long", opts->map_path);
+                return -1;
+            }
+        }
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+        {
+            // Save inputs to a file to replay later
+            opts->input_mode = INPUT_MODE_RECORD;
+            opts->input_path = argv[++i];
+        }
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+        {
+            opts->input_mode = INPUT_MODE_REPLAY;
+            opts->input_path = argv[++i];
+        }
+#ifndef PROFILE_DISABLE
+        else if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc)
+        {
+            // Dump a trace of the first N frames, then quit
+            opts->profile_frames = strtoul(argv[++i], NULL, 10);
+        }
+#endif
+        else
+        {
+            LOG_ERROR("unknown option '%s'", argv[i]);
+            LOG_INFO("usage: %s [--headless] [--gpu-cull] [--ticks N] "
+                "[--map PATH] [--record FILE | --replay FILE] [--profile N]",
+                argv[0]);
+            return -1;
         }
-
-        // Run function on file
-        func(filename);
     }
     return 0;
 }
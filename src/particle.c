@@ -39,7 +39,9 @@ particles_init(void)
     // Render from top down
     g_parts->index = MAX_PARTICLES - 1;
 
-    g_parts->frame_count = g_vulkan->swapchain->image_count;
+    // There are no frames to draw without a swapchain
+    g_parts->frame_count = g_vulkan->headless ?
+        0 : g_vulkan->swapchain->image_count;
     g_parts->frames =
         malloc(sizeof(struct particle_frame) * g_parts->frame_count);
 
@@ -65,7 +67,12 @@ particles_init(void)
         indices[i + 5] = 0 + offset;
         offset += 4;
     }
-    ib_new(&g_parts->ib, indices, INDICES_SIZE);
+    if (ib_new(&g_parts->ib, indices, INDICES_SIZE) < 0)
+    {
+        // Particles aren't drawn without it
+        LOG_ERROR("[particle] failed to create index buffer");
+        g_parts->ib.index_count = 0;
+    }
     free(indices);
 
     const size_t vertices_size = MAX_PARTICLES * sizeof(struct quad_ptl);
@@ -100,6 +107,8 @@ particles_deinit(void)
 void
 particles_update(void)
 {
+    PROFILE_ZONE("particles_update");
+
     // Update all particle states
     for (u32 i = 0; i < MAX_PARTICLES; ++i)
     {
@@ -175,13 +184,15 @@ particles_update(void)
             p->old_diff_sgn_init = true;
         }
 
-        p->life_remain -= DT;
+        // Particles are purely visual so are updated every frame rather
+        // than every tick
+        p->life_remain -= g_state.frame_dt;
         f32 life_norm = 1.0f - (p->life_remain / p->props.lifetime);
 
         // Update position, rotation, etc.
         p->props.pos =
-            glms_vec2_add(p->props.pos, glms_vec2_scale(p->velo, DT));
-        p->props.rot += p->props.rot_speed * DT;
+            glms_vec2_add(p->props.pos, glms_vec2_scale(p->velo, g_state.frame_dt));
+        p->props.rot += p->props.rot_speed * g_state.frame_dt;
 
         // Linearly interpolate properties
         p->props.size_x.now =
@@ -203,11 +214,14 @@ particles_update(void)
 void
 particles_update_frame(u32 frame_index)
 {
+    PROFILE_ZONE("particles_update_frame");
+
     struct particle_frame *frame = &g_parts->frames[frame_index];
 
     /* Begin render batch */
     frame->quad_ptr = (struct quad_ptl *)frame->quad_buffer;
     frame->index_count = 0;
+    if (!g_parts->ib.index_count) return;
 
     for (u32 i = 0; i < MAX_PARTICLES; ++i)
     {
@@ -252,24 +266,17 @@ particles_update_frame(u32 frame_index)
                 p->props.tex_index
             },
         };
-        mat4s model = glms_scale(glms_rotate_z(
-        glms_translate((mat4s)GLMS_MAT4_IDENTITY_INIT, (vec3s)
-        {
-            p->props.pos.x,
-            p->props.pos.y,
-            0.0f,
-        }), glm_rad(p->props.rot)), (vec3s)
-        {
-            p->props.size_x.now,
-            p->props.size_y.now,
-            0.0f,
-        });
-        vec4s tmp;
+        // Scale and rotate the quad, then move it to the particle
+        f32 c = cosf(glm_rad(p->props.rot)), sn = sinf(glm_rad(p->props.rot));
         for (u32 v = 0; v < 4; ++v)
         {
-            tmp = (vec4s){ vertices[v].pos.x, vertices[v].pos.y, 0.0f, 1.0f };
-            tmp = glms_mat4_mulv(model, tmp);
-            vertices[v].pos = (vec2s){ tmp.x, tmp.y };
+            f32 x = vertices[v].pos.x * p->props.size_x.now,
+                y = vertices[v].pos.y * p->props.size_y.now;
+            vertices[v].pos = (vec2s)
+            {
+                p->props.pos.x + x * c - y * sn,
+                p->props.pos.y + x * sn + y * c,
+            };
 
             if (p->props.vertex_colour_muls)
             {
@@ -34,5 +34,6 @@
 #include "types.h"
 #include "log.h"
 #include "util.h"
+#include "profile.h"
 
 #endif
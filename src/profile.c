@@ -0,0 +1,184 @@
+#include "pch.h"
+#include "profile.h"
+
+#ifndef PROFILE_DISABLE
+
+struct profile_event
+{
+    // Index + 1 of the zone in this slot; 0 while it is being written
+    u64 seq;
+
+    const char *name;
+    u64 start, end;
+    u32 tid;
+};
+
+static struct profile_event ring[PROFILE_RING_SIZE];
+static u64 head = 0;
+
+// Small per-thread IDs for the trace
+static u32 next_tid = 0;
+static __thread u32 tid = 0;
+
+/* Record a zone that has just ended (called when the zone leaves scope) */
+void
+profile_zone_end(struct profile_zone *z)
+{
+    u64 end = NOW_NS();
+    if (!tid) tid = __atomic_add_fetch(&next_tid, 1, __ATOMIC_RELAXED);
+
+    // Claim a slot; writers never wait on each other
+    u64 i = __atomic_fetch_add(&head, 1, __ATOMIC_RELAXED);
+    struct profile_event *ev = &ring[i & (PROFILE_RING_SIZE - 1)];
+
+    __atomic_store_n(&ev->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    ev->name = z->name;
+    ev->start = z->start;
+    ev->end = end;
+    ev->tid = tid;
+    __atomic_store_n(&ev->seq, i + 1, __ATOMIC_RELEASE);
+}
+
+/*
+ * Visit each zone that has been recorded since the given cursor (start with
+ * 0), and return the cursor to continue from next time.  Zones that have
+ * already been overwritten are skipped
+ */
+u64
+profile_read(u64 from, profile_read_func func, void *user)
+{
+    u64 end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    if (end - from > PROFILE_RING_SIZE)
+    {
+        LOG_WARN("[profile] ring buffer wrapped; lost %" PRIu64 " zones",
+            end - from - PROFILE_RING_SIZE);
+        from = end - PROFILE_RING_SIZE;
+    }
+
+    for (u64 i = from; i < end; ++i)
+    {
+        struct profile_event *ev = &ring[i & (PROFILE_RING_SIZE - 1)];
+
+        // Copy the event out, and skip it if it was overwritten meanwhile
+        if (__atomic_load_n(&ev->seq, __ATOMIC_ACQUIRE) != i + 1) continue;
+        struct profile_event e = *ev;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&ev->seq, __ATOMIC_RELAXED) != i + 1) continue;
+
+        func(e.name, e.start, e.end, e.tid, user);
+    }
+    return end;
+}
+
+struct profile_dump_state
+{
+    FILE *fp;
+    u64 t0;
+    u32 count;
+};
+
+static void
+profile_dump_find_start(
+    const char *name,
+    u64 start,
+    u64 end,
+    u32 tid,
+    void *user)
+{
+    struct profile_dump_state *ds = user;
+    ds->t0 = min(ds->t0, start);
+}
+
+static void
+profile_dump_zone(
+    const char *name,
+    u64 start,
+    u64 end,
+    u32 tid,
+    void *user)
+{
+    struct profile_dump_state *ds = user;
+    fprintf(ds->fp,
+        "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,"
+        "\"ts\":%.3f,\"dur\":%.3f}",
+        ds->count ? "," : "",
+        name,
+        tid,
+        (f64)(start - ds->t0) / 1000.0,
+        (f64)(end - start) / 1000.0);
+    ++ds->count;
+}
+
+/*
+ * Write the zones currently in the ring buffer to a Chrome trace file
+ */
+i32
+profile_dump(const char *path)
+{
+    struct profile_dump_state ds = { .t0 = UINT64_MAX };
+    if (!(ds.fp = fopen(path, "w")))
+    {
+        LOG_ERROR("[profile] failed to open '%s' for writing", path);
+        return -1;
+    }
+
+    // Make timestamps relative to the first zone
+    u64 end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    u64 begin = end > PROFILE_RING_SIZE ? end - PROFILE_RING_SIZE : 0;
+    profile_read(begin, profile_dump_find_start, &ds);
+
+    fprintf(ds.fp, "{\"traceEvents\":[");
+    profile_read(begin, profile_dump_zone, &ds);
+    fprintf(ds.fp, "\n]}\n");
+    fclose(ds.fp);
+
+    LOG_INFO("[profile] wrote %u zones to '%s'", ds.count, path);
+    return 0;
+}
+
+#ifdef BENCH
+
+// Nanoseconds spent in each timer since they were last taken
+static u64 timer_totals[PROFILE_TIMER_COUNT];
+
+// Time spent in timers nested inside each of this thread's running timers
+#define PROFILE_TIMER_DEPTH 8
+static __thread u64 timer_nested[PROFILE_TIMER_DEPTH];
+static __thread u32 timer_depth = 0;
+
+struct profile_timer
+profile_timer_begin(u32 id)
+{
+    if (timer_depth < PROFILE_TIMER_DEPTH) timer_nested[timer_depth] = 0;
+    ++timer_depth;
+    return (struct profile_timer) { id, NOW_NS() };
+}
+
+/* Add a timer's own time to its total (called when it leaves scope) */
+void
+profile_timer_end(struct profile_timer *t)
+{
+    u64 elapsed = NOW_NS() - t->start, self = elapsed;
+    u32 depth = --timer_depth;
+    if (depth < PROFILE_TIMER_DEPTH) self -= timer_nested[depth];
+    if (depth && depth <= PROFILE_TIMER_DEPTH)
+    {
+        timer_nested[depth - 1] += elapsed;
+    }
+    __atomic_fetch_add(&timer_totals[t->id], self, __ATOMIC_RELAXED);
+}
+
+/* Get each timer's total in nanoseconds, and start them again from zero */
+void
+profile_timers_take(u64 *totals)
+{
+    for (u32 i = 0; i < PROFILE_TIMER_COUNT; ++i)
+    {
+        totals[i] = __atomic_exchange_n(&timer_totals[i], 0, __ATOMIC_RELAXED);
+    }
+}
+
+#endif // BENCH
+
+#endif // PROFILE_DISABLE
@@ -0,0 +1,87 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include "types.h"
+
+/*
+ * profile.h
+ *
+ * Frame profiler.  Timed zones are written to a lock-free ring buffer, which
+ * can be dumped as Chrome trace_event JSON (open with chrome://tracing or
+ * Perfetto).  Compiled out completely when PROFILE_DISABLE is defined, as it
+ * is in dist builds.
+ */
+
+// Number of zones kept; older ones are overwritten (must be a power of two)
+#define PROFILE_RING_SIZE 65536
+
+#define PROFILE_DUMP_PATH "profile.json"
+
+#ifndef PROFILE_DISABLE
+
+struct profile_zone
+{
+    const char *name;
+    u64 start;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+
+// Time the rest of the enclosing scope.  Name must be a string literal
+#define PROFILE_ZONE(_name) \
+    struct profile_zone \
+        __attribute__((cleanup(profile_zone_end))) \
+        PROFILE_CONCAT(profile_zone_, __LINE__) = { (_name), NOW_NS() }
+
+// Called for each zone read back from the ring buffer
+typedef void (*profile_read_func)(const char *, u64, u64, u32, void *);
+
+void profile_zone_end(struct profile_zone *);
+u64 profile_read(u64, profile_read_func, void *);
+i32 profile_dump(const char *);
+
+#else
+
+#define PROFILE_ZONE(_name) ((void)0)
+
+#endif // PROFILE_DISABLE
+
+/*
+ * Timers for code that runs once per entity, for the benchmark build only.
+ * Zones there would fill the ring buffer within a few frames, so these just
+ * add up their time.  Time in a nested timer only counts towards that one
+ */
+enum profile_timer_id
+{
+    PROFILE_TIMER_COLLISION,
+    PROFILE_TIMER_THINK,
+
+    PROFILE_TIMER_COUNT
+};
+
+#if defined(BENCH) && !defined(PROFILE_DISABLE)
+
+struct profile_timer
+{
+    u32 id;
+    u64 start;
+};
+
+// Time the rest of the enclosing scope towards a timer
+#define PROFILE_TIMER(_id) \
+    struct profile_timer \
+        __attribute__((cleanup(profile_timer_end))) \
+        PROFILE_CONCAT(profile_timer_, __LINE__) = profile_timer_begin(_id)
+
+struct profile_timer profile_timer_begin(u32);
+void profile_timer_end(struct profile_timer *);
+void profile_timers_take(u64 *);
+
+#else
+
+#define PROFILE_TIMER(_id) ((void)0)
+
+#endif // BENCH
+
+#endif
@@ -12,6 +12,88 @@
 
 struct renderer g_renderer;
 
+// Unit quad shared by every quad renderable
+static struct vbuffer quad_vb;
+static struct ibuffer quad_ib;
+
+// Level polygons collected for merging, one mesh per run of consecutive
+// polygons in the same grid cell (split further, as indices are 16-bit)
+static struct world_chunk
+{
+    i32 x, y;
+    struct vertex_world *v;
+    ib_type *i;
+    u32 v_count, v_cap;
+    u32 i_count, i_cap;
+    u32 polygon_count;
+    vec2s min, max;
+} *world_chunks = NULL;
+static u32 world_chunk_count = 0, world_chunk_cap = 0;
+static u32 world_polygon_count = 0;
+
+static void renderer_world_discard(void);
+
+/*
+ * Put a renderable's geometry in the vertex and index heaps.  Renderables
+ * that don't fit aren't drawn
+ */
+static void
+renderer_set_geometry(
+    struct renderable *r,
+    const void *vertices,
+    size_t vertices_size,
+    size_t stride,
+    const void *indices,
+    size_t indices_size)
+{
+    if (vb_new(&r->vb, vertices, vertices_size, stride) < 0 ||
+        ib_new(&r->ib, indices, indices_size) < 0)
+    {
+        r->ib.index_count = 0;
+    }
+}
+
+static i32
+renderer_create_quad(void)
+{
+    static const struct vertex vertices[4] =
+    {
+        // Top left
+        {
+            .pos      = (vec3s) { 0.0f, 1.0f, 0.0f },
+            .texcoord = (vec2s) { 0.0f, 0.0f, },
+        },
+        // Top right
+        {
+            .pos      = (vec3s) { 1.0f, 1.0f, 0.0f },
+            .texcoord = (vec2s) { 1.0f, 0.0f, },
+        },
+        // Bottom right
+        {
+            .pos      = (vec3s) { 1.0f, 0.0f, 0.0f },
+            .texcoord = (vec2s) { 1.0f, 1.0f, },
+        },
+        // Bottom left
+        {
+            .pos      = (vec3s) { 0.0f, 0.0f, 0.0f },
+            .texcoord = (vec2s) { 0.0f, 1.0f, },
+        },
+    };
+    static const ib_type indices[6] =
+    {
+        0, 1, 2,
+        0, 2, 3
+    };
+
+    if (vb_new(&quad_vb, vertices,
+            sizeof(vertices), sizeof(struct vertex)) < 0 ||
+        ib_new(&quad_ib, indices, sizeof(indices)) < 0)
+    {
+        return -1;
+    }
+    return 0;
+}
+
 i32
 renderer_init(SDL_Window *winhandle)
 {
@@ -23,6 +105,14 @@ renderer_init(SDL_Window *winhandle)
 
     if (vulkan_renderer_init(winhandle) < 0) return -1;
 
+    // Static geometry all goes into two shared buffers
+    if (vb_heap_init(VB_HEAP_SIZE) < 0 ||
+        ib_heap_init(IB_HEAP_SIZE) < 0 ||
+        renderer_create_quad() < 0)
+    {
+        return -1;
+    }
+
     // Allocate object groups
     for (u32 i = 0; i < SHADER_COUNT; ++i)
     {
@@ -32,6 +122,10 @@ renderer_init(SDL_Window *winhandle)
 
     particles_init();
 
+    // Everything up to here outlives levels
+    vb_heap_mark();
+    ib_heap_mark();
+
     return 0;
 }
 
@@ -43,15 +137,9 @@ renderer_deinit(void)
 
     particles_deinit();
 
-    // Free object vertex and index buffers
-    for (u32 i = 0; i < SHADER_COUNT; ++i)
-    {
-        for (u32 o = 0; o < g_renderer.objgroups[i].obj_count; ++o)
-        {
-            vb_free(&g_renderer.objgroups[i].objs[o].vb);
-            ib_free(&g_renderer.objgroups[i].objs[o].ib);
-        }
-    }
+    // Free all object vertex and index buffers
+    vb_heap_deinit();
+    ib_heap_deinit();
 
     vulkan_renderer_deinit();
 
@@ -67,6 +155,9 @@ renderer_render(vec3s *cam_pos)
 {
     particles_update();
 
+    // Nothing to draw to
+    if (g_vulkan->headless) return;
+
     // Record command buffers and render
     vulkan_render_frame_pre();
     vulkan_record_command_buffers(
@@ -76,6 +167,43 @@ renderer_render(vec3s *cam_pos)
     vulkan_render_frame();
 }
 
+/*
+ * Drop all of the last level's objects (and their geometry) before loading a
+ * new one
+ */
+void
+renderer_level_begin(void)
+{
+    for (u32 i = 0; i < SHADER_COUNT; ++i)
+    {
+        g_renderer.objgroups[i].obj_count = 0;
+    }
+    renderer_world_discard();
+    vb_heap_reset();
+    ib_heap_reset();
+
+    // Also waits for the GPU, so nothing is still drawing from the geometry
+    // about to be overwritten
+    vulkan_level_begin();
+}
+
+/*
+ * Save positions of all objects before a simulation tick, so that frames can
+ * be drawn between the previous and current tick
+ */
+void
+renderer_begin_tick(void)
+{
+    for (u32 i = 0; i < SHADER_COUNT; ++i)
+    {
+        struct renderable *objs = g_renderer.objgroups[i].objs;
+        for (u32 o = 0; o < g_renderer.objgroups[i].obj_count; ++o)
+        {
+            objs[o].pos_prev = objs[o].pos;
+        }
+    }
+}
+
 struct renderable *
 renderer_get_renderable(enum shader_type shader)
 {
@@ -91,8 +219,45 @@ renderer_get_renderable(enum shader_type shader)
     return r;
 }
 
+/* Get the chunk that a polygon with the given bounds is merged into */
+static struct world_chunk *
+renderer_world_chunk(vec2s b_min, vec2s b_max, u32 v_count)
+{
+    i32 x = (i32)floorf((b_min.x + b_max.x) / 2.0f / WORLD_CHUNK_SIZE),
+        y = (i32)floorf((b_min.y + b_max.y) / 2.0f / WORLD_CHUNK_SIZE);
+
+    // Only the newest chunk is added to, so that polygons are still drawn in
+    // the order they were added (many share a depth, and the earliest drawn
+    // wins the depth test).  A new one is started when the cell changes
+    if (world_chunk_count)
+    {
+        struct world_chunk *ch = &world_chunks[world_chunk_count - 1];
+        if (ch->x == x && ch->y == y &&
+            ch->v_count + v_count <= UINT16_MAX + 1)
+        {
+            return ch;
+        }
+    }
+
+    if (world_chunk_count == world_chunk_cap)
+    {
+        world_chunk_cap = max(world_chunk_cap * 2, 16u);
+        world_chunks = realloc(world_chunks,
+            world_chunk_cap * sizeof(struct world_chunk));
+    }
+    struct world_chunk *ch = &world_chunks[world_chunk_count++];
+    memset(ch, 0, sizeof(struct world_chunk));
+    ch->x = x;
+    ch->y = y;
+    ch->min = (vec2s){ FLT_MAX, FLT_MAX };
+    ch->max = (vec2s){ -FLT_MAX, -FLT_MAX };
+    return ch;
+}
+
 /*
- * Add polygon to the renderer
+ * Add polygon to the renderer.  Polygons never move, so rather than being
+ * renderables of their own they are merged into the world meshes, which are
+ * created by renderer_build_world
  */
 void
 renderer_add_polygon(struct tagap_polygon *p)
@@ -114,30 +279,51 @@ renderer_add_polygon(struct tagap_polygon *p)
             texpath);
         return;
     }
+    if (p->point_count < 3) return;
 
-    // Get renderable
-    struct renderable *r = renderer_get_renderable(SHADER_DEFAULT);
-
-    r->tex = tex_index;
     vec2s tex_size =
     {
         (f32)g_vulkan->textures[tex_index].w,
         (f32)g_vulkan->textures[tex_index].h,
     };
-    SET_BIT(r->flags, RENDERABLE_SHADED_BIT, p->tex_is_shaded);
+    f32 shade = p->tex_is_shaded ? 0.60f : 1.0f;
 
-    r->bounds.min.x = FLT_MAX;
-    r->bounds.min.y = FLT_MAX;
-    r->bounds.max.x = FLT_MIN;
-    r->bounds.max.y = FLT_MIN;
+    /* Calculate bounds */
+    vec2s b_min = { FLT_MAX, FLT_MAX }, b_max = { -FLT_MAX, -FLT_MAX };
+    for (u32 i = 0; i < p->point_count; ++i)
+    {
+        const vec2s pos = p->points[i];
+        if (pos.x < b_min.x) { b_min.x = pos.x; }
+        if (pos.y < b_min.y) { b_min.y = pos.y; }
+        if (pos.x > b_max.x) { b_max.x = pos.x; }
+        if (pos.y > b_max.y) { b_max.y = pos.y; }
+    }
+
+    struct world_chunk *ch =
+        renderer_world_chunk(b_min, b_max, p->point_count);
+    if (b_min.x < ch->min.x) { ch->min.x = b_min.x; }
+    if (b_min.y < ch->min.y) { ch->min.y = b_min.y; }
+    if (b_max.x > ch->max.x) { ch->max.x = b_max.x; }
+    if (b_max.y > ch->max.y) { ch->max.y = b_max.y; }
+
+    u32 tri_count = p->point_count - 2;
+    if (ch->v_count + p->point_count > ch->v_cap)
+    {
+        ch->v_cap = max(ch->v_cap * 2, ch->v_count + p->point_count);
+        ch->v = realloc(ch->v, ch->v_cap * sizeof(struct vertex_world));
+    }
+    if (ch->i_count + tri_count * 3 > ch->i_cap)
+    {
+        ch->i_cap = max(ch->i_cap * 2, ch->i_count + tri_count * 3);
+        ch->i = realloc(ch->i, ch->i_cap * sizeof(ib_type));
+    }
 
-    size_t vertices_size = sizeof(struct vertex) * p->point_count;
-    struct vertex *vertices = malloc(vertices_size);
+    u32 base = ch->v_count;
     for (u32 i = 0; i < p->point_count; ++i)
     {
         /* Calculate vertex */
         const vec2s pos = p->points[i];
-        vertices[i] = (struct vertex)
+        ch->v[ch->v_count++] = (struct vertex_world)
         {
             .pos = (vec3s)
             {
@@ -152,28 +338,74 @@ renderer_add_polygon(struct tagap_polygon *p)
                  (p->points[p->tex_offset_point].y - p->points[i].y)
                      / tex_size.y,
             }},
+            .tex_index = tex_index,
+            .shade = shade,
         };
-
-        /* Calculate bounds */
-        if (pos.x < r->bounds.min.x) { r->bounds.min.x = pos.x; }
-        if (pos.y < r->bounds.min.y) { r->bounds.min.y = pos.y; }
-        if (pos.x > r->bounds.max.x) { r->bounds.max.x = pos.x; }
-        if (pos.y > r->bounds.max.y) { r->bounds.max.y = pos.y; }
     }
-    vb_new(&r->vb, vertices, vertices_size);
-    free(vertices);
 
     /* Calculate indices */
-    i32 tri_count = p->point_count - 2;
-    size_t index_buf_size = sizeof(ib_type) * tri_count * 3;
-    ib_type *indices = alloca(index_buf_size);
-    for (i32 i = 0; i < tri_count; ++i)
+    for (u32 i = 0; i < tri_count; ++i)
     {
-        indices[i * 3 + 0] = 0;
-        indices[i * 3 + 1] = i + 1;
-        indices[i * 3 + 2] = i + 2;
+        ch->i[ch->i_count++] = base;
+        ch->i[ch->i_count++] = base + i + 1;
+        ch->i[ch->i_count++] = base + i + 2;
+    }
+    ++ch->polygon_count;
+    ++world_polygon_count;
+}
+
+/* Free polygons collected for merging */
+static void
+renderer_world_discard(void)
+{
+    for (u32 c = 0; c < world_chunk_count; ++c)
+    {
+        free(world_chunks[c].v);
+        free(world_chunks[c].i);
     }
-    ib_new(&r->ib, indices, index_buf_size);
+    free(world_chunks);
+    world_chunks = NULL;
+    world_chunk_count = world_chunk_cap = 0;
+    world_polygon_count = 0;
+}
+
+/*
+ * Create a renderable for each world mesh, once all the level's polygons have
+ * been added
+ */
+void
+renderer_build_world(void)
+{
+    u32 c;
+    for (c = 0; c < world_chunk_count; ++c)
+    {
+        struct world_chunk *ch = &world_chunks[c];
+        struct renderable *r = renderer_get_renderable(SHADER_WORLD);
+        if (!r)
+        {
+            u32 dropped = 0;
+            for (u32 d = c; d < world_chunk_count; ++d)
+            {
+                dropped += world_chunks[d].polygon_count;
+            }
+            LOG_WARN("[renderer] no room for %u of %u world meshes; "
+                "%u polygons won't be drawn",
+                world_chunk_count - c, world_chunk_count, dropped);
+            break;
+        }
+
+        r->tex = TEXINDEX_DEFAULT;
+        r->flags |= RENDERABLE_STATIC_BIT;
+        r->bounds.min = ch->min;
+        r->bounds.max = ch->max;
+        renderer_set_geometry(r,
+            ch->v, ch->v_count * sizeof(struct vertex_world),
+            sizeof(struct vertex_world),
+            ch->i, ch->i_count * sizeof(ib_type));
+    }
+    LOG_INFO("[renderer] merged %u polygons into %u world meshes",
+        world_polygon_count, c);
+    renderer_world_discard();
 }
 
 /*
@@ -347,9 +579,9 @@ renderer_add_linedefs(struct tagap_linedef *ldefs, size_t lc)
                 "(style %d) with %d lines", info->style, cur_l);
             memset(r, 0, sizeof(struct renderable));
             r->tex = tex_index;
-            r->flags |= RENDERABLE_NO_CULL_BIT;
-            vb_new(&r->vb, info->v, info->v_size);
-            ib_new(&r->ib, info->i, info->i_size);
+            r->flags |= RENDERABLE_NO_CULL_BIT | RENDERABLE_STATIC_BIT;
+            renderer_set_geometry(r, info->v, info->v_size,
+                sizeof(struct vertex), info->i, info->i_size);
         }
 
         // Cleanup
@@ -445,9 +677,9 @@ renderer_add_linedefs(struct tagap_linedef *ldefs, size_t lc)
             LOG_DBUG("[renderer] adding faded linedef vertex buffer "
                 "(style %d) with %d lines", info->style, cur_l);
             memset(r, 0, sizeof(struct renderable));
-            r->flags |= RENDERABLE_NO_CULL_BIT;
-            vb_new(&r->vb, info->v, info->v_size);
-            ib_new(&r->ib, info->i, info->i_size);
+            r->flags |= RENDERABLE_NO_CULL_BIT | RENDERABLE_STATIC_BIT;
+            renderer_set_geometry(r, info->v, info->v_size,
+                sizeof(struct vertex_vl), info->i, info->i_size);
         }
 
         // Cleanup
@@ -517,8 +749,8 @@ renderer_add_layer(struct tagap_layer *l, i32 z_offset)
         0, 2, 3
     };
 
-    vb_new(&r->vb, vertices, 4 * sizeof(struct vertex));
-    ib_new(&r->ib, indices, 3 * 4 * sizeof(ib_type));
+    renderer_set_geometry(r, vertices, 4 * sizeof(struct vertex),
+        sizeof(struct vertex), indices, 3 * 4 * sizeof(ib_type));
 }
 
 /*
@@ -562,6 +794,7 @@ renderer_add_trigger(struct tagap_trigger *t)
         };
         struct renderable *r = renderer_get_renderable_quad(&quad);
         r->tex = tex_index;
+        r->flags |= RENDERABLE_STATIC_BIT;
         r->pos.x = t->corner_tl.x;
         r->pos.y = -t->corner_br.y;
 
@@ -584,84 +817,27 @@ renderer_get_renderable_quad(struct renderable_quad_info *i)
     if (i->w == 0.0f) i->w = 1.0f;
     if (i->h == 0.0f) i->h = 1.0f;
 
-    struct vertex vertices[4];
-
-    // Top left
-    vertices[0] = (struct vertex)
-    {
-        .pos      = (vec3s) { 0.0f, 0.0f, i->depth },
-        .texcoord = (vec2s) { 0.0f, 0.0f, },
+    // Every quad draws the shared unit quad; it is sized and positioned by
+    // its transform instead
+    r->vb = quad_vb;
+    r->ib = quad_ib;
+    r->flags |= RENDERABLE_QUAD_BIT;
+    r->quad.size = (vec2s) { i->w, i->h };
+    r->quad.origin = (vec3s)
+    {
+        i->centre_x ? -i->w / 2.0f : 0.0f,
+        i->centre_y ? -i->h / 2.0f : 0.0f,
+        i->depth,
     };
-    // Top right
-    vertices[1] = (struct vertex)
-    {
-        .pos      = (vec3s) { 0.0f, 0.0f, i->depth },
-        .texcoord = (vec2s) { 1.0f, 0.0f, },
-    };
-    // Bottom right
-    vertices[2] = (struct vertex)
-    {
-        .pos      = (vec3s) { 0.0f, 0.0f, i->depth },
-        .texcoord = (vec2s) { 1.0f, 1.0f, },
-    };
-    // Bottom left
-    vertices[3] = (struct vertex)
-    {
-        .pos      = (vec3s) { 0.0f, 0.0f, i->depth },
-        .texcoord = (vec2s) { 0.0f, 1.0f, },
-    };
-
-    vec2s bounds_min = GLMS_VEC2_ZERO, bounds_max = GLMS_VEC2_ZERO;
-
-    if (i->centre_x)
-    {
-        vertices[0].pos.x = -i->w / 2.0f;
-        vertices[1].pos.x = i->w / 2.0f;
-        vertices[2].pos.x = i->w / 2.0f;
-        vertices[3].pos.x = -i->w / 2.0f;
-        bounds_min.x = -i->w / 2.0f;
-        bounds_max.x = i->w / 2.0f;
-    }
-    else
-    {
-        vertices[0].pos.x = 0.0f;
-        vertices[1].pos.x = i->w;
-        vertices[2].pos.x = i->w;
-        vertices[3].pos.x = 0.0f;
-        bounds_min.x = 0.0f;
-        bounds_max.x = i->w;
-    }
-    if (i->centre_y)
-    {
-        vertices[0].pos.y = i->h / 2.0f;
-        vertices[1].pos.y = i->h / 2.0f;
-        vertices[2].pos.y = -i->h / 2.0f;
-        vertices[3].pos.y = -i->h / 2.0f;
-        bounds_min.y = -i->h / 2.0f;
-        bounds_max.y = i->h / 2.0f;
-    }
-    else
-    {
-        vertices[0].pos.y = i->h;
-        vertices[1].pos.y = i->h;
-        vertices[2].pos.y = 0.0f;
-        vertices[3].pos.y = 0.0f;
-        bounds_min.y = 0.0f;
-        bounds_max.y = i->h;
-    }
-    static const ib_type indices[3 * 4] =
-    {
-        0, 1, 2,
-        0, 2, 3
-    };
-
-    vb_new(&r->vb, vertices, 4 * sizeof(struct vertex));
-    ib_new(&r->ib, indices, 3 * 4 * sizeof(ib_type));
 
     if (i->make_bounds)
     {
-        r->bounds.min = bounds_min;
-        r->bounds.max = bounds_max;
+        r->bounds.min = (vec2s) { r->quad.origin.x, r->quad.origin.y };
+        r->bounds.max = (vec2s)
+        {
+            r->quad.origin.x + i->w,
+            r->quad.origin.y + i->h,
+        };
     }
 
     return r;
@@ -676,6 +852,7 @@ renderer_add_polygon_fade(struct tagap_polygon *p)
     // Get renderable
     struct renderable *r = renderer_get_renderable(SHADER_VERTEXLIT);
     SET_BIT(r->flags, RENDERABLE_SHADED_BIT, p->tex_is_shaded);
+    r->flags |= RENDERABLE_STATIC_BIT;
 
     r->bounds.min.x = FLT_MAX;
     r->bounds.min.y = FLT_MAX;
@@ -719,9 +896,6 @@ renderer_add_polygon_fade(struct tagap_polygon *p)
         vertices[p->tex_offset_point - 1].colour.w = 0.0f;
     }
 
-    vb_new(&r->vb, vertices, vertices_size);
-    free(vertices);
-
     // Calculate indices
     i32 tri_count = p->point_count - 2;
     size_t index_buf_size = sizeof(ib_type) * tri_count * 3;
@@ -732,7 +906,9 @@ renderer_add_polygon_fade(struct tagap_polygon *p)
         indices[i * 3 + 1] = i + 1;
         indices[i * 3 + 2] = i + 2;
     }
-    ib_new(&r->ib, indices, index_buf_size);
+    renderer_set_geometry(r, vertices, vertices_size,
+        sizeof(struct vertex_vl), indices, index_buf_size);
+    free(vertices);
 }
 
 i32
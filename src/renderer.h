@@ -19,6 +19,14 @@ struct tagap_theme_info;
 #define DEPTH_ENTITIES (150.0f)
 #define DEPTH_ENV (220.0f)
 
+// Objects that move further than this in a tick are drawn at their new
+// position rather than interpolated (e.g. teleports and respawns)
+#define RENDERABLE_SNAP_DIST 128.0f
+
+// Size of the grid cells that level polygons are merged in; each run of
+// polygons in the same cell is a mesh that is culled as one object
+#define WORLD_CHUNK_SIZE 1024.0f
+
 /*
  * renderer.h
  *
@@ -30,10 +38,15 @@ static const u32 MAX_OBJECTS[SHADER_COUNT] =
     [SHADER_DEFAULT] = 1024,
     [SHADER_DEFAULT_NO_ZBUFFER] = 1024,
     [SHADER_VERTEXLIT] = 128,
+    // At most one mesh per level polygon
+    [SHADER_WORLD] = 512,
     [SHADER_PARTICLE] = 1,
     [SHADER_LIGHT] = 512,
 
     [SHADER_SCREENSUBPASS] = 0,
+    [SHADER_SPRITE] = 0,
+    [SHADER_INDIRECT] = 0,
+    [SHADER_INDIRECT_NO_ZBUFFER] = 0,
 };
 
 enum renderable_flag
@@ -46,6 +59,10 @@ enum renderable_flag
     RENDERABLE_FLIPPED_BIT = 16,
     RENDERABLE_EXTRA_SHADING_BIT = 32,
     RENDERABLE_SCALED_BIT = 64,
+    RENDERABLE_QUAD_BIT = 128,
+
+    // Never changes once the level is loaded (its draw is recorded once)
+    RENDERABLE_STATIC_BIT = 256,
 };
 
 struct renderable
@@ -55,11 +72,19 @@ struct renderable
     struct ibuffer ib;
     i32 tex;
     vec2s pos;
+    vec2s pos_prev; // Position as of the previous tick
     vec2s offset;
     f32 rot;
     vec2s tex_offset;
     f32 scale; // Requires SCALED
 
+    // Placement of the shared unit quad (requires QUAD)
+    struct
+    {
+        vec3s origin;
+        vec2s size;
+    } quad;
+
     // Additional shading multiplier (requires EXTRA_SHADING)
     union
     {
@@ -71,6 +96,11 @@ struct renderable
     struct
     {
         vec2s min, max;
+
+        // TEX_SCALE objects use their texture's size instead; cached along
+        // with the texture (index + 1) they were worked out from
+        vec2s tex_min, tex_max;
+        i32 tex;
     } bounds;
 };
 
@@ -97,11 +127,14 @@ extern struct renderer g_renderer;
 
 i32 renderer_init(SDL_Window *);
 void renderer_render(vec3s *);
+void renderer_begin_tick(void);
+void renderer_level_begin(void);
 void renderer_deinit(void);
 
 struct renderable *renderer_get_renderable(enum shader_type);
 struct renderable *renderer_get_renderable_quad(struct renderable_quad_info *);
 void renderer_add_polygon(struct tagap_polygon *);
+void renderer_build_world(void);
 void renderer_add_layer(struct tagap_layer *, i32);
 void renderer_add_linedefs(struct tagap_linedef *, size_t);
 void renderer_add_trigger(struct tagap_trigger *);
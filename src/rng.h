@@ -0,0 +1,45 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include "types.h"
+
+/*
+ * rng.h
+ *
+ * Small seedable random number generator (PCG32).  Anything that affects the
+ * game simulation should use this rather than rand(), so that runs can be
+ * reproduced from their seed.
+ */
+
+struct rng
+{
+    u64 state;
+};
+
+static inline u32
+rng_next(struct rng *r)
+{
+    u64 old = r->state;
+    r->state = old * 6364136223846793005ull + 1442695040888963407ull;
+    u32 xorshifted = (u32)(((old >> 18u) ^ old) >> 27u);
+    u32 rot = (u32)(old >> 59u);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
+
+// Get random integer in range [0, n)
+static inline i32
+rng_int(struct rng *r, i32 n)
+{
+    return (i32)(rng_next(r) % (u32)n);
+}
+
+static inline void
+rng_seed(struct rng *r, u64 seed)
+{
+    r->state = 0;
+    rng_next(r);
+    r->state += seed;
+    rng_next(r);
+}
+
+#endif
@@ -80,7 +80,7 @@ g_shader_list[SHADER_COUNT] =
     {
         .name = "vertexlit",
         .pconst_size = sizeof(struct push_constants_vl),
-        .use_descriptor_sets = false,
+        .use_descriptor_sets = true,
         .depth_test = true,
         .blending = true,
 
@@ -108,11 +108,59 @@ g_shader_list[SHADER_COUNT] =
             },
         },
     },
+    // Level polygons, baked into a few large meshes that carry the texture
+    // index and shading of each polygon in their vertices
+    [SHADER_WORLD] =
+    {
+        .name = "world",
+        .pconst_size = sizeof(struct push_constants_world),
+        .use_descriptor_sets = true,
+        .depth_test = true,
+        .blending = true,
+
+        .vertex_binding_desc = (VkVertexInputBindingDescription)
+        {
+            .binding = 0,
+            .stride = sizeof(struct vertex_world),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+        },
+        .vertex_attr_desc =
+        {
+            // #1: vertex position
+            {
+                .binding = 0,
+                .location = 0,
+                .format = VK_FORMAT_R32G32B32_SFLOAT,
+                .offset = offsetof(struct vertex_world, pos),
+            },
+            // #2: texcoord
+            {
+                .binding = 0,
+                .location = 1,
+                .format = VK_FORMAT_R32G32_SFLOAT,
+                .offset = offsetof(struct vertex_world, texcoord),
+            },
+            // #3: texture index
+            {
+                .binding = 0,
+                .location = 2,
+                .format = VK_FORMAT_R32_SINT,
+                .offset = offsetof(struct vertex_world, tex_index),
+            },
+            // #4: shading
+            {
+                .binding = 0,
+                .location = 3,
+                .format = VK_FORMAT_R32_SFLOAT,
+                .offset = offsetof(struct vertex_world, shade),
+            },
+        },
+    },
     // Particle rendering shader
     [SHADER_PARTICLE] =
     {
         .name = "particle",
-        .pconst_size = sizeof(struct push_constants_ptl),
+        .pconst_size = 0,
         .use_descriptor_sets = true,
         .depth_test = false,
         .blending = true,
@@ -183,6 +231,158 @@ g_shader_list[SHADER_COUNT] =
             },
         },
     },
+    // Instanced quads, drawn in place of SHADER_DEFAULT_NO_ZBUFFER quads
+    [SHADER_SPRITE] =
+    {
+        .name = "sprite",
+        .pconst_size = 0,
+        .use_descriptor_sets = true,
+        .depth_test = false,
+        .blending = true,
+
+        .vertex_binding_desc = (VkVertexInputBindingDescription)
+        {
+            .binding = 0,
+            .stride = sizeof(struct vertex),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+        },
+        .instanced = true,
+        .instance_binding_desc = (VkVertexInputBindingDescription)
+        {
+            .binding = 1,
+            .stride = sizeof(struct sprite_instance),
+            .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE,
+        },
+        .vertex_attr_desc =
+        {
+            // #1: vertex position
+            {
+                .binding = 0,
+                .location = 0,
+                .format = VK_FORMAT_R32G32B32_SFLOAT,
+                .offset = offsetof(struct vertex, pos),
+            },
+            // #2: texcoord
+            {
+                .binding = 0,
+                .location = 1,
+                .format = VK_FORMAT_R32G32_SFLOAT,
+                .offset = offsetof(struct vertex, texcoord),
+            },
+            // #3: position and offset
+            {
+                .binding = 1,
+                .location = 2,
+                .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+                .offset = offsetof(struct sprite_instance, pos),
+            },
+            // #4: quad origin and rotation
+            {
+                .binding = 1,
+                .location = 3,
+                .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+                .offset = offsetof(struct sprite_instance, origin),
+            },
+            // #5: quad size, scale and flip
+            {
+                .binding = 1,
+                .location = 4,
+                .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+                .offset = offsetof(struct sprite_instance, size),
+            },
+            // #6: shading
+            {
+                .binding = 1,
+                .location = 5,
+                .format = VK_FORMAT_R32G32B32A32_SFLOAT,
+                .offset = offsetof(struct sprite_instance, shading),
+            },
+            // #7: texture offset
+            {
+                .binding = 1,
+                .location = 6,
+                .format = VK_FORMAT_R32G32_SFLOAT,
+                .offset = offsetof(struct sprite_instance, tex_offset),
+            },
+            // #8: texture index
+            {
+                .binding = 1,
+                .location = 7,
+                .format = VK_FORMAT_R32_SINT,
+                .offset = offsetof(struct sprite_instance, tex_index),
+            },
+        },
+    },
+    // GPU-driven default shader; draws every object in a group with
+    // one indirect draw
+    [SHADER_INDIRECT] =
+    {
+        .name = "indirect",
+        .pconst_size = 0,
+        .use_descriptor_sets = true,
+        .indirect = true,
+        .depth_test = true,
+        .blending = true,
+
+        .vertex_binding_desc = (VkVertexInputBindingDescription)
+        {
+            .binding = 0,
+            .stride = sizeof(struct vertex),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+        },
+        .vertex_attr_desc =
+        {
+            // #1: vertex position
+            {
+                .binding = 0,
+                .location = 0,
+                .format = VK_FORMAT_R32G32B32_SFLOAT,
+                .offset = offsetof(struct vertex, pos),
+            },
+            // #2: texcoord
+            {
+                .binding = 0,
+                .location = 1,
+                .format = VK_FORMAT_R32G32_SFLOAT,
+                .offset = offsetof(struct vertex, texcoord),
+            },
+        },
+    },
+    // GPU-driven default shader without depth testing; draws every object in a group with
+    // one indirect draw
+    [SHADER_INDIRECT_NO_ZBUFFER] =
+    {
+        .name = "indirect",
+        .pconst_size = 0,
+        .use_descriptor_sets = true,
+        .indirect = true,
+        .depth_test = false,
+        .blending = true,
+
+        .vertex_binding_desc = (VkVertexInputBindingDescription)
+        {
+            .binding = 0,
+            .stride = sizeof(struct vertex),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX,
+        },
+        .vertex_attr_desc =
+        {
+            // #1: vertex position
+            {
+                .binding = 0,
+                .location = 0,
+                .format = VK_FORMAT_R32G32B32_SFLOAT,
+                .offset = offsetof(struct vertex, pos),
+            },
+            // #2: texcoord
+            {
+                .binding = 0,
+                .location = 1,
+                .format = VK_FORMAT_R32G32_SFLOAT,
+                .offset = offsetof(struct vertex, texcoord),
+            },
+        },
+    },
     // Subpass 2 shader
     [SHADER_SCREENSUBPASS] =
     {
@@ -194,6 +394,12 @@ g_shader_list[SHADER_COUNT] =
     },
 };
 
+struct compute_shader g_cull_shader =
+{
+    .name = "cull",
+    .pconst_size = sizeof(struct push_constants_cull),
+};
+
 struct shader_module_set
 {
     char name[SHADER_NAME_MAX];
@@ -204,6 +410,7 @@ struct shader_module_set
 static i32 shader_init(enum shader_type,
     struct shader *,
     struct shader_module_set *);
+static i32 compute_shader_init(struct compute_shader *);
 static VkShaderModule create_shader_module(const char *, bool *);
 
 i32
@@ -220,6 +427,9 @@ vulkan_shaders_init_all(void)
     {
         struct shader_module_set *cur_mod;
 
+        // Don't need the GPU-driven pipelines if not drawing that way
+        if (g_shader_list[i].indirect && !g_vulkan->gpu_driven) continue;
+
         for (u32 j = 0; j < shader_module_count; ++j)
         {
             // Check if shader has already been loaded
@@ -268,6 +478,11 @@ vulkan_shaders_init_all(void)
         vkDestroyShaderModule(g_vulkan->d, modules[i].vert, NULL);
     }
 
+    if (g_vulkan->gpu_driven && compute_shader_init(&g_cull_shader) < 0)
+    {
+        status = -1;
+    }
+
     return status;
 }
 
@@ -284,6 +499,8 @@ vulkan_shaders_free_all(void)
             g_shader_list[i].pipeline_layout,
             NULL);
     }
+    vkDestroyPipeline(g_vulkan->d, g_cull_shader.pipeline, NULL);
+    vkDestroyPipelineLayout(g_vulkan->d, g_cull_shader.pipeline_layout, NULL);
     return 0;
 }
 
@@ -319,6 +536,7 @@ shader_init(
      * Vertex input
      */
     VkPipelineVertexInputStateCreateInfo vertex_input_info;
+    VkVertexInputBindingDescription bindings[2];
     if (id == SHADER_SCREENSUBPASS)
     {
         // Empty vertex input info for subpass 2 shader
@@ -335,11 +553,14 @@ shader_init(
             if (s->vertex_attr_desc[desc_count].location == 0 &&
                 desc_count != 0) break;
         }
+        // Instanced shaders also read from a per-instance buffer
+        bindings[0] = s->vertex_binding_desc;
+        bindings[1] = s->instance_binding_desc;
         vertex_input_info = (VkPipelineVertexInputStateCreateInfo)
         {
             .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-            .vertexBindingDescriptionCount = 1,
-            .pVertexBindingDescriptions = &s->vertex_binding_desc,
+            .vertexBindingDescriptionCount = s->instanced ? 2 : 1,
+            .pVertexBindingDescriptions = bindings,
             .vertexAttributeDescriptionCount = desc_count,
             .pVertexAttributeDescriptions = s->vertex_attr_desc,
         };
@@ -464,21 +685,28 @@ shader_init(
         .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
     };
 
-    VkDescriptorSetLayout *desc_set_layout = NULL;
+    VkDescriptorSetLayout desc_set_layout[2];
     u32 desc_set_layout_count = 0;
     if (s->use_descriptor_sets)
     {
         if (id == SHADER_SCREENSUBPASS)
         {
             // Subpass 2 shader; use special descriptor set layout
-            desc_set_layout = &g_vulkan->desc_set_layout_sp2;
+            desc_set_layout[desc_set_layout_count++] =
+                g_vulkan->desc_set_layout_sp2;
         }
         else
         {
             // Regular shader; use normal descriptor set layout
-            desc_set_layout = &g_vulkan->desc_set_layout;
+            desc_set_layout[desc_set_layout_count++] =
+                g_vulkan->desc_set_layout;
         }
-        ++desc_set_layout_count;
+    }
+    if (s->indirect)
+    {
+        // Objects are read from the object buffer in set 1
+        desc_set_layout[desc_set_layout_count++] =
+            g_vulkan->desc_set_layout_obj;
     }
 
     /*
@@ -488,7 +716,7 @@ shader_init(
     {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
         .pPushConstantRanges = &push_consts,
-        .pushConstantRangeCount = 1,
+        .pushConstantRangeCount = s->pconst_size ? 1 : 0,
         .setLayoutCount = desc_set_layout_count,
         .pSetLayouts = desc_set_layout,
     };
@@ -540,6 +768,66 @@ shader_init(
     return 0;
 }
 
+/* Create a compute pipeline, using only the object buffer descriptor set */
+static i32
+compute_shader_init(struct compute_shader *s)
+{
+    char path[256];
+    sprintf(path, "shader/%s.comp.spv", s->name);
+
+    bool success;
+    VkShaderModule module = create_shader_module(path, &success);
+    if (!success) return -1;
+
+    const VkPushConstantRange push_consts =
+    {
+        .offset = 0,
+        .size = s->pconst_size,
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+    };
+    const VkPipelineLayoutCreateInfo pipeline_layout_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .pPushConstantRanges = &push_consts,
+        .pushConstantRangeCount = 1,
+        .setLayoutCount = 1,
+        .pSetLayouts = &g_vulkan->desc_set_layout_obj,
+    };
+    if (vkCreatePipelineLayout(g_vulkan->d,
+        &pipeline_layout_info, NULL, &s->pipeline_layout) != VK_SUCCESS)
+    {
+        LOG_ERROR("[vulkan] failed to create compute pipeline layout");
+        vkDestroyShaderModule(g_vulkan->d, module, NULL);
+        return -1;
+    }
+
+    const VkComputePipelineCreateInfo pipeline_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage =
+        {
+            .sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO,
+            .stage = VK_SHADER_STAGE_COMPUTE_BIT,
+            .module = module,
+            .pName = "main",
+        },
+        .layout = s->pipeline_layout,
+    };
+    VkResult result = vkCreateComputePipelines(g_vulkan->d, VK_NULL_HANDLE,
+        1, &pipeline_info, NULL, &s->pipeline);
+    vkDestroyShaderModule(g_vulkan->d, module, NULL);
+    if (result != VK_SUCCESS)
+    {
+        LOG_ERROR("[vulkan] failed to create compute pipeline");
+        return -1;
+    }
+
+    LOG_INFO("[vulkan] compute shader '%s' initialised and pipeline created!",
+        s->name);
+
+    return 0;
+}
+
 static VkShaderModule
 create_shader_module(const char *path, bool *success)
 {
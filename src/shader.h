@@ -8,7 +8,7 @@
  */
 
 #define SHADER_NAME_MAX 32
-#define MAX_VERTEX_ATTR 4
+#define MAX_VERTEX_ATTR 8
 
 enum shader_type
 {
@@ -16,6 +16,9 @@ enum shader_type
     SHADER_DEFAULT_NO_ZBUFFER, // Default without depth testing
     SHADER_VERTEXLIT,
 
+    // Static world geometry, merged into a few meshes at level load
+    SHADER_WORLD,
+
     // Particle shader; rendered separately from everything else
     SHADER_PARTICLE,
 
@@ -26,12 +29,23 @@ enum shader_type
     // basic post-processing
     SHADER_SCREENSUBPASS,
 
+    // Instanced version of the no-Z-buffer shader; quads in that group are
+    // drawn with this (it has no objects of its own)
+    SHADER_SPRITE,
+
+    // GPU-driven versions of the default shaders; objects in those groups
+    // are read from a storage buffer and drawn indirectly (no objects of
+    // their own either)
+    SHADER_INDIRECT,
+    SHADER_INDIRECT_NO_ZBUFFER,
+
     SHADER_COUNT
 };
 
 // Rendering order of shaders
 static const u32 SHADER_RENDER_ORDER[SHADER_COUNT] =
 {
+    SHADER_WORLD,
     SHADER_DEFAULT,
     SHADER_VERTEXLIT,
     SHADER_DEFAULT_NO_ZBUFFER,
@@ -41,6 +55,9 @@ static const u32 SHADER_RENDER_ORDER[SHADER_COUNT] =
     //            shaders are not used in)
     SHADER_LIGHT,
     SHADER_SCREENSUBPASS,
+    SHADER_SPRITE,
+    SHADER_INDIRECT,
+    SHADER_INDIRECT_NO_ZBUFFER,
 };
 
 /* Vertex attributes for default shader */
@@ -63,20 +80,68 @@ struct vertex_vl
     vec4s colour;
 };
 
+// Uniforms shared by every object in a frame (binding 2 of the subpass 1
+// descriptor set), so that commands recorded ahead of time need no camera
+struct frame_uniforms
+{
+    mat4s vp;
+};
+
+/*
+ * Transform of an object, pushed in place of a model matrix.  The vertex
+ * shaders apply it the same way as the sprite instance transform, so keep the
+ * order of fields (three vec4s)
+ */
+struct transform_2d
+{
+    // Object position, and offset from it (X offset is flipped with object)
+    vec2s pos;
+    vec2s offset;
+
+    // Placement of the vertices (already scaled by texture size), rotation
+    // in deg
+    vec3s origin;
+    f32 rot;
+
+    // Size of the vertices (already scaled by texture size), object scale,
+    // and -1.0 if flipped (1.0 otherwise)
+    vec2s size;
+    f32 scale;
+    f32 flip;
+};
+
 // Push constants for default shader
 struct push_constants
 {
-    mat4s mvp;
+    struct transform_2d transform;
     vec4s shading;
     vec2s tex_offset;
     int tex_index;
 };
 
+/* Vertex attributes for world shader */
+struct vertex_world
+{
+    vec3s pos;
+    vec2s texcoord;
+
+    // Each polygon keeps its own texture and shading in the merged mesh
+    i32 tex_index;
+    f32 shade;
+};
+
 // Push constants for vertexlit shader
 struct push_constants_vl
 {
-    // Only need MVP; any shading can be done on vertices directly
-    mat4s mvp;
+    // Only need transform; any shading can be done on vertices directly
+    struct transform_2d transform;
+};
+
+// Push constants for world shader
+struct push_constants_world
+{
+    // Only need transform; texture and shading are per vertex
+    struct transform_2d transform;
 };
 
 /* Vertex attributes for particle shader */
@@ -87,18 +152,75 @@ struct vertex_ptl
     i32 tex_index;
 };
 
-// Push constants for particle shader
-struct push_constants_ptl
+/*
+ * Per-instance attributes for sprite shader.  The transform is the same as
+ * the default shader gets as a struct transform_2d.  Fields are grouped
+ * into vec4 attributes, so keep the order of them
+ */
+struct sprite_instance
 {
-    // Only need MVP; any shading can be done on vertices directly, and
-    // texcoords are stored in shader itself as we only render quads with this
-    mat4s mvp;
+    // Object position, and offset from it (X offset is flipped with object)
+    vec2s pos;
+    vec2s offset;
+
+    // Unit quad placement (already scaled by texture size), rotation in deg
+    vec3s origin;
+    f32 rot;
+
+    // Unit quad size (already scaled by texture size), object scale, and
+    // -1.0 if flipped (1.0 otherwise)
+    vec2s size;
+    f32 scale;
+    f32 flip;
+
+    vec4s shading;
+    vec2s tex_offset;
+    i32 tex_index;
+};
+
+/*
+ * Object in the storage buffer read by the cull compute shader and indirect
+ * shader.  The transform is the same as a sprite instance's.  Laid out to
+ * match std430 without any implicit padding, so keep the order of fields
+ * (and keep it in sync with the shaders)
+ */
+struct gpu_renderable
+{
+    vec2s pos;
+    vec2s offset;
+    vec3s origin;
+    f32 rot;
+    vec2s size;
+    f32 scale;
+    f32 flip;
+    vec4s shading;
+    vec2s tex_offset;
+    i32 tex_index;
+
+    // Whether the object can be culled, and its bounds relative to its
+    // position
+    u32 cull;
+    vec2s bounds_min, bounds_max;
+
+    // Draw arguments; objects with no indices are never drawn
+    u32 index_count;
+    u32 first_index;
+    i32 vertex_offset;
+    u32 pad;
+};
+
+// Push constants for cull compute shader
+struct push_constants_cull
+{
+    // Viewport bounds (Y up, as used for culling)
+    vec2s view_min, view_max;
+    u32 count;
 };
 
 // Push constants for light shader
 struct push_constants_light
 {
-    mat4s mvp;
+    struct transform_2d transform;
     vec4s colour;
     int tex_index;
 };
@@ -131,9 +253,17 @@ struct shader
     VkVertexInputBindingDescription vertex_binding_desc;
     VkVertexInputAttributeDescription vertex_attr_desc[MAX_VERTEX_ATTR];
 
+    // Per-instance buffer info (binding 1), for instanced shaders only
+    bool instanced;
+    VkVertexInputBindingDescription instance_binding_desc;
+
     // Whether to use descriptor sets
     bool use_descriptor_sets;
 
+    // Reads objects from the GPU-driven object buffer (descriptor set 1);
+    // only created when drawing GPU-driven
+    bool indirect;
+
     // Whether to read/write to Z-buffer
     bool depth_test;
 
@@ -142,9 +272,21 @@ struct shader
     bool blend_additive;
 };
 
+// Compute shader (just the pipeline, as there is no vertex input, etc.)
+struct compute_shader
+{
+    char name[SHADER_NAME_MAX];
+    VkPipelineLayout pipeline_layout;
+    VkPipeline pipeline;
+    size_t pconst_size;
+};
+
 // Shader list
 extern struct shader g_shader_list[SHADER_COUNT];
 
+// Culls objects into indirect draws when drawing GPU-driven
+extern struct compute_shader g_cull_shader;
+
 i32 vulkan_shaders_init_all(void);
 i32 vulkan_shaders_free_all(void);
 
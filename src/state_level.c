@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "tagap.h"
+#include "intern.h"
 #include "tagap_theme.h"
 #include "tagap_linedef.h"
 #include "tagap_entity.h"
@@ -9,6 +10,8 @@
 #include "state_level.h"
 #include "renderer.h"
 #include "entity_pool.h"
+#include "collision.h"
+#include "entity_hash.h"
 
 struct level *g_map;
 struct state_level *g_level;
@@ -24,6 +27,16 @@ level_init(void)
     // Allocate memory
     g_map->linedefs = malloc(LEVEL_MAX_LINEDEFS * sizeof(struct tagap_linedef));
     g_map->linedef_count = 0;
+    g_map->linedef_geom = (struct tagap_linedef_geom)
+    {
+        .x_min = malloc(LEVEL_MAX_LINEDEFS * sizeof(f32)),
+        .x_max = malloc(LEVEL_MAX_LINEDEFS * sizeof(f32)),
+        .y_min = malloc(LEVEL_MAX_LINEDEFS * sizeof(f32)),
+        .y_max = malloc(LEVEL_MAX_LINEDEFS * sizeof(f32)),
+        .gradient = malloc(LEVEL_MAX_LINEDEFS * sizeof(f32)),
+        .shift = malloc(LEVEL_MAX_LINEDEFS * sizeof(f32)),
+        .flags = malloc(LEVEL_MAX_LINEDEFS * sizeof(u32)),
+    };
     g_map->polygons = calloc(LEVEL_MAX_POLYGONS, sizeof(struct tagap_polygon));
     g_map->polygon_count = 0;
     g_map->layers = calloc(LEVEL_MAX_LAYERS, sizeof(struct tagap_layer));
@@ -39,14 +52,18 @@ level_init(void)
     g_state.l.entity_infos =
         malloc(GAME_ENTITY_INFO_LIMIT * sizeof(struct tagap_entity_info));
     g_state.l.entity_info_count = 0;
+    g_state.l.entity_names = calloc(1, sizeof(struct intern_map));
 
     g_state.l.theme_infos =
         calloc(GAME_THEME_INFO_LIMIT, sizeof(struct tagap_theme_info));
     g_state.l.theme_info_count = 1;
+    g_state.l.theme_names = calloc(1, sizeof(struct intern_map));
+    intern_map_add(g_state.l.theme_names, g_state.l.theme_infos[0].name, 0);
 
     g_state.l.sprite_infos =
         malloc(GAME_SPRITE_INFO_LIMIT * sizeof(struct tagap_sprite_info));
     g_state.l.sprite_info_count = 0;
+    g_state.l.sprite_names = calloc(1, sizeof(struct intern_map));
 
     g_map->theme = &g_state.l.theme_infos[0];
 }
@@ -76,25 +93,57 @@ level_reset(void)
     g_map->current_depth = 0;
     g_map->current_entity_depth = 0;
 
+    // Linedefs are about to change
+    collision_level_free();
+    entity_hash_clear();
+
     // Need to set this to zero to reset polygon point counters
     memset(g_map->polygons, 0,
         LEVEL_MAX_POLYGONS * sizeof(struct tagap_polygon));
 }
 
+/*
+ * Load level from map file
+ */
+i32
+level_load(const char *fpath)
+{
+    LOG_INFO("[level] loading '%s'", fpath);
+    i32 status = tagap_script_run(fpath);
+    if (status == 0)
+    {
+        // Linedefs are fixed from here on, so build the collision data
+        collision_level_build();
+    }
+    LOG_INFO("[level] load %s", status ? "failed" : "complete");
+    return status;
+}
+
 void
 level_deinit(void)
 {
     entity_pool_deinit();
+    collision_level_free();
 
     LOG_INFO("[state] level cleanup");
     free(g_map->linedefs);
+    free(g_map->linedef_geom.x_min);
+    free(g_map->linedef_geom.x_max);
+    free(g_map->linedef_geom.y_min);
+    free(g_map->linedef_geom.y_max);
+    free(g_map->linedef_geom.gradient);
+    free(g_map->linedef_geom.shift);
+    free(g_map->linedef_geom.flags);
     free(g_map->polygons);
     free(g_map->triggers);
     free(g_map->layers);
     free(g_map->entities);
     free(g_state.l.entity_infos);
+    free(g_state.l.entity_names);
     free(g_state.l.theme_infos);
+    free(g_state.l.theme_names);
     free(g_state.l.sprite_infos);
+    free(g_state.l.sprite_names);
 }
 
 /*
@@ -110,6 +159,7 @@ level_submit_to_renderer(void)
     {
         renderer_add_polygon(&g_map->polygons[i]);
     }
+    renderer_build_world();
 
     // Generate line geometry second
     renderer_add_linedefs(g_map->linedefs, g_map->linedef_count);
@@ -184,15 +234,20 @@ level_spawn_entities()
 void
 level_update()
 {
-    for (u32 i = 0; i < g_map->entity_count; ++i)
-    {
-        entity_update(&g_map->entities[i]);
-    }
-    for (u32 i = 0; i < LEVEL_MAX_TMP_ENTITIES; ++i)
+    PROFILE_ZONE("level_update");
+
     {
-        if (!g_map->tmp_entities[i].active) continue;
+        PROFILE_ZONE("level_entities_update");
+        for (u32 i = 0; i < g_map->entity_count; ++i)
+        {
+            entity_update(&g_map->entities[i]);
+        }
+        for (u32 i = 0; i < LEVEL_MAX_TMP_ENTITIES; ++i)
+        {
+            if (!g_map->tmp_entities[i].active) continue;
 
-        entity_update(&g_map->tmp_entities[i]);
+            entity_update(&g_map->tmp_entities[i]);
+        }
     }
     // Update pooled entities
     entity_pool_update();
@@ -5,8 +5,10 @@
 #include "player.h"
 #include "tagap_script.h"
 #include "tagap_weapon.h"
+#include "tagap_linedef.h"
 
 struct renderable;
+struct intern_map;
 
 /*
  * state_level.h
@@ -47,6 +49,9 @@ struct state_level
         struct tagap_linedef *linedefs;
         i32 linedef_count;
 
+        // Precomputed linedef geometry for collision
+        struct tagap_linedef_geom linedef_geom;
+
         // Level polygons
         struct tagap_polygon *polygons;
         i32 polygon_count;
@@ -87,10 +92,12 @@ struct state_level
     // read when the game starts up.
     struct tagap_entity_info *entity_infos;
     i32 entity_info_count;
+    struct intern_map *entity_names;
 
     // Theme definitions
     struct tagap_theme_info *theme_infos;
     i32 theme_info_count;
+    struct intern_map *theme_names;
 
     // Weapon slots
     struct tagap_weapon weapons[WEAPON_SLOT_COUNT];
@@ -99,6 +106,7 @@ struct state_level
     // we don't have to load them every time
     struct tagap_sprite_info *sprite_infos;
     i32 sprite_info_count;
+    struct intern_map *sprite_names;
 
     // List of cloned textures
     struct tagap_texclone
@@ -116,6 +124,7 @@ extern struct level *g_map;
 
 void level_init(void);
 void level_reset(void);
+i32 level_load(const char *);
 void level_deinit(void);
 
 void level_submit_to_renderer(void);
@@ -130,13 +139,4 @@ struct tagap_entity *level_spawn_entity(
     f32 aim_angle,
     bool flipped);
 
-static inline i32
-level_load(const char *fpath)
-{
-    LOG_INFO("[level] loading '%s'", fpath);
-    i32 status = tagap_script_run(fpath);
-    LOG_INFO("[level] load %s", status ? "failed" : "complete");
-    return status;
-}
-
 #endif
@@ -5,6 +5,8 @@
 #include "state_menu.h"
 #include "vulkan_renderer.h"
 #include "sfx.h"
+#include "input.h"
+#include "rng.h"
 
 // TAGAP data directory.  May make this adjustable
 //#define TAGAP_DATA_DIR "/home/mike/games/TAGAP/data"
@@ -17,6 +19,17 @@
 #define TAGAP_LAYERS_DIR TAGAP_ART_DIR "/layers"
 #define TAGAP_EFFECTS_DIR TAGAP_ART_DIR "/effects"
 
+// Parsed scripts are cached here
+#define TAGAP_CACHE_DIR "./data_cache"
+
+// The game simulation runs at a fixed rate, independent of framerate
+#define TICK_RATE 120
+#define TICK_DT (1.0 / (f64)TICK_RATE)
+
+// Most ticks to run in a single frame; if we fall further behind than this
+// the rest of the time is dropped rather than spiralling
+#define MAX_TICKS_PER_FRAME 8
+
 enum game_state
 {
     // Loading into the game
@@ -43,10 +56,13 @@ struct tagap
     struct state_level l;
 
     // Current client-side input/state info
-    vec3s cam_pos;
-    i32 mouse_x, mouse_y, mouse_scroll;
-    u8 m_state;
-    const u8 *kb_state;
+    vec3s cam_pos, cam_pos_prev;
+
+    // Inputs for the current tick
+    struct input_state input;
+
+    // Random numbers for the game simulation
+    struct rng rng;
 
     // Renderer
     struct vulkan_renderer vulkan;
@@ -56,7 +72,20 @@ struct tagap
 
     // Internal state
     u64 now, last_frame, last_sec;
-    f64 dt;
+    u64 tick;
+
+    // Simulation clock (nanoseconds), advanced by each tick
+    u64 sim_now;
+
+    // Quit after this many ticks (0 to run until closed)
+    u64 max_ticks;
+
+    // Simulation timestep (always TICK_DT), and real time since last frame
+    f64 dt, frame_dt;
+
+    // Unsimulated time, and how far we are between the last two ticks
+    f64 tick_accum;
+    f32 tick_alpha;
     u32 draw_calls;
 };
 
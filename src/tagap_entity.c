@@ -144,6 +144,7 @@ entity_spawn(struct tagap_entity *e)
 
     entity_reset(e, e->position, e->aim_angle, e->flipped);
     e->is_spawned = true;
+    entity_hash_update(e);
 }
 
 void
@@ -203,7 +204,7 @@ entity_update(struct tagap_entity *e)
                 if (tracer)
                 {
                     // Tracers have bullets spawn randomly in angle range
-                    angle = (f32)(rand() % (ang_base * 2)) -
+                    angle = (f32)rng_int(&g_state.rng, ang_base * 2) -
                         ang_base + e->aim_angle;
                 }
                 else
@@ -322,6 +323,9 @@ entity_update(struct tagap_entity *e)
         e->weapon_charge_time = e->owner->weapon_charge_time;
     }
 
+    // Keep our place in the spatial hash up to date
+    entity_hash_update(e);
+
     f32 flip_mul = (f32)e->flipped * -2.0f + 1.0f;
 
     // TODO: only enable bobbing if entity during load detects that sprites
@@ -525,10 +529,10 @@ entity_update(struct tagap_entity *e)
             }
 
             // Blink animation
-            if (g_state.now > e->next_blink)
+            if (g_state.sim_now > e->next_blink)
             {
-                e->next_blink = g_state.now +
-                    ((rand() % 4000) + 600) * NS_PER_MS;
+                e->next_blink = g_state.sim_now +
+                    (rng_int(&g_state.rng, 4000) + 600) * (u64)NS_PER_MS;
                 e->blink_timer = 0.0f;
             }
             if (e->blink_timer < 0.15f)
@@ -630,6 +634,7 @@ entity_reset(
     e->position = pos;
     e->aim_angle = aim;
     e->flipped = flipped;
+    entity_hash_update(e);
 
     // Reset timers
     e->bobbing_timer = 0.0f;
@@ -673,6 +678,7 @@ void
 entity_set_inactive_hidden(struct tagap_entity *e, bool h)
 {
     e->active = !h;
+    entity_hash_update(e);
     for (u32 i = 0; i < e->info->sprite_count; ++i)
     {
         SET_BIT(e->sprites[i]->flags, RENDERABLE_HIDDEN_BIT, h);
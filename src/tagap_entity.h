@@ -8,6 +8,7 @@
 #include "tagap_weapon.h"
 #include "collision.h"
 #include "entity_pool.h"
+#include "entity_hash.h"
 
 #define ENTITY_NAME_MAX 128
 #define ENTITY_MAX_SPRITES 32
@@ -267,6 +268,14 @@ struct tagap_entity
     // Whether this entity is active or not
     bool active;
 
+    // Place in the entity spatial hash (see entity_hash.h)
+    struct
+    {
+        bool inserted;
+        i32 cell_x, cell_y;
+        struct tagap_entity *next, *prev;
+    } hash;
+
     // Position of the entity
     vec2s position;
 
@@ -140,7 +140,7 @@ entity_fx_update(struct tagap_entity *e)
     if (e->info->stats[STAT_FX_DISABLE]) return;
 
     // Aim angle with some randomisation
-    f32 ang = e->aim_angle + (f32)((rand() % 100 - 50) / 2.0f);
+    f32 ang = e->aim_angle + (f32)((rng_int(&g_state.rng, 100) - 50) / 2.0f);
 
     /*
      * Bullet effect for trace attacks.  These are not actual projectiles and
@@ -523,12 +523,12 @@ entity_fx_die(struct tagap_entity *e)
                 props.pos = (vec2s)
                 {
                     e->position.x +
-                        (f32)((rand() % 10) - 5) * explode_size / 10.0f,
+                        (f32)(rng_int(&g_state.rng, 10) - 5) * explode_size / 10.0f,
                     e->position.y +
-                        (f32)((rand() % 10) - 5) * explode_size / 10.0f,
+                        (f32)(rng_int(&g_state.rng, 10) - 5) * explode_size / 10.0f,
                 };
                 props.speed = explode_velo;
-                props.dir = (f32)(rand() % 360);
+                props.dir = (f32)rng_int(&g_state.rng, 360);
 
                 // Emit smoke trail
                 particle_emit(&props);
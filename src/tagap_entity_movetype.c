@@ -177,10 +177,11 @@ entity_movetype_walk(struct tagap_entity *e)
         e->jump_timer < 0.0f)
     {
         // We are on a floor, so follow the floor's path
+        const struct tagap_linedef_geom *g = &g_map->linedef_geom;
+        const i32 l = e->collision.floor_linedef;
         e->position.x += e->velo.x * DT * 60.0f;
-        e->position.y =
-            e->collision.floor_gradient * e->position.x +
-            e->collision.floor_shift + e->info->offsets[OFFSET_SIZE].x;
+        e->position.y = g->gradient[l] * e->position.x + g->shift[l] +
+            e->info->offsets[OFFSET_SIZE].x;
     }
     else
     {
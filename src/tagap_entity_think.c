@@ -6,11 +6,14 @@
 
 static void entity_think_user(struct tagap_entity *);
 static void entity_think_missile(struct tagap_entity *);
-static void entity_think_item(struct tagap_entity *);
+static void entity_think_user_pickup(struct tagap_entity *);
+static void entity_item_pickup(struct tagap_entity *, struct tagap_entity *);
 
 void
 entity_think(struct tagap_entity *e)
 {
+    PROFILE_TIMER(PROFILE_TIMER_THINK);
+
     switch(e->info->think.mode)
     {
     // Entity is controlled by the player
@@ -19,8 +22,9 @@ entity_think(struct tagap_entity *e)
     // Entity is a projectile
     case THINK_AI_MISSILE: entity_think_missile(e); break;
 
-    // Entity is an item
-    case THINK_AI_ITEM: entity_think_item(e); break;
+    // Entity is an item; these are passive, and picked up by the player's
+    // think routine
+    case THINK_AI_ITEM: break;
 
     // Static entity
     default:
@@ -33,8 +37,8 @@ entity_think_user(struct tagap_entity *e)
 {
     // Calculate world point of cursor
     vec2s cursor_world = { g_state.cam_pos.x, g_state.cam_pos.y };
-    cursor_world.x += ((f32)g_state.mouse_x / WIDTH) * WIDTH_INTERNAL;
-    cursor_world.y += ((f32)g_state.mouse_y / HEIGHT) * HEIGHT_INTERNAL;
+    cursor_world.x += ((f32)g_state.input.mouse_x / WIDTH) * WIDTH_INTERNAL;
+    cursor_world.y += ((f32)g_state.input.mouse_y / HEIGHT) * HEIGHT_INTERNAL;
 
     // Calculate aiming angle
     vec2s pos = e->position;
@@ -59,18 +63,19 @@ entity_think_user(struct tagap_entity *e)
     e->aim_angle = -ang * (e->flipped ? -1 : 1);
 
     // Set inputs to player input
-    if (g_state.kb_state[SDL_SCANCODE_A]) e->inputs.horiz = -1.0f;
-    else if (g_state.kb_state[SDL_SCANCODE_D]) e->inputs.horiz = 1.0f;
+    const u16 buttons = g_state.input.buttons;
+    if (buttons & INPUT_LEFT_BIT) e->inputs.horiz = -1.0f;
+    else if (buttons & INPUT_RIGHT_BIT) e->inputs.horiz = 1.0f;
     else e->inputs.horiz = 0.0f;
 
-    if (g_state.kb_state[SDL_SCANCODE_S]) e->inputs.vert = -1.0f;
-    else if (g_state.kb_state[SDL_SCANCODE_W]) e->inputs.vert = 1.0f;
+    if (buttons & INPUT_DOWN_BIT) e->inputs.vert = -1.0f;
+    else if (buttons & INPUT_UP_BIT) e->inputs.vert = 1.0f;
     else e->inputs.vert = 0.0f;
 
-    e->inputs.fire = !!(g_state.m_state & SDL_BUTTON(1));
+    e->inputs.fire = !!(buttons & INPUT_FIRE_BIT);
 
     // Mouse scroll: weapon slot changes
-    if (g_state.mouse_scroll > 0)
+    if (g_state.input.scroll > 0)
     {
         i32 new_slot = 0;
         for (i32 i = PLAYER_WEAPON_COUNT - 1; i > -1; --i)
@@ -91,7 +96,7 @@ entity_think_user(struct tagap_entity *e)
         }
         entity_change_weapon_slot(e, new_slot);
     }
-    else if (g_state.mouse_scroll < 0)
+    else if (g_state.input.scroll < 0)
     {
         i32 new_slot = 0;
         for (i32 i = (i32)e->weapon_slot + 1; i < PLAYER_WEAPON_COUNT; ++i)
@@ -108,11 +113,34 @@ entity_think_user(struct tagap_entity *e)
 #ifdef DEBUG
     // Debug controls for fast movement across the map
     const f32 god_mode_speed = 2000.0f * DT;
-    if (g_state.kb_state[SDL_SCANCODE_H]) e->position.x -= god_mode_speed;
-    if (g_state.kb_state[SDL_SCANCODE_J]) e->position.y -= god_mode_speed / 2.0f;
-    if (g_state.kb_state[SDL_SCANCODE_K]) e->position.y += god_mode_speed / 2.0f;
-    if (g_state.kb_state[SDL_SCANCODE_L]) e->position.x += god_mode_speed;
+    if (buttons & INPUT_DEBUG_LEFT_BIT) e->position.x -= god_mode_speed;
+    if (buttons & INPUT_DEBUG_DOWN_BIT) e->position.y -= god_mode_speed / 2.0f;
+    if (buttons & INPUT_DEBUG_UP_BIT) e->position.y += god_mode_speed / 2.0f;
+    if (buttons & INPUT_DEBUG_RIGHT_BIT) e->position.x += god_mode_speed;
 #endif
+
+    entity_think_user_pickup(e);
+}
+
+static bool
+entity_is_item(const struct tagap_entity *e)
+{
+    return e->info->think.mode == THINK_AI_ITEM;
+}
+
+/* Pick up any items that the player is near */
+static void
+entity_think_user_pickup(struct tagap_entity *e)
+{
+    static const f32 ITEM_RADIUS = 32.0f;
+
+    struct tagap_entity *nearby[32];
+    u32 count = entity_hash_query_radius(e->position, ITEM_RADIUS,
+        entity_is_item, nearby, sizeof(nearby) / sizeof(nearby[0]));
+    for (u32 i = 0; i < count; ++i)
+    {
+        entity_item_pickup(nearby[i], e);
+    }
 }
 
 static void
@@ -170,34 +198,28 @@ entity_think_missile(struct tagap_entity *e)
 }
 
 static void
-entity_think_item(struct tagap_entity *e)
+entity_item_pickup(struct tagap_entity *e, struct tagap_entity *player)
 {
-    // Check if we come in proximity to player
-    static const f32 ITEM_RADIUS = 32.0f;
-    if (glms_vec2_distance2(e->position, g_map->player->position) <
-        ITEM_RADIUS * ITEM_RADIUS)
+    // Copy the ammunition from item to player's store
+    i32 set_slot = -1;
+    for (u32 w = 0; w < WEAPON_SLOT_COUNT; ++w)
     {
-        // Copy the ammunition from item to player's store
-        i32 set_slot = -1;
-        for (u32 w = 0; w < WEAPON_SLOT_COUNT; ++w)
+        if (e->weapons[w].ammo > 0 &&
+            player->weapons[w].ammo == 0)
         {
-            if (e->weapons[w].ammo > 0 &&
-                g_map->player->weapons[w].ammo == 0)
-            {
-                // Player doesn't have this weapon; we set their slot to it.
-                set_slot = w;
-            }
-
-            g_map->player->weapons[w].ammo += e->weapons[w].ammo;
+            // Player doesn't have this weapon; we set their slot to it.
+            set_slot = w;
         }
 
-        // Destroy the pickup
-        entity_die(e);
+        player->weapons[w].ammo += e->weapons[w].ammo;
+    }
 
-        // Set player weapon slot
-        if (set_slot > -1)
-        {
-            entity_change_weapon_slot(g_map->player, set_slot);
-        }
+    // Destroy the pickup
+    entity_die(e);
+
+    // Set player weapon slot
+    if (set_slot > -1)
+    {
+        entity_change_weapon_slot(player, set_slot);
     }
 }
@@ -31,4 +31,34 @@ struct tagap_linedef
     enum tagap_linedef_style style;
 };
 
+enum tagap_linedef_geom_flag
+{
+    // Line acts as a floor or left-facing wall
+    LINEDEF_GEOM_FLOOR_BIT = 1,
+
+    // Line acts as a ceiling or right-facing wall
+    LINEDEF_GEOM_CEILING_BIT = 2,
+
+    // Line is vertical (a wall)
+    LINEDEF_GEOM_VERTICAL_BIT = 4,
+};
+
+/*
+ * Linedef geometry precomputed at load time, stored as separate arrays
+ * (indexed the same as the level linedefs) for the collision checks
+ */
+struct tagap_linedef_geom
+{
+    // Leftmost/rightmost X and lowest/highest Y of the line
+    f32 *x_min, *x_max;
+    f32 *y_min, *y_max;
+
+    // Line equation y = gradient * x + shift (not valid for vertical lines)
+    f32 *gradient, *shift;
+
+    // tagap_linedef_geom_flag bits (32-bit so that they can be loaded into
+    // vector registers alongside the floats)
+    u32 *flags;
+};
+
 #endif
@@ -1,5 +1,7 @@
 #include "pch.h"
 #include "tagap.h"
+#include "intern.h"
+#include "jobs.h"
 #include "tagap_anim.h"
 #include "tagap_entity.h"
 #include "tagap_linedef.h"
@@ -9,15 +11,119 @@
 #include "tagap_layer.h"
 #include "tagap_trigger.h"
 #include "tagap_script.h"
+#include "tagap_script_lexer.h"
 
 #include "tagap_script_def.h"
 
 #include "tagap_script_logging.h"
 
+#include <fcntl.h>
+#include <sys/mman.h>
+
+/*
+ * Scripts are run in two phases: they are parsed into lists of commands
+ * (which only depends on the script itself, so can be done on any thread),
+ * then the commands are run in order on the main thread.  Entity and theme
+ * names are kept as strings until then, as they may refer to definitions in
+ * earlier scripts.
+ */
+
+// Command that has been parsed, but not yet run
+struct tagap_script_parsed_cmd
+{
+    enum tagap_script_atom_id atom;
+    i32 line_num;
+    u32 tok_count;
+
+    // Token values.  Strings are offsets into the script's string storage
+    union
+    {
+        i32 i;
+        f32 f;
+        bool b;
+        u32 str;
+    } tok[TAGAP_SCRIPT_MAX_TOKENS];
+};
+
+// Parsed script
+struct tagap_script_parsed
+{
+    char fname[256];
+    i32 status;
+
+    struct tagap_script_parsed_cmd *cmds;
+    u32 cmd_count, cmd_capacity;
+
+    char *strs;
+    u32 strs_size, strs_capacity;
+
+    // Cache file mapping, if the commands were loaded from the cache
+    void *map;
+    size_t map_size;
+};
+
+/*
+ * Parsed scripts are cached in TAGAP_CACHE_DIR, so that they only need to be
+ * parsed again when they change.  The command list has no pointers in it, so
+ * a cache file is used in place straight from the mapping.  Caches are keyed
+ * on a hash of the command table and lookup name lists, so they go stale by
+ * themselves when those change; bump the version if the file layout does
+ */
+#define TAGAP_SCRIPT_CACHE_MAGIC "TGSC"
+#define TAGAP_SCRIPT_CACHE_VERSION 2
+
+struct tagap_script_cache_header
+{
+    char magic[4];
+    u32 version;
+
+    // Layout of the command list, and what its tokens mean
+    u32 atom_count;
+    u32 cmd_size;
+    u64 schema_hash;
+
+    // Source script this was parsed from
+    char src_path[256];
+    u64 src_mtime_ns;
+    u64 src_size;
+    u64 src_hash;
+
+    u32 cmd_count;
+    u32 strs_size;
+};
+
+// Name lists that lookup tokens are turned into values with
+static const struct
+{
+    i32 (*func)(const char *);
+    const char **names;
+    u32 count;
+} TAGAP_SCRIPT_LOOKUPS[] =
+{
+    { lookup_tagap_anim, ANIM_NAMES, ANIM_COUNT },
+    { lookup_tagap_stat, STAT_NAMES, ENTITY_STAT_COUNT },
+    { lookup_tagap_offset, OFFSET_NAMES, ENTITY_OFFSET_COUNT },
+    { lookup_tagap_effect_event, EFFECT_EVENT_NAMES, EFFECT_EVENT_COUNT },
+    { lookup_tagap_effect, EFFECT_NAMES, EFFECT_COUNT },
+    { lookup_tagap_movetype, MOVETYPE_NAMES, MOVETYPE_COUNT },
+    { lookup_tagap_think, THINK_NAMES, THINK_COUNT },
+    { lookup_tagap_think_attack, THINK_ATTACK_NAMES, THINK_ATTACK_COUNT },
+    { lookup_tagap_cvar, CVAR_NAMES, _CVAR_COUNT },
+    { lookup_tagap_spritevar, SPRITEVAR_NAMES, _SPRITEVAR_COUNT },
+    { lookup_tagap_env, ENVIRON_NAMES, ENVIRON_COUNT },
+    { lookup_tagap_trigger, TRIGGER_NAMES, TRIGGER_COUNT },
+};
+#define TAGAP_SCRIPT_LOOKUP_COUNT \
+    (sizeof(TAGAP_SCRIPT_LOOKUPS) / sizeof(TAGAP_SCRIPT_LOOKUPS[0]))
+
 static i32 tagap_script_run_cmd_in_state(
     enum tagap_script_atom_id, struct tagap_script_state *);
-static enum tagap_script_atom_id tagap_script_parse_cmd(
-    struct tagap_script_state *, const char *, size_t);
+static i32 tagap_script_parse_cmd(
+    struct tagap_script_state *,
+    const struct tagap_script_span *,
+    i32,
+    struct tagap_script_parsed *,
+    struct tagap_script_parsed_cmd *);
 
 /* Set script parser mode */
 static inline void
@@ -35,167 +141,716 @@ tagap_script_set_parse_mode(
     ss->mode = mode;
 }
 
+/* Store a (null-terminated) copy of a token; returns its offset */
+static u32
+tagap_script_add_str(
+    struct tagap_script_parsed *p,
+    struct tagap_script_span t)
+{
+    if (p->strs_size + t.len + 1 > p->strs_capacity)
+    {
+        p->strs_capacity = max(p->strs_capacity * 2, p->strs_size + t.len + 1);
+        p->strs_capacity = max(p->strs_capacity, 4096u);
+        p->strs = realloc(p->strs, p->strs_capacity);
+    }
+
+    u32 offset = p->strs_size;
+    memcpy(&p->strs[offset], t.s, t.len);
+    p->strs[offset + t.len] = '\0';
+    p->strs_size += t.len + 1;
+    return offset;
+}
+
+/* Parse a line of tokens and add it to the command list */
+static void
+tagap_script_add_line(
+    struct tagap_script_state *ss,
+    struct tagap_script_parsed *p,
+    const struct tagap_script_span *toks,
+    i32 tok_count)
+{
+    if (p->cmd_count == p->cmd_capacity)
+    {
+        p->cmd_capacity = max(p->cmd_capacity * 2, 256u);
+        p->cmds = realloc(p->cmds,
+            p->cmd_capacity * sizeof(struct tagap_script_parsed_cmd));
+    }
+
+    // Unused tokens (and bytes) are written to the cache, so clear them
+    struct tagap_script_parsed_cmd *c = &p->cmds[p->cmd_count];
+    memset(c, 0, sizeof(struct tagap_script_parsed_cmd));
+    if (tagap_script_parse_cmd(ss, toks, tok_count, p, c) > 0)
+    {
+        c->line_num = ss->line_num;
+        ++p->cmd_count;
+    }
+}
+
+static void
+tagap_script_parsed_free(struct tagap_script_parsed *p)
+{
+    if (p->map)
+    {
+        munmap(p->map, p->map_size);
+    }
+    else
+    {
+        free(p->cmds);
+        free(p->strs);
+    }
+    memset(p, 0, sizeof(struct tagap_script_parsed));
+}
+
+// FNV-1a, 64-bit; continues on from the given hash
+#define TAGAP_SCRIPT_HASH_BASIS 14695981039346656037ull
+static u64
+tagap_script_cache_hash_more(u64 h, const void *data, size_t size)
+{
+    for (const u8 *b = data, *end = b + size; b < end; ++b)
+    {
+        h = (h ^ *b) * 1099511628211ull;
+    }
+    return h;
+}
+
+static inline u64
+tagap_script_cache_hash(const void *data, size_t size)
+{
+    return tagap_script_cache_hash_more(TAGAP_SCRIPT_HASH_BASIS, data, size);
+}
+
+/* Get which lookup name list a lookup function uses, or -1 */
+static i32
+tagap_script_lookup_index(i32 (*func)(const char *))
+{
+    for (u32 i = 0; i < TAGAP_SCRIPT_LOOKUP_COUNT; ++i)
+    {
+        if (TAGAP_SCRIPT_LOOKUPS[i].func == func) return i;
+    }
+    return -1;
+}
+
 /*
- * Parse and run a command string
+ * Hash what parsed commands mean: the command table's token layouts, and the
+ * name lists that lookup tokens were turned into values with.  Only worked
+ * out once
  */
-i32
-tagap_script_run_cmd(
-    struct tagap_script_state *ss,
-    const char *cmd,
-    size_t cmd_len)
+static u64
+tagap_script_cache_schema(void)
 {
-    // Parse the command
-    enum tagap_script_atom_id atom = tagap_script_parse_cmd(ss, cmd, cmd_len);
-    if (atom < 0) return -1;
+    static u64 schema = 0;
+    u64 h = __atomic_load_n(&schema, __ATOMIC_RELAXED);
+    if (h) return h;
 
-    // Run parsed command
-    i32 status = tagap_script_run_cmd_in_state(atom, ss);
+    h = TAGAP_SCRIPT_HASH_BASIS;
+    for (u32 i = 0; i < _ATOM_COUNT; ++i)
+    {
+        const struct tagap_script_command *cmd = &TAGAP_SCRIPT_COMMANDS[i];
+        h = tagap_script_cache_hash_more(h, cmd->name, strlen(cmd->name) + 1);
+        for (u32 t = 0; t < cmd->token_count; ++t)
+        {
+            const struct tagap_script_token *tok = &cmd->tokens[t];
+            i32 layout[] =
+            {
+                tok->type,
+                tok->length,
+                tok->optional,
+                tagap_script_lookup_index(tok->lookup_func),
+            };
+            h = tagap_script_cache_hash_more(h, layout, sizeof(layout));
+        }
+    }
+    for (u32 i = 0; i < TAGAP_SCRIPT_LOOKUP_COUNT; ++i)
+    {
+        for (u32 n = 0; n < TAGAP_SCRIPT_LOOKUPS[i].count; ++n)
+        {
+            const char *name = TAGAP_SCRIPT_LOOKUPS[i].names[n];
+            if (!name) name = "";
+            h = tagap_script_cache_hash_more(h, name, strlen(name) + 1);
+        }
+    }
 
-    // Finally, adjust the parser mode
-    if (status == 0 && ss->has_next_mode)
+    __atomic_store_n(&schema, h, __ATOMIC_RELAXED);
+    return h;
+}
+
+/* Get the cache file path of a script */
+static void
+tagap_script_cache_path(const char *fpath, char *out, size_t size)
+{
+    snprintf(out, size, "%s/%016" PRIx64 ".tsc",
+        TAGAP_CACHE_DIR, tagap_script_cache_hash(fpath, strlen(fpath)));
+}
+
+/* Get what the cache of a script needs to match */
+static i32
+tagap_script_cache_key(
+    const char *fpath,
+    struct tagap_script_cache_header *key)
+{
+    struct stat st;
+    if (stat(fpath, &st) < 0) return -1;
+
+    memset(key, 0, sizeof(struct tagap_script_cache_header));
+    memcpy(key->magic, TAGAP_SCRIPT_CACHE_MAGIC, sizeof(key->magic));
+    key->version = TAGAP_SCRIPT_CACHE_VERSION;
+    key->atom_count = _ATOM_COUNT;
+    key->cmd_size = sizeof(struct tagap_script_parsed_cmd);
+    key->schema_hash = tagap_script_cache_schema();
+    snprintf(key->src_path, sizeof(key->src_path), "%s", fpath);
+    key->src_mtime_ns =
+        (u64)st.st_mtim.tv_sec * 1000000000ull + (u64)st.st_mtim.tv_nsec;
+    key->src_size = st.st_size;
+    return 0;
+}
+
+/*
+ * Check that a cached command list only refers to commands, lookup values
+ * and strings that exist, so that a corrupt cache can't be read past its end
+ */
+static bool
+tagap_script_cache_check(const struct tagap_script_cache_header *h)
+{
+    const struct tagap_script_parsed_cmd *cmds = (const void *)(h + 1);
+    const char *strs = (const char *)(cmds + h->cmd_count);
+    for (u32 i = 0; i < h->cmd_count; ++i)
     {
-        tagap_script_set_parse_mode(ss, ss->next_mode);
-        ss->has_next_mode = false;
+        const struct tagap_script_parsed_cmd *c = &cmds[i];
+        if ((u32)c->atom <= ATOM_UNKNOWN || (u32)c->atom >= _ATOM_COUNT ||
+            c->tok_count > TAGAP_SCRIPT_MAX_TOKENS)
+        {
+            return false;
+        }
+
+        const struct tagap_script_command *cmd =
+            &TAGAP_SCRIPT_COMMANDS[c->atom];
+        for (u32 t = 0; t < c->tok_count; ++t)
+        {
+            const struct tagap_script_token *tok = &cmd->tokens[t];
+            u32 max_len = TAGAP_SCRIPT_STRING_TOKEN_MAX;
+            switch (tok->type)
+            {
+            case TSCRIPT_TOKEN_LOOKUP:
+            {
+                i32 l = tagap_script_lookup_index(tok->lookup_func);
+                if (l >= 0 && (c->tok[t].i < 0 ||
+                    (u32)c->tok[t].i >= TAGAP_SCRIPT_LOOKUPS[l].count))
+                {
+                    return false;
+                }
+            } continue;
+
+            case TSCRIPT_TOKEN_STRING:
+                max_len = min(max_len, tok->length);
+                break;
+            case TSCRIPT_TOKEN_ENTITY:
+            case TSCRIPT_TOKEN_THEME:
+                break;
+            default:
+                continue;
+            }
+
+            // Strings need to end within their length limit, and before the
+            // string storage does
+            u32 offset = c->tok[t].str;
+            if (offset >= h->strs_size ||
+                !memchr(&strs[offset], '\0',
+                    min(h->strs_size - offset, max_len)))
+            {
+                return false;
+            }
+        }
     }
-    return status;
+    return true;
 }
 
 /*
- * Run script from file
+ * Use the cached command list of a script if it is up to date.  Scripts whose
+ * modification time changed are hashed, so touching a file doesn't throw its
+ * cache away
  */
-i32
-tagap_script_run(const char *fpath)
+static i32
+tagap_script_cache_load(
+    const struct tagap_script_cache_header *key,
+    struct tagap_script_parsed *p)
+{
+    char path[512];
+    tagap_script_cache_path(key->src_path, path, sizeof(path));
+
+    i32 fd = open(path, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 ||
+        st.st_size < sizeof(struct tagap_script_cache_header))
+    {
+        close(fd);
+        return -1;
+    }
+
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return -1;
+
+    const struct tagap_script_cache_header *h = map;
+    if (memcmp(h->magic, key->magic, sizeof(h->magic)) != 0 ||
+        h->version != key->version ||
+        h->atom_count != key->atom_count ||
+        h->cmd_size != key->cmd_size ||
+        h->schema_hash != key->schema_hash ||
+        strnlen(h->src_path, sizeof(h->src_path)) == sizeof(h->src_path) ||
+        strcmp(h->src_path, key->src_path) != 0 ||
+        h->src_size != key->src_size ||
+        st.st_size != sizeof(struct tagap_script_cache_header) +
+            (size_t)h->cmd_count * h->cmd_size + h->strs_size)
+    {
+        goto stale;
+    }
+    if (!tagap_script_cache_check(h))
+    {
+        LOG_WARN("[tagap_script] cache '%s' is corrupt", path);
+        goto stale;
+    }
+
+    if (h->src_mtime_ns != key->src_mtime_ns)
+    {
+        struct tagap_script_lexer l;
+        if (tagap_script_lexer_open(&l, key->src_path) < 0) goto stale;
+        u64 hash = tagap_script_cache_hash(l.p, l.end - l.p);
+        tagap_script_lexer_close(&l);
+        if (hash != h->src_hash) goto stale;
+
+        // Same contents, so only the time needs updating; saves hashing the
+        // script again next time
+        fd = open(path, O_WRONLY);
+        if (fd >= 0)
+        {
+            if (pwrite(fd, &key->src_mtime_ns, sizeof(key->src_mtime_ns),
+                offsetof(struct tagap_script_cache_header, src_mtime_ns)) !=
+                sizeof(key->src_mtime_ns))
+            {
+                LOG_WARN("[tagap_script] failed to update cache '%s'", path);
+            }
+            close(fd);
+        }
+    }
+
+    // Use the commands straight from the mapping
+    p->map = map;
+    p->map_size = st.st_size;
+    p->cmds = (struct tagap_script_parsed_cmd *)(h + 1);
+    p->cmd_count = h->cmd_count;
+    p->strs = (char *)(p->cmds + h->cmd_count);
+    p->strs_size = h->strs_size;
+    return 0;
+
+stale:
+    munmap(map, st.st_size);
+    return -1;
+}
+
+/* Write the command list of a freshly parsed script to the cache */
+static void
+tagap_script_cache_save(
+    const struct tagap_script_cache_header *key,
+    const struct tagap_script_parsed *p)
+{
+    char path[512], tmp_path[520];
+    tagap_script_cache_path(key->src_path, path, sizeof(path));
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+    mkdir(TAGAP_CACHE_DIR, 0755);
+    FILE *fp = fopen(tmp_path, "wb");
+    if (!fp)
+    {
+        LOG_WARN("[tagap_script] failed to write cache '%s'", tmp_path);
+        return;
+    }
+
+    struct tagap_script_cache_header h = *key;
+    h.cmd_count = p->cmd_count;
+    h.strs_size = p->strs_size;
+
+    bool ok =
+        fwrite(&h, sizeof(h), 1, fp) == 1 &&
+        fwrite(p->cmds, sizeof(struct tagap_script_parsed_cmd),
+            p->cmd_count, fp) == p->cmd_count &&
+        fwrite(p->strs, 1, p->strs_size, fp) == p->strs_size;
+    ok = fclose(fp) == 0 && ok;
+
+    // Replace the old cache in one go, so that it is never seen half-written
+    if (!ok || rename(tmp_path, path) < 0)
+    {
+        LOG_WARN("[tagap_script] failed to write cache '%s'", path);
+        remove(tmp_path);
+    }
+}
+
+/*
+ * Parse a script file into a command list.  Doesn't touch any game state, so
+ * can be run on any thread
+ */
+static i32
+tagap_script_parse_file(const char *fpath, struct tagap_script_parsed *p)
 {
+    PROFILE_ZONE("tagap_script_parse_file");
+
     // Make sure that all defined atoms have strings
 #if DEBUG
     assert(sizeof(TAGAP_SCRIPT_COMMANDS) /
         sizeof(struct tagap_script_command) == _ATOM_COUNT);
 #endif
 
-    FILE *fp = fopen(fpath, "r");
-    if (!fp)
+    memset(p, 0, sizeof(struct tagap_script_parsed));
+    snprintf(p->fname, sizeof(p->fname), "%s", fpath);
+
+    struct tagap_script_cache_header key;
+    bool cacheable = tagap_script_cache_key(fpath, &key) == 0;
+    if (cacheable && tagap_script_cache_load(&key, p) == 0)
+    {
+        return p->status = 0;
+    }
+
+    struct tagap_script_lexer l;
+    if (tagap_script_lexer_open(&l, fpath) < 0)
     {
         LOG_ERROR("[tagap_script] failed to read script '%s' (%d)",
             fpath, errno);
-        return -1;
+        return p->status = -1;
     }
+    key.src_hash = tagap_script_cache_hash(l.p, l.end - l.p);
 
-    LOG_INFO("running script '%s'", fpath);
-
-    // Create state
+    // State is only used for error messages here
     struct tagap_script_state ss;
     tagap_script_new_state(&ss);
 
 #ifdef DEBUG
     ss.line_num = 1;
-    strcpy(ss.fname, fpath);
+    strcpy(ss.fname, p->fname);
 #endif
 
-    // Read the script file line by line
-    size_t len = 0, ltmp;
-    for (char *line = NULL;
-        (len = getline(&line, &ltmp, fp)) != -1;
+    // Read the script file line by line.  The command name is the extra
+    // token
+    struct tagap_script_span toks[TAGAP_SCRIPT_MAX_TOKENS + 1];
+    for (i32 tok_count;
+        (tok_count = tagap_script_lex_line(
+            &l, toks, TAGAP_SCRIPT_MAX_TOKENS + 1)) >= 0;
         ++ss.line_num)
     {
-        // Strip newline
-        if (line[len - 1] == '\n') line[len - 2] = '\0';
+        tagap_script_add_line(&ss, p, toks, tok_count);
+    }
+
+    tagap_script_lexer_close(&l);
+    if (cacheable) tagap_script_cache_save(&key, p);
+    return p->status = 0;
+}
+
+/*
+ * Run a parsed command
+ */
+static i32
+tagap_script_apply_cmd(
+    struct tagap_script_state *ss,
+    const struct tagap_script_parsed *p,
+    const struct tagap_script_parsed_cmd *c)
+{
+    const struct tagap_script_command *cmd = &TAGAP_SCRIPT_COMMANDS[c->atom];
+    ss->line_num = c->line_num;
+
+    // Make sure that we are in the right parsing mode
+    if (cmd->requires_mode && ss->mode != cmd->required_mode)
+    {
+        SCRIPT_ERROR("cannot parse command '%s' "
+            "because parse mode '%d' not satisfied (is %d)",
+            cmd->name, cmd->required_mode, ss->mode);
+        return -1;
+    }
+
+    // Zero all the tokens so that unspecified optional parameters don't cause
+    // issues
+    memset(ss->tok, 0, sizeof(union tagap_script_token_value));
+    ss->tok_count = c->tok_count;
+
+    // Fill in the token values, looking up any names
+    for (u32 i = 0; i < c->tok_count; ++i)
+    {
+        union tagap_script_token_value *v = &ss->tok[i];
+        switch(cmd->tokens[i].type)
+        {
+        case TSCRIPT_TOKEN_INT:
+        case TSCRIPT_TOKEN_LOOKUP:
+            v->i = c->tok[i].i;
+            break;
+        case TSCRIPT_TOKEN_FLOAT:
+            v->f = c->tok[i].f;
+            break;
+        case TSCRIPT_TOKEN_BOOL:
+            v->b = c->tok[i].b;
+            break;
+        case TSCRIPT_TOKEN_STRING:
+            strcpy(v->str, &p->strs[c->tok[i].str]);
+            break;
+
+        // Special: token is name of an entity
+        case TSCRIPT_TOKEN_ENTITY:
+        {
+            const char *name = &p->strs[c->tok[i].str];
+            i32 index = intern_map_find(g_level->entity_names, name);
+            v->e = index >= 0 ? &g_level->entity_infos[index] : NULL;
+            if (!v->e)
+            {
+                SCRIPT_WARN("entity '%s' not found", name);
+                return -1;
+            }
+        } break;
+
+        // Special: token is name of a theme
+        case TSCRIPT_TOKEN_THEME:
+        {
+            const char *name = &p->strs[c->tok[i].str];
+            i32 index = intern_map_find(g_level->theme_names, name);
+            v->t = index >= 0 ? &g_level->theme_infos[index] : NULL;
+            if (!v->t)
+            {
+                SCRIPT_WARN("theme '%s' not found", name);
+                return -1;
+            }
+            LOG_SCRIPT("found info for theme %s", name);
+        } break;
+        }
+    }
+
+    if (cmd->sets_mode)
+    {
+        ss->has_next_mode = true;
+        ss->next_mode = cmd->sets_mode_to;
+    }
+
+    // Run parsed command
+    i32 status = tagap_script_run_cmd_in_state(c->atom, ss);
+
+    // Finally, adjust the parser mode
+    if (status == 0 && ss->has_next_mode)
+    {
+        tagap_script_set_parse_mode(ss, ss->next_mode);
+        ss->has_next_mode = false;
+    }
+    return status;
+}
+
+/* Run the commands of a parsed script */
+static void
+tagap_script_apply(const struct tagap_script_parsed *p)
+{
+    PROFILE_ZONE("tagap_script_apply");
+
+    LOG_INFO("running script '%s'", p->fname);
+
+    struct tagap_script_state ss;
+    tagap_script_new_state(&ss);
+
+#ifdef DEBUG
+    strcpy(ss.fname, p->fname);
+#endif
+
+    for (u32 i = 0; i < p->cmd_count; ++i)
+    {
+        tagap_script_apply_cmd(&ss, p, &p->cmds[i]);
+    }
+}
+
+/*
+ * Parse and run a command string
+ */
+i32
+tagap_script_run_cmd(
+    struct tagap_script_state *ss,
+    const char *cmd,
+    size_t cmd_len)
+{
+    struct tagap_script_lexer l;
+    struct tagap_script_span toks[TAGAP_SCRIPT_MAX_TOKENS + 1];
+
+    tagap_script_lexer_open_string(&l, cmd, cmd_len);
+    i32 tok_count =
+        tagap_script_lex_line(&l, toks, TAGAP_SCRIPT_MAX_TOKENS + 1);
+    if (tok_count < 0) return 0;
+
+    struct tagap_script_parsed p;
+    memset(&p, 0, sizeof(struct tagap_script_parsed));
+    struct tagap_script_parsed_cmd c;
+
+    // Blank lines and comments parse to no command, and aren't errors
+    i32 status = tagap_script_parse_cmd(ss, toks, tok_count, &p, &c);
+    if (status > 0)
+    {
+        c.line_num = ss->line_num;
+        status = tagap_script_apply_cmd(ss, &p, &c);
+    }
+    tagap_script_parsed_free(&p);
+    return status;
+}
+
+/*
+ * Run script from file
+ */
+i32
+tagap_script_run(const char *fpath)
+{
+    PROFILE_ZONE("tagap_script_run");
+
+    struct tagap_script_parsed p;
+    if (tagap_script_parse_file(fpath, &p) < 0)
+    {
+        tagap_script_parsed_free(&p);
+        return -1;
+    }
+
+    tagap_script_apply(&p);
+    tagap_script_parsed_free(&p);
+    return 0;
+}
+
+static void
+tagap_script_parse_job(u32 i, void *user)
+{
+    struct tagap_script_parsed *parsed = user;
+
+    // Parsing clears the file name, so keep a copy
+    char fname[sizeof(parsed[i].fname)];
+    strcpy(fname, parsed[i].fname);
+    tagap_script_parse_file(fname, &parsed[i]);
+}
+
+/*
+ * Run all scripts in a directory.  They are parsed in parallel, then run in
+ * the order that the directory lists them, so that scripts referring to each
+ * other's definitions behave as if they were run one by one
+ */
+i32
+tagap_script_run_dir(const char *path)
+{
+    PROFILE_ZONE("tagap_script_run_dir");
 
-        // Parse and run the command
-        tagap_script_run_cmd(&ss, line, len);
+    struct dirent *dp;
+    DIR *dfd;
+
+    if (!(dfd = opendir(path)))
+    {
+        LOG_ERROR("[tagap_script] cannot open directory '%s'", path);
+        return -1;
     }
 
-    fclose(fp);
+    // Collect the script files
+    struct tagap_script_parsed *parsed = NULL;
+    u32 count = 0, capacity = 0;
+    char filename[512];
+    for (; (dp = readdir(dfd)) != NULL;)
+    {
+        struct stat stbuf;
+        snprintf(filename, sizeof(filename), "%s/%s", path, dp->d_name);
+        if (stat(filename, &stbuf) == -1)
+        {
+            LOG_WARN("[tagap_script] cannot stat file '%s'", filename);
+            continue;
+        }
 
+        // Skip directories
+        if ((stbuf.st_mode & S_IFMT) == S_IFDIR) continue;
+
+        if (count == capacity)
+        {
+            capacity = max(capacity * 2, 64u);
+            parsed = realloc(parsed,
+                capacity * sizeof(struct tagap_script_parsed));
+        }
+        snprintf(parsed[count++].fname, sizeof(parsed[0].fname),
+            "%s", filename);
+    }
+    closedir(dfd);
+
+    // Parse everything, then run the scripts one after the other
+    jobs_parallel_for(count, tagap_script_parse_job, parsed);
+    for (u32 i = 0; i < count; ++i)
+    {
+        if (parsed[i].status == 0) tagap_script_apply(&parsed[i]);
+        tagap_script_parsed_free(&parsed[i]);
+    }
+    free(parsed);
     return 0;
 }
 
 /*
- * Parse a string of TAGAP_Script
+ * Parse a line of TAGAP_Script.  Returns the command atom, 0 if there was no
+ * command on the line, or -1 on error
  */
-static enum tagap_script_atom_id
+static i32
 tagap_script_parse_cmd(
     struct tagap_script_state *ss,
-    const char *cmd_str,
-    size_t cmd_len)
+    const struct tagap_script_span *toks,
+    i32 tok_count,
+    struct tagap_script_parsed *p,
+    struct tagap_script_parsed_cmd *c)
 {
-    if (cmd_len < 1 || cmd_str[0] == '/') return 0;
-    strcpy(ss->tmp, cmd_str);
+    // Skip blank lines and comments
+    if (tok_count < 1 || toks[0].s[0] == '/') return 0;
 
-    // Get the first token in the string, this is our command ID
-    char *token = strtok(ss->tmp, " ");
-    if (token == NULL) return -1;
+    // First token is our command ID
+    char name[sizeof(TAGAP_SCRIPT_COMMANDS[0].name)];
+    if (!tagap_script_span_to_str(toks[0], name, sizeof(name))) return -1;
 
-    // Get info about the command we are parsing.  We store parsed token values
-    // in here too
+    // Get info about the command we are parsing
     enum tagap_script_atom_id atom;
-    struct tagap_script_command cmd =
-        tagap_script_lookup_command(token, &atom);
+    const struct tagap_script_command *cmd =
+        tagap_script_lookup_command(name, &atom);
     if (atom == ATOM_UNKNOWN)
     {
         // Unknown/unimplemented command
         return -1;
     }
 
-    // Make sure that we are in the right parsing mode
-    if (cmd.requires_mode && ss->mode != cmd.required_mode)
-    {
-        SCRIPT_ERROR("cannot parse command '%s' "
-            "because parse mode '%d' not satisfied (is %d)",
-            cmd.name, cmd.required_mode, ss->mode);
-        return -1;
-    }
+    // Parameters follow the command name
+    ++toks;
+    --tok_count;
 
     {
         // Get minimum number of tokens we need to successfully parse
-        u32 min_tok_count = cmd.token_count;
-        if (min_tok_count > 0 && cmd.tokens[min_tok_count - 1].optional)
+        u32 min_tok_count = cmd->token_count;
+        if (min_tok_count > 0 && cmd->tokens[min_tok_count - 1].optional)
         {
             // Last parameter is optional.
             --min_tok_count;
         }
 
-        // Count number of tokens in the string and make sure they are
-        // sufficient
-        u32 tok_count = 0;
-        const char *tmpptr = cmd_str;
-        for (;(tmpptr = strchr(tmpptr, ' ')) != NULL; ++tok_count, ++tmpptr);
+        // Make sure there are sufficient tokens
         if (tok_count < min_tok_count)
         {
             SCRIPT_ERROR("parse fail: token count (%d) does not meet "
                 "minimum of %d tokens (%s)",
-                tok_count, min_tok_count, cmd.name);
+                tok_count, min_tok_count, cmd->name);
             return -1;
         }
     }
 
-    // Zero all the tokens so that unspecified optional parameters don't cause
-    // issues
-    memset(ss->tok, 0, sizeof(union tagap_script_token_value));
-    ss->tok_count = 0;
+    c->atom = atom;
+    c->tok_count = min(tok_count, TAGAP_SCRIPT_MAX_TOKENS);
 
     // Now iterate over the tokens/parameters in the command
-    for (token = strtok(NULL, " ");
-        token != NULL;
-        token = strtok(NULL, " "))
+    for (i32 tok_index = 0; tok_index < c->tok_count; ++tok_index)
     {
-        i32 tok_index = ss->tok_count;
-        union tagap_script_token_value *v = &ss->tok[tok_index];
-        ++ss->tok_count;
-
-        // Used for strtof, strtod, etc. error checking
-        char *tmp_ptr;
+        struct tagap_script_span t = toks[tok_index];
 
         // Convert token to appropriate types and store in the parser for
         // proper parsing
-        switch(cmd.tokens[tok_index].type)
+        switch(cmd->tokens[tok_index].type)
         {
         // Token is an integer
         case TSCRIPT_TOKEN_INT:
         {
-            v->i = strtol(token, &tmp_ptr, 10);
-            if (v->i == 0 && tmp_ptr == token)
+            if (!tagap_script_span_to_i32(t, &c->tok[tok_index].i))
             {
-                SCRIPT_ERROR("error parsing 'int' token: '%s'", token);
+                SCRIPT_ERROR("error parsing 'int' token: '%.*s'",
+                    (i32)t.len, t.s);
                 return -1;
             }
         } break;
@@ -203,10 +858,10 @@ tagap_script_parse_cmd(
         // Token is floating-point
         case TSCRIPT_TOKEN_FLOAT:
         {
-            v->f = strtof(token, &tmp_ptr);
-            if (v->f == 0.0f && tmp_ptr == token)
+            if (!tagap_script_span_to_f32(t, &c->tok[tok_index].f))
             {
-                SCRIPT_ERROR("error parsing 'float' token: '%s'", token);
+                SCRIPT_ERROR("error parsing 'float' token: '%.*s'",
+                    (i32)t.len, t.s);
                 return -1;
             }
         } break;
@@ -214,94 +869,60 @@ tagap_script_parse_cmd(
         // Token is boolean
         case TSCRIPT_TOKEN_BOOL:
         {
-            v->b = (bool)!!strtol(token, &tmp_ptr, 10);
-            if (v->b == 0 && tmp_ptr == token)
+            i32 i;
+            if (!tagap_script_span_to_i32(t, &i))
             {
-                SCRIPT_ERROR("error parsing 'bool' token: '%s'", token);
+                SCRIPT_ERROR("error parsing 'bool' token: '%.*s'",
+                    (i32)t.len, t.s);
                 return -1;
             }
+            c->tok[tok_index].b = (bool)!!i;
         } break;
 
         // Token is a string
         case TSCRIPT_TOKEN_STRING:
         {
-            size_t slen = strlen(token);
-            if (slen >= TAGAP_SCRIPT_STRING_TOKEN_MAX ||
-                slen >= cmd.tokens[tok_index].length)
+            if (t.len >= TAGAP_SCRIPT_STRING_TOKEN_MAX ||
+                t.len >= cmd->tokens[tok_index].length)
             {
-                SCRIPT_ERROR("'string' token '%s' is too long", token);
+                SCRIPT_ERROR("'string' token '%.*s' is too long",
+                    (i32)t.len, t.s);
                 return -1;
             }
-
-            // Just copy the string
-            strcpy(v->str, token);
+            c->tok[tok_index].str = tagap_script_add_str(p, t);
         } break;
 
         // Special: token is an enum value that needs to be looked up
         case TSCRIPT_TOKEN_LOOKUP:
         {
-            if (!cmd.tokens[tok_index].lookup_func)
+            if (!cmd->tokens[tok_index].lookup_func)
             {
-                SCRIPT_ERROR("lookup_func for '%s' not defined", cmd.name);
+                SCRIPT_ERROR("lookup_func for '%s' not defined", cmd->name);
                 return -1;
             }
 
             // Set the integer to the lookup-up value
-            v->i = cmd.tokens[tok_index].lookup_func(token);
+            char str[TAGAP_SCRIPT_STRING_TOKEN_MAX];
+            c->tok[tok_index].i =
+                tagap_script_span_to_str(t, str, sizeof(str)) ?
+                cmd->tokens[tok_index].lookup_func(str) : 0;
         } break;
 
-        // Special: token is name of an entity
+        // Special: names of entities and themes are looked up when the
+        // command is run
         case TSCRIPT_TOKEN_ENTITY:
-        {
-            // Search for the entity info in the entity list
-            v->e = NULL;
-            for (u32 i = 0; i < g_level->entity_info_count; ++i)
-            {
-                struct tagap_entity_info *e = &g_level->entity_infos[i];
-                if (strcmp(e->name, token) == 0)
-                {
-                    v->e = e;
-                    //LOG_SCRIPT("found info for entity %s", token);
-                    break;
-                }
-            }
-            if (!v->e)
-            {
-                SCRIPT_WARN("entity '%s' not found", token);
-                return -1;
-            }
-        } break;
-
-        // Special: token is name of a theme
         case TSCRIPT_TOKEN_THEME:
         {
-            // Search for the theme info in the theme list
-            v->t = NULL;
-            for (u32 i = 0; i < g_level->theme_info_count; ++i)
+            if (t.len >= TAGAP_SCRIPT_STRING_TOKEN_MAX)
             {
-                struct tagap_theme_info *t = &g_level->theme_infos[i];
-                if (strcmp(t->name, token) == 0)
-                {
-                    v->t = t;
-                    LOG_SCRIPT("found info for theme %s", token);
-                    break;
-                }
-            }
-            if (!v->t)
-            {
-                SCRIPT_WARN("theme '%s' not found", token);
+                SCRIPT_WARN("name '%.*s' is too long", (i32)t.len, t.s);
                 return -1;
             }
+            c->tok[tok_index].str = tagap_script_add_str(p, t);
         } break;
         }
     }
 
-    if (cmd.sets_mode)
-    {
-        ss->has_next_mode = true;
-        ss->next_mode = cmd.sets_mode_to;
-    }
-
     return atom;
 }
 
@@ -329,23 +950,17 @@ tagap_script_run_cmd_in_state(
             strcpy(g_map->title, value);
             break;
         case CVAR_MAP_SCHEME:
+        {
             LOG_SCRIPT("CVAR: map scheme is %s", value);
 
             // Find theme with given name
-            g_map->theme = NULL;
-            for (u32 i = 0; i < g_level->theme_info_count; ++i)
-            {
-                if (strcmp(g_level->theme_infos[i].name, value) == 0)
-                {
-                    g_map->theme = &g_level->theme_infos[i];
-                    break;
-                }
-            }
+            i32 i = intern_map_find(g_level->theme_names, value);
+            g_map->theme = i >= 0 ? &g_level->theme_infos[i] : NULL;
             if (!g_map->theme)
             {
                 SCRIPT_WARN("CVAR: no such theme '%s'", value);
             }
-            break;
+        } break;
         case CVAR_SND_SONG:
             LOG_SCRIPT("CVAR: map song is %s", value);
             break;
@@ -424,6 +1039,8 @@ tagap_script_run_cmd_in_state(
             &g_level->theme_infos[g_level->theme_info_count++];
         memset(t, 0, sizeof(struct tagap_theme_info));
         strcpy(t->name, ss->tok[0].str);
+        intern_map_add(g_level->theme_names, t->name,
+            g_level->theme_info_count - 1);
     } break;
 
     // End theme definition
@@ -471,6 +1088,8 @@ tagap_script_run_cmd_in_state(
             &g_level->entity_infos[g_level->entity_info_count++];
         memset(e, 0, sizeof(struct tagap_entity_info));
         strcpy(e->name, ss->tok[0].str);
+        intern_map_add(g_level->entity_names, e->name,
+            g_level->entity_info_count - 1);
     } break;
 
     // End of entity definition
@@ -534,15 +1153,9 @@ tagap_script_run_cmd_in_state(
 
         // Check global list if sprite info has already been added , so we can
         // reuse it (and hence avoid re-reading it's frames, etc.)
-        struct tagap_sprite_info *info = NULL;
-        for (u32 i = 0; i < g_level->sprite_info_count; ++i)
-        {
-            if (strcmp(g_level->sprite_infos[i].name, ss->tok[5].str) == 0)
-            {
-                info = &g_level->sprite_infos[i];
-                break;
-            }
-        }
+        i32 spr_index = intern_map_find(g_level->sprite_names, ss->tok[5].str);
+        struct tagap_sprite_info *info =
+            spr_index >= 0 ? &g_level->sprite_infos[spr_index] : NULL;
         if (!info)
         {
             // Sprite has not been added to the list yet, so let's add it.
@@ -562,6 +1175,8 @@ tagap_script_run_cmd_in_state(
             memset(info, 0, sizeof(struct tagap_sprite_info));
             strcpy(g_level->sprite_infos[spr_index_global].name,
                 ss->tok[5].str);
+            intern_map_add(g_level->sprite_names, info->name,
+                spr_index_global);
         }
 
         // Get sprite in the entity info list
@@ -93,15 +93,13 @@ struct tagap_script_state
     bool has_next_mode;
     enum tagap_script_parse_mode next_mode;
 
-    // Used for line storage
-    char tmp[256];
-
     // For debugging.  Set to -1 for non-file commands
     i32 line_num;
     char fname[256];
 };
 
 i32 tagap_script_run(const char *fpath);
+i32 tagap_script_run_dir(const char *);
 i32 tagap_script_run_cmd(
     struct tagap_script_state *, const char *, size_t);
 
@@ -593,25 +593,28 @@ TAGAP_SCRIPT_COMMANDS[] =
 /*
  * Lookup a command by name
  */
-static inline struct tagap_script_command
+static inline const struct tagap_script_command *
 tagap_script_lookup_command(
     const char *a,
     enum tagap_script_atom_id *atom)
 {
-    for (enum tagap_script_atom_id i = ATOM_UNKNOWN + 1;
-        i < _ATOM_COUNT;
-        ++i)
+    static struct lookup_table table;
+    if (lookup_table_begin(&table))
     {
-        if (strcmp(TAGAP_SCRIPT_COMMANDS[i].name, a) == 0)
+        assert(_ATOM_COUNT <= LOOKUP_TABLE_SIZE / 2);
+        for (enum tagap_script_atom_id i = ATOM_UNKNOWN + 1;
+            i < _ATOM_COUNT;
+            ++i)
         {
-            if (atom) *atom = i;
-            return TAGAP_SCRIPT_COMMANDS[i];
+            lookup_table_insert(&table, TAGAP_SCRIPT_COMMANDS[i].name, i);
         }
+        lookup_table_ready(&table);
     }
 
-    // Could not find command
-    if (atom) *atom = 0;
-    return TAGAP_SCRIPT_COMMANDS[0];
+    // Unknown commands get the empty command at index 0
+    i32 i = max(lookup_table_find(&table, a), 0);
+    if (atom) *atom = i;
+    return &TAGAP_SCRIPT_COMMANDS[i];
 }
 
 #endif
@@ -0,0 +1,191 @@
+#include "pch.h"
+#include "tagap_script_lexer.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+
+/* Map a script file for lexing */
+i32
+tagap_script_lexer_open(struct tagap_script_lexer *l, const char *fpath)
+{
+    memset(l, 0, sizeof(struct tagap_script_lexer));
+
+    i32 fd = open(fpath, O_RDONLY);
+    if (fd < 0) return -1;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    // Can't map empty files, but there is nothing to lex in them anyway
+    if (st.st_size > 0)
+    {
+        l->map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (l->map == MAP_FAILED)
+        {
+            l->map = NULL;
+            close(fd);
+            return -1;
+        }
+        l->map_size = st.st_size;
+        madvise(l->map, l->map_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    l->p = l->map;
+    l->end = l->p + l->map_size;
+    return 0;
+}
+
+/* Lex a string (not copied, so it must outlive the lexer) */
+void
+tagap_script_lexer_open_string(
+    struct tagap_script_lexer *l,
+    const char *str,
+    size_t len)
+{
+    memset(l, 0, sizeof(struct tagap_script_lexer));
+    l->p = str;
+    l->end = str + len;
+}
+
+void
+tagap_script_lexer_close(struct tagap_script_lexer *l)
+{
+    if (l->map) munmap(l->map, l->map_size);
+    memset(l, 0, sizeof(struct tagap_script_lexer));
+}
+
+/*
+ * Read the tokens on the next line, storing up to max of them.  Returns the
+ * number of tokens on the line (which may be more than max), or -1 at the end
+ * of the input
+ */
+i32
+tagap_script_lex_line(
+    struct tagap_script_lexer *l,
+    struct tagap_script_span *toks,
+    u32 max)
+{
+    if (l->p >= l->end) return -1;
+
+    const char *p = l->p, *end = l->end;
+    i32 count = 0;
+    for (;;)
+    {
+        // Skip separators.  Lines end in CRLF in the original game data
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\r')) ++p;
+        if (p >= end || *p == '\n') break;
+
+        const char *start = p;
+        while (p < end && *p != ' ' && *p != '\t' && *p != '\r' && *p != '\n')
+        {
+            ++p;
+        }
+
+        if (count < max)
+        {
+            toks[count] = (struct tagap_script_span)
+            {
+                .s = start,
+                .len = (u32)(p - start),
+            };
+        }
+        ++count;
+    }
+
+    // Step over the newline
+    l->p = p < end ? p + 1 : p;
+    return count;
+}
+
+/*
+ * Parse leading integer of token, like strtol.  Returns false if the token
+ * does not start with a number
+ */
+bool
+tagap_script_span_to_i32(struct tagap_script_span t, i32 *out)
+{
+    const char *p = t.s, *end = t.s + t.len;
+
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+
+    const char *digits = p;
+    i64 v = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p)
+    {
+        v = v * 10 + (*p - '0');
+        if (v > (i64)INT32_MAX + 1) v = (i64)INT32_MAX + 1;
+    }
+    if (p == digits) return false;
+
+    v = neg ? -v : v;
+    *out = (i32)clamp(v, (i64)INT32_MIN, (i64)INT32_MAX);
+    return true;
+}
+
+/*
+ * Parse leading float of token, like strtof.  Plain decimals are handled
+ * directly; anything else (exponents, inf, very long numbers) goes through
+ * strtof
+ */
+bool
+tagap_script_span_to_f32(struct tagap_script_span t, f32 *out)
+{
+    const char *p = t.s, *end = t.s + t.len;
+
+    bool neg = false;
+    if (p < end && (*p == '-' || *p == '+')) neg = *p++ == '-';
+
+    u64 mantissa = 0;
+    i32 digit_count = 0, frac_count = 0;
+    for (; p < end && *p >= '0' && *p <= '9'; ++p, ++digit_count)
+    {
+        mantissa = mantissa * 10 + (*p - '0');
+    }
+    if (p < end && *p == '.')
+    {
+        for (++p; p < end && *p >= '0' && *p <= '9'; ++p, ++frac_count)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+        }
+    }
+    digit_count += frac_count;
+
+    // Fast path when the digits and power of ten are both exact in a float,
+    // so that one correctly rounded division gives the same result as strtof
+    if (digit_count > 0 && digit_count <= 15 &&
+        mantissa < (1u << 24) && frac_count <= 10 &&
+        (p >= end || (*p != 'e' && *p != 'E')))
+    {
+        static const f32 POW10[] =
+        {
+            1e0f, 1e1f, 1e2f, 1e3f, 1e4f, 1e5f,
+            1e6f, 1e7f, 1e8f, 1e9f, 1e10f,
+        };
+        f32 v = (f32)mantissa / POW10[frac_count];
+        *out = neg ? -v : v;
+        return true;
+    }
+
+    // Slow path
+    char tmp[64];
+    if (!tagap_script_span_to_str(t, tmp, sizeof(tmp))) return false;
+    char *tmp_end;
+    *out = strtof(tmp, &tmp_end);
+    return tmp_end != tmp;
+}
+
+/* Copy token into a null-terminated string.  Returns false if too long */
+bool
+tagap_script_span_to_str(struct tagap_script_span t, char *out, size_t size)
+{
+    if (t.len >= size) return false;
+    memcpy(out, t.s, t.len);
+    out[t.len] = '\0';
+    return true;
+}
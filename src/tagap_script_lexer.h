@@ -0,0 +1,42 @@
+#ifndef TAGAP_SCRIPT_LEXER_H
+#define TAGAP_SCRIPT_LEXER_H
+
+#include "types.h"
+
+/*
+ * tagap_script_lexer.h
+ *
+ * Splits TAGAP_Script into lines of tokens.  Script files are memory-mapped
+ * and tokens point straight into the mapping, so nothing is copied.  All
+ * state lives in the lexer struct, so any number of scripts can be lexed at
+ * once.
+ */
+
+// Token; NOT null-terminated
+struct tagap_script_span
+{
+    const char *s;
+    u32 len;
+};
+
+struct tagap_script_lexer
+{
+    const char *p, *end;
+
+    // File mapping, if the lexer was opened on a file
+    void *map;
+    size_t map_size;
+};
+
+i32 tagap_script_lexer_open(struct tagap_script_lexer *, const char *);
+void tagap_script_lexer_open_string(
+    struct tagap_script_lexer *, const char *, size_t);
+void tagap_script_lexer_close(struct tagap_script_lexer *);
+i32 tagap_script_lex_line(
+    struct tagap_script_lexer *, struct tagap_script_span *, u32);
+
+bool tagap_script_span_to_i32(struct tagap_script_span, i32 *);
+bool tagap_script_span_to_f32(struct tagap_script_span, f32 *);
+bool tagap_script_span_to_str(struct tagap_script_span, char *, size_t);
+
+#endif
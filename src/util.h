@@ -16,21 +16,105 @@
         } \
     })
 
+/*
+ * Small open-addressed hash table mapping names to their index in a name
+ * list.  Built once on first use, and safe to build from several threads
+ */
+#define LOOKUP_TABLE_SIZE 128
+
+struct lookup_table
+{
+    // 0 = not built, 1 = being built, 2 = ready
+    u32 state;
+    struct
+    {
+        const char *name;
+        i32 index;
+    } slots[LOOKUP_TABLE_SIZE];
+};
+
+// FNV-1a
+static inline u32
+hash_str(const char *s)
+{
+    u32 h = 2166136261u;
+    for (; *s; ++s) h = (h ^ (u8)*s) * 16777619u;
+    return h;
+}
+
+static inline void
+lookup_table_insert(struct lookup_table *t, const char *name, i32 index)
+{
+    if (!name) return;
+    for (u32 i = hash_str(name);; ++i)
+    {
+        i &= LOOKUP_TABLE_SIZE - 1;
+        if (!t->slots[i].name)
+        {
+            t->slots[i].name = name;
+            t->slots[i].index = index;
+            return;
+        }
+
+        // Keep the first of any duplicate names
+        if (strcmp(t->slots[i].name, name) == 0) return;
+    }
+}
+
+/*
+ * Wait for the table to be ready; returns true if the caller should build it
+ * (and then call lookup_table_ready)
+ */
+static inline bool
+lookup_table_begin(struct lookup_table *t)
+{
+    u32 expected = 0;
+    if (__atomic_load_n(&t->state, __ATOMIC_ACQUIRE) == 2) return false;
+    if (__atomic_compare_exchange_n(&t->state, &expected, 1, false,
+        __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE))
+    {
+        return true;
+    }
+    while (__atomic_load_n(&t->state, __ATOMIC_ACQUIRE) != 2);
+    return false;
+}
+
+static inline void
+lookup_table_ready(struct lookup_table *t)
+{
+    __atomic_store_n(&t->state, 2, __ATOMIC_RELEASE);
+}
+
+// Returns index of name, or -1 if it is not in the table
+static inline i32
+lookup_table_find(const struct lookup_table *t, const char *name)
+{
+    for (u32 i = hash_str(name);; ++i)
+    {
+        i &= LOOKUP_TABLE_SIZE - 1;
+        if (!t->slots[i].name) return -1;
+        if (strcmp(t->slots[i].name, name) == 0) return t->slots[i].index;
+    }
+}
+
 // Useful macro to create lookup functions for enum types
 // Also contains an assert to avoid serious issues
 #define CREATE_LOOKUP_FUNC(func_name, names, count) \
     static inline i32 \
     func_name (const char *x) \
     { \
-        assert(sizeof((names)) / sizeof(const char *) == (count)); \
-        for (i32 i = 0; i < (count); ++i) \
+        static struct lookup_table table; \
+        if (lookup_table_begin(&table)) \
         { \
-            if (strcmp(x, (names)[i]) == 0)\
+            assert(sizeof((names)) / sizeof(const char *) == (count)); \
+            assert((count) <= LOOKUP_TABLE_SIZE / 2); \
+            for (i32 i = 0; i < (count); ++i) \
             { \
-                return i;\
+                lookup_table_insert(&table, (names)[i], i); \
             } \
+            lookup_table_ready(&table); \
         } \
-        return 0; \
+        return max(lookup_table_find(&table, x), 0); \
     }
 
 // Get max of two scalars
@@ -2,74 +2,91 @@
 #include "vulkan_renderer.h"
 #include "vertex_buffer.h"
 
-i32
-vb_new(struct vbuffer *vb, const void *vertices, size_t size)
+// Shared buffer that all static vertices live in
+static struct
 {
-    memset(vb, 0, sizeof(struct vbuffer));
+    VkBuffer buf;
+    VmaAllocation alloc;
+    size_t size, used;
 
-    /*
-     * Create staging buffer for transfer of vertex data
-     */
-    //LOG_DBUG("[vulkan] creating staging buffer");
-    VkBuffer staging_buf;
-    VmaAllocation staging_buf_alloc;
-    if (vulkan_create_buffer(
-        (VkDeviceSize)size,
-        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-        VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
-        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT |
-            VMA_ALLOCATION_CREATE_MAPPED_BIT,
-        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
-            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-        &staging_buf, &staging_buf_alloc) < 0)
-    {
-        LOG_ERROR("[vbuffer] failed to create staging buffer");
-        return -1;
-    }
+    // Where the current level's vertices start
+    size_t mark;
+} heap;
+
+/* Create the shared vertex heap */
+i32
+vb_heap_init(size_t size)
+{
+    memset(&heap, 0, sizeof(heap));
+    if (g_vulkan->headless) return 0;
 
-    /*
-     * Map vertex data into staging buffer
-     */
-    void *data;
-    vmaMapMemory(g_vulkan->vma, staging_buf_alloc, &data);
-    memcpy(data, vertices, size);
-    vmaUnmapMemory(g_vulkan->vma, staging_buf_alloc);
-
-    /*
-     * Create vertex buffer.
-     * We specify that it's used as destination of transfer, and as a vertex
-     * buffer
-     */
-    //LOG_DBUG("[vulkan] creating vertex buffer");
     if (vulkan_create_buffer(
         (VkDeviceSize)size,
         VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
         VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
         0,
         VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-        &vb->vk_buffer, &vb->vma_alloc) < 0)
+        &heap.buf, &heap.alloc) < 0)
     {
-        LOG_ERROR("[vbuffer] failed to create vertex buffer");
-        goto fail;
+        LOG_ERROR("[vbuffer] failed to create vertex heap");
+        return -1;
     }
+    heap.size = size;
+    return 0;
+}
 
-    // Copy staging buffer to vertex buffer
-    if (vulkan_copy_buffer(staging_buf, vb->vk_buffer, size) < 0)
+void
+vb_heap_deinit(void)
+{
+    if (g_vulkan->headless) return;
+    vmaDestroyBuffer(g_vulkan->vma, heap.buf, heap.alloc);
+    memset(&heap, 0, sizeof(heap));
+}
+
+/* Keep everything allocated so far when the heap is reset */
+void
+vb_heap_mark(void) { heap.mark = heap.used; }
+
+/* Free every vertex buffer allocated since the mark at once */
+void
+vb_heap_reset(void) { heap.used = heap.mark; }
+
+/* Buffer that the heap's vertexs are in (for binding all of them at once) */
+VkBuffer
+vb_heap_buffer(void) { return heap.buf; }
+
+i32
+vb_new(struct vbuffer *vb, const void *vertices, size_t size, size_t stride)
+{
+    memset(vb, 0, sizeof(struct vbuffer));
+
+    if (g_vulkan->headless)
     {
-        LOG_ERROR("[vbuffer] failed to copy staging buffer to vertex buffer");
-        goto fail;
+        vb->size = size;
+        return 0;
     }
 
-    // Free the staging buffer as we no longer need it
-    vmaDestroyBuffer(g_vulkan->vma, staging_buf, staging_buf_alloc);
+    // Start on a whole vertex so the offset can be given to the draw
+    size_t offset = (heap.used + stride - 1) / stride * stride;
+    if (offset + size > heap.size)
+    {
+        LOG_ERROR("[vbuffer] vertex heap (%zu bytes) is full", heap.size);
+        return -1;
+    }
+
+    // Queue the vertex data to be copied in along with the rest of the batch
+    if (vulkan_upload_buffer(heap.buf, offset, vertices, size) < 0)
+    {
+        LOG_ERROR("[vbuffer] failed to upload vertex data");
+        return -1;
+    }
+    heap.used = offset + size;
 
+    vb->vk_buffer = heap.buf;
     vb->size = size;
+    vb->first_vertex = offset / stride;
 
     return 0;
-
-fail:
-    vmaDestroyBuffer(g_vulkan->vma, staging_buf, staging_buf_alloc);
-    return -1;
 }
 
 /* Create empty vertex buffer */
@@ -78,6 +95,12 @@ vb_new_empty(struct vbuffer *vb, size_t size, bool direct_map)
 {
     memset(vb, 0, sizeof(struct vbuffer));
 
+    if (g_vulkan->headless)
+    {
+        vb->size = size;
+        return 0;
+    }
+
     VkBufferUsageFlags usage = 0;
     VkMemoryPropertyFlagBits flags = 0;
     VmaAllocationCreateFlagBits alloc_flags = 0;
@@ -119,5 +142,7 @@ vb_new_empty(struct vbuffer *vb, size_t size, bool direct_map)
 void
 vb_free(struct vbuffer *vb)
 {
+    // Heap vertices are only freed with the rest of the heap
+    if (g_vulkan->headless || !vb->vma_alloc) return;
     vmaDestroyBuffer(g_vulkan->vma, vb->vk_buffer, vb->vma_alloc);
 }
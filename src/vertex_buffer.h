@@ -4,7 +4,8 @@
 #include "types.h"
 
 /*
- * Main ertex buffer structure
+ * Main ertex buffer structure.  Static vertices are suballocated from one
+ * shared heap buffer; those buffers have no allocation of their own
  */
 struct vbuffer
 {
@@ -12,9 +13,21 @@ struct vbuffer
     VkBuffer vk_buffer;
     VmaAllocation vma_alloc;
     size_t size;
+
+    // Index of the first vertex in the buffer (for vertexOffset)
+    u32 first_vertex;
 };
 
-i32 vb_new(struct vbuffer *, const void *, size_t);
+// Size of the shared heap that static vertices are allocated from
+#define VB_HEAP_SIZE (8 * 1024 * 1024)
+
+i32 vb_heap_init(size_t);
+void vb_heap_deinit(void);
+void vb_heap_mark(void);
+void vb_heap_reset(void);
+VkBuffer vb_heap_buffer(void);
+
+i32 vb_new(struct vbuffer *, const void *, size_t, size_t);
 i32 vb_new_empty(struct vbuffer *, size_t, bool);
 void vb_free(struct vbuffer *);
 
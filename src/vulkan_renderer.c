@@ -1,5 +1,6 @@
 #include "pch.h"
 #include "index_buffer.h"
+#include "jobs.h"
 #include "renderer.h"
 #include "tagap.h"
 #include "tagap_theme.h"
@@ -11,6 +12,12 @@
 
 #define MAX_FRAMES_IN_FLIGHT 2
 
+// Initial size of the buffer that streamed textures are uploaded through
+#define TEXTURE_STAGING_SIZE (16 * 1024 * 1024)
+
+// Initial size of the buffer that vertex/index data is uploaded through
+#define UPLOAD_STAGING_SIZE (8 * 1024 * 1024)
+
 #ifdef DEBUG
 #  define VALIDATION_LAYERS_ENABLED 1
 #else
@@ -45,6 +52,194 @@ static const i32 VALIDATION_LAYER_COUNT =
 static size_t cur_frame = 0;
 static u32 cur_image_index = 0;
 
+// Vertex/index buffers bound in the command buffer being recorded; objects
+// mostly share the geometry heap, so they rarely need binding.  Command
+// buffers are recorded on several threads, so each has its own
+static __thread VkBuffer bound_vb, bound_ib;
+
+// Draw calls made in the command buffer being recorded
+static __thread u32 draw_calls;
+
+// Per-frame sprite instances; quads in the no-Z-buffer group are written here
+// and drawn in runs with one instanced call
+static struct sprite_frame
+{
+    struct vbuffer vb;
+    struct sprite_instance *instances;
+} *sprite_frames = NULL;
+
+/*
+ * GPU-driven drawing.  Objects in the default groups are written to a storage
+ * buffer each frame, and a compute pass culls them into one indirect draw
+ * command each (in the same order)
+ */
+#define GPU_OBJECT_COUNT \
+    (MAX_OBJECTS[SHADER_DEFAULT] + MAX_OBJECTS[SHADER_DEFAULT_NO_ZBUFFER])
+#define CULL_GROUP_SIZE 64
+static struct gpu_frame
+{
+    VkBuffer objs_buf, draws_buf;
+    VmaAllocation objs_alloc, draws_alloc;
+    struct gpu_renderable *objs;
+    VkDescriptorSet desc_set;
+} *gpu_frames = NULL;
+
+// Range of each group's objects (and draws) in the buffers this frame
+static struct
+{
+    u32 first, count;
+} gpu_groups[SHADER_COUNT];
+
+// Per-frame uniforms (one buffer for each swapchain image)
+static struct frame_ubo
+{
+    VkBuffer buf;
+    VmaAllocation alloc;
+    struct frame_uniforms *data;
+} *frame_ubos = NULL;
+
+/*
+ * The light pass and subpass 1 are recorded into secondary command buffers,
+ * one group at a time on the worker pool.  The static objects at the start of
+ * each group (level geometry) are recorded once per swapchain image and
+ * reused, and only the rest of each group is recorded every frame
+ */
+static struct subpass_cmds
+{
+    VkCommandBuffer statics[SHADER_COUNT];
+    VkCommandBuffer dynamics[SHADER_COUNT];
+
+    // Area the static command buffers were recorded for (Y up, as used for
+    // culling), and the draw calls they make
+    vec2s static_min, static_max;
+    u32 static_draw_calls[SHADER_COUNT];
+} *subpass_cmds = NULL;
+
+// Command pool for each recorded group, as pools can't be used by two
+// threads at once
+static VkCommandPool record_pools[SHADER_COUNT];
+
+// Number of static objects at the start of each group
+static u32 static_counts[SHADER_COUNT];
+
+// Swapchain images whose static command buffers need recording again
+static u32 statics_dirty = 0;
+
+/*
+ * Static objects that can be culled, sorted by the left edge of their bounds
+ * (built at level end).  Static command buffers are only recorded with the
+ * objects around the camera, and finding them only looks at the objects
+ * that overlap that area on the X axis
+ */
+struct static_span
+{
+    vec2s min, max;
+    u32 index;
+};
+static struct static_list
+{
+    struct static_span *spans;
+    u32 span_count;
+
+    // Widest span, so it's known how far left of an area to start looking
+    f32 max_width;
+
+    // Static objects that are never culled
+    u32 *no_cull;
+    u32 no_cull_count;
+
+    // Objects found around the camera, in the order they're drawn
+    u32 *found;
+} static_lists[SHADER_COUNT];
+
+// How far past the viewport static command buffers are recorded for, so they
+// don't need recording again as soon as the camera moves
+#define STATIC_CULL_MARGIN_X WIDTH_INTERNAL
+#define STATIC_CULL_MARGIN_Y HEIGHT_INTERNAL
+
+// A group being recorded
+struct record_job
+{
+    u32 shader_id;
+    i32 status;
+
+    // Command buffer recorded for this frame (if any), and its draw calls
+    VkCommandBuffer cbuf;
+    u32 draw_calls;
+};
+
+// Everything the recording jobs need for one frame
+struct record_frame
+{
+    struct renderer_obj_group *objgrps;
+    vec3s *cam_pos;
+
+    // Whether to record the static command buffers, and the area to
+    // record them for
+    bool record_statics;
+    vec2s static_min, static_max;
+
+    struct record_job jobs[SHADER_COUNT];
+    u32 job_count;
+};
+
+/*
+ * Texture streaming.  Images are decoded on worker threads, then uploaded in
+ * batches through a single staging buffer with one fence.  Until a texture's
+ * view exists its descriptor points at the default texture
+ */
+enum texture_stream_state
+{
+    TEXTURE_STREAM_NONE = 0,
+    TEXTURE_STREAM_DECODING,
+    TEXTURE_STREAM_DECODED,
+    TEXTURE_STREAM_UPLOADING,
+};
+static struct
+{
+    u32 state;
+    u8 *pixels;
+
+    // Times its batch failed to submit; given up on after a few
+    u32 retries;
+} tex_stream[MAX_TEXTURES];
+#define TEXTURE_STREAM_MAX_RETRIES 3
+static struct
+{
+    VkBuffer buf;
+    VmaAllocation alloc;
+    VkDeviceSize size;
+    u8 *data;
+
+    VkCommandBuffer cmdbuf;
+    VkFence fence;
+    bool in_flight;
+
+    // Textures in the batch currently on the GPU
+    u32 batch[MAX_TEXTURES];
+    u32 batch_count;
+} staging;
+
+// Swapchain images whose descriptor sets are missing newly resident textures
+static u32 desc_sets_dirty = 0;
+
+/*
+ * Buffer uploads.  Data is appended to one staging arena and the copies are
+ * recorded into one command buffer, which is submitted with a single fence
+ * when flushed (at the end of level load, or before the next frame)
+ */
+static struct
+{
+    VkBuffer buf;
+    VmaAllocation alloc;
+    VkDeviceSize size, used;
+    u8 *data;
+
+    VkCommandBuffer cmdbuf;
+    VkFence fence;
+    bool recording, in_flight;
+} uploads;
+
 static i32 vulkan_create_instance(SDL_Window *handle);
 static i32 vulkan_create_surface(SDL_Window *handle);
 static i32 vulkan_get_physical_device(void);
@@ -59,9 +254,21 @@ static i32 vulkan_create_sync_objects(void);
 static i32 vulkan_create_command_buffers(void);
 static i32 vulkan_create_descriptor_pool(void);
 static i32 vulkan_setup_textures(void);
+static i32 vulkan_create_texture_staging(VkDeviceSize);
+static i32 vulkan_create_upload_staging(VkDeviceSize);
+static i32 vulkan_create_sprite_buffers(void);
+static i32 vulkan_create_gpu_buffers(void);
+static i32 vulkan_create_frame_uniforms(void);
+static void vulkan_texture_stream_update(bool);
+static void vulkan_texture_stream_drop(void);
 static i32 vulkan_texture_create(u8 *, i32, i32,
     VkDeviceSize, VkImageUsageFlagBits, VkFormat, struct vulkan_texture *);
+static i32 vulkan_texture_load_info(const char *);
 static i32 vulkan_rewrite_descriptors(void);
+static void vulkan_fill_texture_infos(void);
+static void vulkan_write_texture_descriptors(u32);
+static void vulkan_build_static_lists(void);
+static void vulkan_free_static_lists(void);
 
 static VkCommandBuffer vulkan_begin_oneshot_cmd(void);
 static i32 vulkan_end_oneshot_cmd(VkCommandBuffer);
@@ -77,6 +284,28 @@ is_qfam_complete(struct queue_family *qfam, u32 count)
     return true;
 }
 
+/* Whether a group is drawn in Pass 2, Subpass 1 (in SHADER_RENDER_ORDER) */
+static inline bool
+vulkan_is_subpass1_group(u32 shader_id)
+{
+    // We don't use the subpass 2 shader, as we're still in subpass 1...
+    // Also don't render lights twice
+    // Sprites are drawn as part of the no-Z-buffer group, and the indirect
+    // shaders as part of the default groups
+    return shader_id != SHADER_SCREENSUBPASS &&
+        shader_id != SHADER_LIGHT &&
+        shader_id != SHADER_SPRITE &&
+        shader_id != SHADER_INDIRECT &&
+        shader_id != SHADER_INDIRECT_NO_ZBUFFER;
+}
+
+/* Whether a group is recorded into its own command buffers */
+static inline bool
+vulkan_is_recorded_group(u32 shader_id)
+{
+    return shader_id == SHADER_LIGHT || vulkan_is_subpass1_group(shader_id);
+}
+
 void
 vulkan_renderer_init_state(void) { g_vulkan = &g_state.vulkan; }
 
@@ -85,6 +314,17 @@ vulkan_renderer_init(SDL_Window *handle)
 {
     i32 status;
 
+    if (g_vulkan->headless)
+    {
+        // Just need the default texture's info
+        memset(&g_vulkan->textures[TEXINDEX_DEFAULT],
+            0, sizeof(struct vulkan_texture));
+        g_vulkan->textures[TEXINDEX_DEFAULT].w = 1;
+        g_vulkan->textures[TEXINDEX_DEFAULT].h = 1;
+        g_vulkan->tex_used = RESERVED_TEXTURE_COUNT;
+        return 0;
+    }
+
     swapchain = calloc(1, sizeof(struct vulkan_swapchain));
     g_vulkan->swapchain = swapchain;
 
@@ -102,7 +342,12 @@ vulkan_renderer_init(SDL_Window *handle)
     (status = vulkan_swapchain_create_framebuffers(swapchain)) < 0 ||
     (status = vulkan_create_command_pool()) < 0 ||
     (status = vulkan_create_sync_objects()) < 0 ||
+    (status = vulkan_create_texture_staging(TEXTURE_STAGING_SIZE)) < 0 ||
+    (status = vulkan_create_upload_staging(UPLOAD_STAGING_SIZE)) < 0 ||
+    (status = vulkan_create_sprite_buffers()) < 0 ||
     (status = vulkan_create_descriptor_pool()) < 0 ||
+    (status = vulkan_create_gpu_buffers()) < 0 ||
+    (status = vulkan_create_frame_uniforms()) < 0 ||
     (status = vulkan_setup_textures()) < 0 ||
     (status = vulkan_update_sp2_descriptors()) < 0 ||
     (status = vulkan_rewrite_descriptors()) < 0 ||
@@ -113,15 +358,79 @@ vulkan_renderer_init(SDL_Window *handle)
 void
 vulkan_renderer_wait_for_idle(void)
 {
+    if (g_vulkan->headless) return;
+    vulkan_flush_uploads(true);
     vkDeviceWaitIdle(g_vulkan->d);
 }
 
 void
 vulkan_renderer_deinit(void)
 {
+    if (g_vulkan->headless) return;
+
     LOG_INFO("[vulkan] cleanup");
+    vulkan_texture_stream_drop();
     vulkan_renderer_wait_for_idle();
 
+    // Destroy the texture staging buffer
+    if (staging.data) vmaUnmapMemory(g_vulkan->vma, staging.alloc);
+    vmaDestroyBuffer(g_vulkan->vma, staging.buf, staging.alloc);
+    vkDestroyFence(g_vulkan->d, staging.fence, NULL);
+
+    // Destroy the buffer upload arena
+    if (uploads.data) vmaUnmapMemory(g_vulkan->vma, uploads.alloc);
+    vmaDestroyBuffer(g_vulkan->vma, uploads.buf, uploads.alloc);
+    vkDestroyFence(g_vulkan->d, uploads.fence, NULL);
+
+    // Destroy sprite instance buffers
+    if (sprite_frames)
+    {
+        for (u32 i = 0; i < swapchain->image_count; ++i)
+        {
+            if (!sprite_frames[i].instances) continue;
+            vmaUnmapMemory(g_vulkan->vma, sprite_frames[i].vb.vma_alloc);
+            vb_free(&sprite_frames[i].vb);
+        }
+        free(sprite_frames);
+        sprite_frames = NULL;
+    }
+
+    // Destroy GPU-driven object and draw buffers
+    if (gpu_frames)
+    {
+        for (u32 i = 0; i < swapchain->image_count; ++i)
+        {
+            if (gpu_frames[i].objs)
+            {
+                vmaUnmapMemory(g_vulkan->vma, gpu_frames[i].objs_alloc);
+            }
+            vmaDestroyBuffer(g_vulkan->vma,
+                gpu_frames[i].objs_buf, gpu_frames[i].objs_alloc);
+            vmaDestroyBuffer(g_vulkan->vma,
+                gpu_frames[i].draws_buf, gpu_frames[i].draws_alloc);
+        }
+        free(gpu_frames);
+        gpu_frames = NULL;
+    }
+
+    // Destroy per-frame uniform buffers
+    if (frame_ubos)
+    {
+        for (u32 i = 0; i < swapchain->image_count; ++i)
+        {
+            if (frame_ubos[i].data)
+            {
+                vmaUnmapMemory(g_vulkan->vma, frame_ubos[i].alloc);
+            }
+            vmaDestroyBuffer(g_vulkan->vma,
+                frame_ubos[i].buf, frame_ubos[i].alloc);
+        }
+        free(frame_ubos);
+        frame_ubos = NULL;
+    }
+    if (subpass_cmds) free(subpass_cmds);
+    vulkan_free_static_lists();
+
     // Destroy the global sampler
     vkDestroySampler(g_vulkan->d, g_vulkan->sampler, NULL);
     if (g_vulkan->image_desc_infos) free(g_vulkan->image_desc_infos);
@@ -175,10 +484,16 @@ vulkan_renderer_deinit(void)
         }
     }
     vkDestroyCommandPool(g_vulkan->d, g_vulkan->cmd_pool, NULL);
+    for (u32 i = 0; i < SHADER_COUNT; ++i)
+    {
+        vkDestroyCommandPool(g_vulkan->d, record_pools[i], NULL);
+    }
     vulkan_swapchain_deinit_framebuffers(swapchain);
     vulkan_shaders_free_all();
     vkDestroyDescriptorSetLayout(g_vulkan->d,
         g_vulkan->desc_set_layout_sp2, NULL);
+    vkDestroyDescriptorSetLayout(g_vulkan->d,
+        g_vulkan->desc_set_layout_obj, NULL);
     vkDestroyDescriptorSetLayout(g_vulkan->d,
         g_vulkan->desc_set_layout, NULL);
     vkDestroyRenderPass(g_vulkan->d, g_vulkan->light_render_pass, NULL);
@@ -529,7 +844,29 @@ vulkan_create_logical_device(void)
         };
     }
 
-    const VkPhysicalDeviceFeatures features = { 0 };
+    VkPhysicalDeviceFeatures features = { 0 };
+    if (g_vulkan->gpu_driven)
+    {
+        // Indirect draws are made with one call per group, and each draw's
+        // first instance is the index of its object
+        VkPhysicalDeviceFeatures supported;
+        VkPhysicalDeviceProperties props;
+        vkGetPhysicalDeviceFeatures(g_vulkan->video_card, &supported);
+        vkGetPhysicalDeviceProperties(g_vulkan->video_card, &props);
+        if (supported.multiDrawIndirect &&
+            supported.drawIndirectFirstInstance &&
+            props.limits.maxDrawIndirectCount >= GPU_OBJECT_COUNT)
+        {
+            features.multiDrawIndirect = VK_TRUE;
+            features.drawIndirectFirstInstance = VK_TRUE;
+        }
+        else
+        {
+            LOG_WARN("[vulkan] video card can't draw GPU-driven; "
+                "falling back to drawing each object");
+            g_vulkan->gpu_driven = false;
+        }
+    }
     VkDeviceCreateInfo create_info =
     {
         .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
@@ -836,6 +1173,14 @@ vulkan_create_descriptor_set_layout(void)
             .pImmutableSamplers = NULL,
             .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
         },
+        {
+            // Per-frame uniforms
+            .binding = 2,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .descriptorCount = 1,
+            .pImmutableSamplers = NULL,
+            .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        },
     };
 
     const VkDescriptorSetLayoutCreateInfo layout_info =
@@ -900,6 +1245,46 @@ vulkan_create_descriptor_set_layout(void)
         return -1;
     }
 
+    /*
+     * GPU-driven object buffer layout.  The cull pass reads objects and
+     * writes draws, and the indirect shader reads objects (as set 1)
+     */
+    static const VkDescriptorSetLayoutBinding layout_bindings_obj[] =
+    {
+        {
+            // Objects
+            .binding = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .pImmutableSamplers = NULL,
+            .stageFlags =
+                VK_SHADER_STAGE_COMPUTE_BIT | VK_SHADER_STAGE_VERTEX_BIT,
+        },
+        {
+            // Indirect draw commands
+            .binding = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = 1,
+            .pImmutableSamplers = NULL,
+            .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        },
+    };
+
+    const VkDescriptorSetLayoutCreateInfo layout_info_obj =
+    {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .bindingCount = sizeof(layout_bindings_obj) /
+            sizeof(VkDescriptorSetLayoutBinding),
+        .pBindings = layout_bindings_obj,
+    };
+    if (vkCreateDescriptorSetLayout(g_vulkan->d,
+        &layout_info_obj, NULL, &g_vulkan->desc_set_layout_obj) != VK_SUCCESS)
+    {
+        LOG_ERROR("[vulkan] failed to create descriptor "
+            "set layout for object buffer");
+        return -1;
+    }
+
     return 0;
 }
 
@@ -921,6 +1306,18 @@ vulkan_create_command_pool(void)
         LOG_ERROR("[vulkan] failed to create command pool");
         return -1;
     }
+
+    // Each group is recorded from its own pool
+    for (u32 i = 0; i < SHADER_COUNT; ++i)
+    {
+        if (!vulkan_is_recorded_group(i)) continue;
+        if (vkCreateCommandPool(g_vulkan->d, &pool_info, NULL,
+            &record_pools[i]) != VK_SUCCESS)
+        {
+            LOG_ERROR("[vulkan] failed to create command pool");
+            return -1;
+        }
+    }
     return 0;
 }
 
@@ -949,6 +1346,34 @@ vulkan_create_command_buffers(void)
         return -1;
     }
 
+    // Secondary command buffers for each group, from the group's own pool
+    subpass_cmds =
+        calloc(swapchain->image_count, sizeof(struct subpass_cmds));
+    for (u32 s = 0; s < SHADER_COUNT; ++s)
+    {
+        if (!vulkan_is_recorded_group(s)) continue;
+
+        const VkCommandBufferAllocateInfo alloc_info_sec =
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+            .commandPool = record_pools[s],
+            .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+            .commandBufferCount = 1,
+        };
+        for (u32 i = 0; i < swapchain->image_count; ++i)
+        {
+            if (vkAllocateCommandBuffers(g_vulkan->d, &alloc_info_sec,
+                    &subpass_cmds[i].statics[s]) != VK_SUCCESS ||
+                vkAllocateCommandBuffers(g_vulkan->d, &alloc_info_sec,
+                    &subpass_cmds[i].dynamics[s]) != VK_SUCCESS)
+            {
+                LOG_ERROR("[vulkan] failed to allocate secondary command "
+                    "buffers");
+                return -1;
+            }
+        }
+    }
+
     return 0;
 }
 
@@ -956,10 +1381,176 @@ static void vulkan_record_obj_command_buffer(
     VkCommandBuffer,
     struct renderable *,
     struct shader *,
-    enum shader_type,
-    vec3s *);
+    enum shader_type);
 
 static bool vulkan_check_should_cull_obj(struct renderable *, vec3s *);
+static void vulkan_sprite_instance(struct sprite_instance *,
+    const struct renderable *);
+static void vulkan_record_sprites(VkCommandBuffer,
+    const struct renderable *, u32, u32);
+static void vulkan_record_cull(VkCommandBuffer,
+    struct renderer_obj_group *, vec3s *);
+static void vulkan_record_indirect(VkCommandBuffer,
+    enum shader_type, enum shader_type);
+static void vulkan_record_group(VkCommandBuffer,
+    struct renderer_obj_group *, u32, u32, u32, const u32 *, vec3s *);
+static u32 vulkan_find_statics(u32, vec2s, vec2s);
+static inline void vulkan_obj_bounds(struct renderable *, vec2s *, vec2s *);
+static void vulkan_record_particles(VkCommandBuffer);
+
+/* Get position to draw object at, between the previous and current tick */
+static inline vec2s
+vulkan_obj_draw_pos(const struct renderable *obj)
+{
+    if (glms_vec2_distance2(obj->pos_prev, obj->pos) >
+        RENDERABLE_SNAP_DIST * RENDERABLE_SNAP_DIST)
+    {
+        return obj->pos;
+    }
+    return glms_vec2_lerp(obj->pos_prev, obj->pos, g_state.tick_alpha);
+}
+
+/* Begin recording a secondary command buffer inside the given render pass */
+static i32
+vulkan_begin_secondary_cmd(
+    VkCommandBuffer cbuf,
+    VkRenderPass render_pass,
+    VkFramebuffer framebuffer,
+    VkCommandBufferUsageFlags flags)
+{
+    const VkCommandBufferInheritanceInfo inherit_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO,
+        .renderPass = render_pass,
+        .subpass = 0,
+        .framebuffer = framebuffer,
+    };
+    const VkCommandBufferBeginInfo begin_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = flags | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT,
+        .pInheritanceInfo = &inherit_info,
+    };
+    if (vkBeginCommandBuffer(cbuf, &begin_info) != VK_SUCCESS)
+    {
+        LOG_ERROR("[vulkan] failed to begin recording secondary command "
+            "buffer");
+        return -1;
+    }
+
+    // Nothing is bound in a new command buffer
+    bound_vb = bound_ib = VK_NULL_HANDLE;
+    return 0;
+}
+
+/*
+ * Record one group's secondary command buffer(s) for this frame; run on the
+ * worker pool, one job per group
+ */
+static void
+vulkan_record_job(u32 j, void *user)
+{
+    struct record_frame *rf = user;
+    struct record_job *job = &rf->jobs[j];
+    u32 shader_id = job->shader_id;
+    struct subpass_cmds *sc = &subpass_cmds[cur_image_index];
+    VkRenderPass render_pass = g_vulkan->render_pass;
+    VkFramebuffer framebuffer = swapchain->framebuffers[cur_image_index];
+
+    job->status = 0;
+    job->draw_calls = 0;
+    job->cbuf = VK_NULL_HANDLE;
+
+    if (shader_id == SHADER_LIGHT)
+    {
+        render_pass = g_vulkan->light_render_pass;
+        framebuffer = g_vulkan->light_framebufs[cur_image_index];
+    }
+
+    // Static objects come first in their group, and only need recording
+    // again when their descriptor set has changed (or the level has, or the
+    // camera has left the area they were recorded for)
+    u32 first = static_counts[shader_id];
+    if (rf->record_statics && first)
+    {
+        VkCommandBuffer scbuf = sc->statics[shader_id];
+        u32 found = vulkan_find_statics(shader_id,
+            rf->static_min, rf->static_max);
+        draw_calls = 0;
+        if (vulkan_begin_secondary_cmd(scbuf,
+            render_pass, framebuffer, 0) < 0) goto fail;
+        vulkan_record_group(scbuf, &rf->objgrps[shader_id],
+            shader_id, 0, found, static_lists[shader_id].found, rf->cam_pos);
+        if (vkEndCommandBuffer(scbuf) != VK_SUCCESS)
+        {
+            LOG_ERROR("[vulkan] failed to record static command buffer");
+            goto fail;
+        }
+        sc->static_draw_calls[shader_id] = draw_calls;
+    }
+
+    u32 count = rf->objgrps[shader_id].obj_count - first;
+
+    // Particles are rendered separately from their (empty) group, to make
+    // management of the seperate vertex buffers (foreach swapchain image)
+    // easier
+    if (shader_id == SHADER_PARTICLE)
+    {
+        count = g_parts->frames[cur_image_index].index_count;
+    }
+
+    // If Skip if there's no objects to render in this group
+    if (count == 0) return;
+
+    // Record the rest of the group for this frame
+    VkCommandBuffer dcbuf = sc->dynamics[shader_id];
+    draw_calls = 0;
+    if (vulkan_begin_secondary_cmd(dcbuf, render_pass, framebuffer,
+        VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT) < 0) goto fail;
+    if (shader_id == SHADER_PARTICLE)
+    {
+        vulkan_record_particles(dcbuf);
+    }
+    else if (g_vulkan->gpu_driven && shader_id == SHADER_DEFAULT)
+    {
+        // GPU-driven groups are drawn all at once
+        vulkan_record_indirect(dcbuf, shader_id, SHADER_INDIRECT);
+    }
+    else if (g_vulkan->gpu_driven && shader_id == SHADER_DEFAULT_NO_ZBUFFER)
+    {
+        vulkan_record_indirect(dcbuf,
+            shader_id, SHADER_INDIRECT_NO_ZBUFFER);
+    }
+    else
+    {
+        vulkan_record_group(dcbuf, &rf->objgrps[shader_id],
+            shader_id, first, count, NULL, rf->cam_pos);
+    }
+    if (vkEndCommandBuffer(dcbuf) != VK_SUCCESS)
+    {
+        LOG_ERROR("[vulkan] failed to record secondary command buffer");
+        goto fail;
+    }
+    job->cbuf = dcbuf;
+    job->draw_calls = draw_calls;
+    return;
+
+fail:
+    job->status = -1;
+}
+
+/* Add a job's command buffers to the list the primary executes, in order */
+static u32
+vulkan_job_cmds(const struct record_job *job, VkCommandBuffer *exec)
+{
+    u32 count = 0;
+    if (static_counts[job->shader_id])
+    {
+        exec[count++] = subpass_cmds[cur_image_index].statics[job->shader_id];
+    }
+    if (job->cbuf) exec[count++] = job->cbuf;
+    return count;
+}
 
 /*
  * Record into current command buffer
@@ -970,11 +1561,59 @@ vulkan_record_command_buffers(
     size_t objgrp_count,
     vec3s *cam_pos)
 {
+    PROFILE_ZONE("vulkan_record_command_buffers");
+
 #ifdef DEBUG
     assert(objgrp_count == SHADER_COUNT);
 #endif
     VkCommandBuffer cbuf = g_vulkan->cmd_buffers[cur_image_index];
 
+    // View-projection; every shader reads this from the per-frame uniforms,
+    // so it's only worked out once
+    frame_ubos[cur_image_index].data->vp = glms_mat4_mul(
+        glms_ortho(
+            0.0f, WIDTH_INTERNAL,
+            0.0f, HEIGHT_INTERNAL,
+            -225.0f, 225.0f),
+        glms_translate((mat4s)GLMS_MAT4_IDENTITY_INIT,
+            (vec3s){ -cam_pos->x, -cam_pos->y, 0.0f }));
+
+    // Static command buffers also need recording again once the viewport
+    // leaves the area they were recorded for
+    struct subpass_cmds *sc = &subpass_cmds[cur_image_index];
+    const vec2s view_min = {{ cam_pos->x, -cam_pos->y - HEIGHT_INTERNAL }},
+        view_max = {{ cam_pos->x + WIDTH_INTERNAL, -cam_pos->y }};
+    if (view_min.x < sc->static_min.x || view_min.y < sc->static_min.y ||
+        view_max.x > sc->static_max.x || view_max.y > sc->static_max.y)
+    {
+        statics_dirty |= 1u << cur_image_index;
+    }
+
+    struct record_frame rf =
+    {
+        .objgrps = objgrps,
+        .cam_pos = cam_pos,
+        .record_statics = !!(statics_dirty & (1u << cur_image_index)),
+        .static_min = (vec2s)
+        {{
+            view_min.x - STATIC_CULL_MARGIN_X,
+            view_min.y - STATIC_CULL_MARGIN_Y,
+        }},
+        .static_max = (vec2s)
+        {{
+            view_max.x + STATIC_CULL_MARGIN_X,
+            view_max.y + STATIC_CULL_MARGIN_Y,
+        }},
+    };
+
+    // Light pass, then each subpass 1 group in render order
+    rf.jobs[rf.job_count++].shader_id = SHADER_LIGHT;
+    for (u32 g = 0; g < SHADER_COUNT; ++g)
+    {
+        if (!vulkan_is_subpass1_group(SHADER_RENDER_ORDER[g])) continue;
+        rf.jobs[rf.job_count++].shader_id = SHADER_RENDER_ORDER[g];
+    }
+
     // Reset the command buffer
     vkResetCommandBuffer(g_vulkan->cmd_buffers[cur_image_index], 0);
 
@@ -990,8 +1629,32 @@ vulkan_record_command_buffers(
         return -1;
     }
 
-    // Reset draw count
+    // Cull the default groups into indirect draws (has to be done outside
+    // of the render passes, and before the jobs read the group ranges)
+    if (g_vulkan->gpu_driven) vulkan_record_cull(cbuf, objgrps, cam_pos);
+
+    // Record every group at once; each job has its own command pool
+    jobs_parallel_for(rf.job_count, vulkan_record_job, &rf);
+
+    // Count draws (static objects are drawn every frame too)
     g_state.draw_calls = 0;
+    for (u32 j = 0; j < rf.job_count; ++j)
+    {
+        if (rf.jobs[j].status < 0) return -1;
+        g_state.draw_calls += rf.jobs[j].draw_calls;
+        if (static_counts[rf.jobs[j].shader_id])
+        {
+            g_state.draw_calls +=
+                subpass_cmds[cur_image_index]
+                    .static_draw_calls[rf.jobs[j].shader_id];
+        }
+    }
+    if (rf.record_statics)
+    {
+        sc->static_min = rf.static_min;
+        sc->static_max = rf.static_max;
+        statics_dirty &= ~(1u << cur_image_index);
+    }
 
     /* Configure render pass 1 (light render) */
     static const VkClearValue clear_colours_p1[] =
@@ -1016,44 +1679,11 @@ vulkan_record_command_buffers(
     /*
      * Pass 1: lighting render
      */
-    vkCmdBeginRenderPass(cbuf, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
-
-    // Bind the light shader
-    vkCmdBindPipeline(cbuf,
-        VK_PIPELINE_BIND_POINT_GRAPHICS,
-        g_shader_list[SHADER_LIGHT].pipeline);
-
-    do
-    {
-        struct renderable *objs = objgrps[SHADER_LIGHT].objs;
-        u32 obj_count = objgrps[SHADER_LIGHT].obj_count;
-        if (obj_count == 0) break;
-
-        // Render each light
-        for (u32 o = 0; o < obj_count; ++o)
-        {
-            // Skip hidden lights
-            if (objs[o].flags & RENDERABLE_HIDDEN_BIT) continue;
-
-            // Skip lights with no indices
-            if (objs[o].ib.index_count == 0) continue;
-
-            // Cull lights that have bounds outside the viewport
-        #ifndef NO_CULLING
-            if (vulkan_check_should_cull_obj(&objs[o], cam_pos))
-            {
-                continue;
-            }
-        #endif
-
-            // Render the light
-            vulkan_record_obj_command_buffer(cbuf,
-                &objs[o],
-                &g_shader_list[SHADER_LIGHT],
-                SHADER_LIGHT,
-                cam_pos);
-        }
-    } while(0);
+    VkCommandBuffer exec[SHADER_COUNT * 2];
+    u32 exec_count = vulkan_job_cmds(&rf.jobs[0], exec);
+    vkCmdBeginRenderPass(cbuf, &render_pass_info,
+        VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    if (exec_count) vkCmdExecuteCommands(cbuf, exec_count, exec);
 
     // End the light render pass
     vkCmdEndRenderPass(cbuf);
@@ -1084,120 +1714,20 @@ vulkan_record_command_buffers(
         .pClearValues = clear_colours_p2,
     };
 
-    // Begin the level render pass
-    vkCmdBeginRenderPass(cbuf, &render_pass_info, VK_SUBPASS_CONTENTS_INLINE);
+    // Begin the level render pass; subpass 1 is made up of secondary command
+    // buffers
+    vkCmdBeginRenderPass(cbuf, &render_pass_info,
+        VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
 
     /*
      * Pass 2: level G-buffer render (Subpass 1)
      */
-    // Iterate over each of the groups (i.e. objects with different shaders)
-    for (u32 g = 0; g < SHADER_COUNT; ++g)
+    exec_count = 0;
+    for (u32 j = 1; j < rf.job_count; ++j)
     {
-        u32 shader_id = SHADER_RENDER_ORDER[g];
-
-        // We don't use the subpass 2 shader, as we're still in subpass 1...
-        // Also don't render lights twice
-        // Particles are now rendered separately also
-        if (shader_id == SHADER_SCREENSUBPASS ||
-            shader_id == SHADER_LIGHT ||
-            shader_id == SHADER_PARTICLE) continue;
-
-        struct renderable *objs = objgrps[shader_id].objs;
-        u32 obj_count = objgrps[shader_id].obj_count;
-
-        // If Skip if there's no objects to render in this group
-        if (obj_count == 0) continue;
-
-        // Bind the graphics pipeline for this shader
-        vkCmdBindPipeline(cbuf,
-            VK_PIPELINE_BIND_POINT_GRAPHICS, g_shader_list[shader_id].pipeline);
-
-        // Render each object
-        for (i32 o = 0; o < obj_count; ++o)
-        {
-            // Skip hidden objects
-            if (objs[o].flags & RENDERABLE_HIDDEN_BIT) continue;
-
-            // Skip objects with no indices
-            if (objs[o].ib.index_count == 0) continue;
-
-            // Cull objects that have bounds outside the viewport
-            // Extremely effective at more than doubling the FPS
-        #ifndef NO_CULLING
-            if (vulkan_check_should_cull_obj(&objs[o], cam_pos))
-            {
-                continue;
-            }
-        #endif
-
-            // Render the object
-            vulkan_record_obj_command_buffer(cbuf,
-                &objs[o], &g_shader_list[shader_id], shader_id, cam_pos);
-        }
-    }
-
-    /*
-     * Render particles
-     * Done seperately to make management of the seperate vertex buffers
-     * (foreach swapchain image) easier
-     */
-    struct shader *part_s = &g_shader_list[SHADER_PARTICLE];
-    struct particle_frame *part_f = &g_parts->frames[cur_image_index];
-    if (part_f->index_count)
-    {
-        vkCmdBindPipeline(cbuf,
-            VK_PIPELINE_BIND_POINT_GRAPHICS, part_s->pipeline);
-
-        // Bind vertex and index buffers
-        static const VkDeviceSize offset = 0;
-        vkCmdBindVertexBuffers(cbuf,
-            0,
-            1,
-            &part_f->vb.vk_buffer,
-            &offset);
-        vkCmdBindIndexBuffer(cbuf,
-            g_parts->ib.vk_buffer,
-            0,
-            IB_VKTYPE);
-
-        // Apply camera position
-        mat4s mat = glms_translate((mat4s)GLMS_MAT4_IDENTITY_INIT, (vec3s)
-        {
-            -cam_pos->x,
-            -cam_pos->y,
-            0.0f
-        });
-        mat.raw[1][1] *= -1.0f;
-
-        // Push constants
-        struct push_constants_ptl pconsts =
-        {
-            .mvp = glms_mat4_mul(glms_ortho(
-                0.0f, WIDTH_INTERNAL,
-                0.0f, HEIGHT_INTERNAL,
-                -225.0f, 225.0f), mat)
-        };
-        vkCmdPushConstants(cbuf,
-            part_s->pipeline_layout,
-            VK_SHADER_STAGE_VERTEX_BIT,
-            0,
-            part_s->pconst_size,
-            &pconsts);
-
-        // Bind descriptor sets
-        vkCmdBindDescriptorSets(cbuf,
-            VK_PIPELINE_BIND_POINT_GRAPHICS,
-            part_s->pipeline_layout,
-            0, 1,
-            &g_vulkan->desc_sets[cur_image_index],
-            0, NULL);
-
-        // Draw!
-        vkCmdDrawIndexed(cbuf,
-            part_f->index_count,
-            1, 0, 0, 0);
-        ++g_state.draw_calls;
-    }
+        exec_count += vulkan_job_cmds(&rf.jobs[j], &exec[exec_count]);
+    }
+    if (exec_count) vkCmdExecuteCommands(cbuf, exec_count, exec);
 
     /*
      * Pass 2: Subpass 2: we read colour attachments here and compose G-buffer
@@ -1250,97 +1780,604 @@ vulkan_record_command_buffers(
     return 0;
 }
 
-// Record to command buffer for a single object
+/*
+ * Record draws for a range of objects in a group, or for the objects in the
+ * given list.  Lists are of static objects, which are recorded ahead of time
+ * and already culled, so they're not instanced (the instance buffer is only
+ * good for one frame)
+ */
 static void
-vulkan_record_obj_command_buffer(
+vulkan_record_group(
     VkCommandBuffer cbuf,
-    struct renderable *obj,
-    struct shader *s,
-    enum shader_type shader_id,
+    struct renderer_obj_group *grp,
+    u32 shader_id,
+    u32 first,
+    u32 count,
+    const u32 *list,
     vec3s *cam_pos)
 {
-    static const VkDeviceSize offset = 0;
+    struct renderable *objs = grp->objs;
+    struct sprite_frame *sprite_f = &sprite_frames[cur_image_index];
+    u32 sprite_count = 0;
+
+    // Quads in this group are instanced; consecutive ones are drawn
+    // together so the draw order stays the same
+    bool instancing = !list && shader_id == SHADER_DEFAULT_NO_ZBUFFER;
+    const struct renderable *run_quad = NULL;
+    u32 run_first = 0;
+
+    // Bind the graphics pipeline for this shader
+    vkCmdBindPipeline(cbuf,
+        VK_PIPELINE_BIND_POINT_GRAPHICS, g_shader_list[shader_id].pipeline);
+
+    // Render each object
+    for (u32 i = 0; i < count; ++i)
+    {
+        u32 o = list ? list[i] : first + i;
+
+        // Skip hidden objects
+        if (objs[o].flags & RENDERABLE_HIDDEN_BIT) continue;
+
+        // Skip objects with no indices
+        if (objs[o].ib.index_count == 0) continue;
+
+        // Cull objects that have bounds outside the viewport
+        // Extremely effective at more than doubling the FPS
+    #ifndef NO_CULLING
+        if (!list && vulkan_check_should_cull_obj(&objs[o], cam_pos))
+        {
+            continue;
+        }
+    #endif
+
+        if (instancing && (objs[o].flags & RENDERABLE_QUAD_BIT))
+        {
+            // Add to the current run of sprites
+            if (!run_quad)
+            {
+                run_quad = &objs[o];
+                run_first = sprite_count;
+            }
+            vulkan_sprite_instance(
+                &sprite_f->instances[sprite_count++], &objs[o]);
+            continue;
+        }
+        if (run_quad)
+        {
+            // Draw the sprites that come before this object
+            vulkan_record_sprites(cbuf,
+                run_quad, run_first, sprite_count - run_first);
+            run_quad = NULL;
+            vkCmdBindPipeline(cbuf,
+                VK_PIPELINE_BIND_POINT_GRAPHICS,
+                g_shader_list[shader_id].pipeline);
+        }
+
+        // Render the object
+        vulkan_record_obj_command_buffer(cbuf,
+            &objs[o], &g_shader_list[shader_id], shader_id);
+    }
+    if (run_quad)
+    {
+        vulkan_record_sprites(cbuf,
+            run_quad, run_first, sprite_count - run_first);
+    }
+}
+
+/* Compare object indices, to put them back in draw order */
+static int
+vulkan_compare_index(const void *a, const void *b)
+{
+    u32 ia = *(const u32 *)a, ib = *(const u32 *)b;
+    return (ia > ib) - (ia < ib);
+}
+
+/*
+ * Find a group's static objects that overlap the given area (Y up), and put
+ * their indices in draw order in its list.  Returns how many there are
+ */
+static u32
+vulkan_find_statics(u32 shader_id, vec2s min, vec2s max)
+{
+    struct static_list *l = &static_lists[shader_id];
+    memcpy(l->found, l->no_cull, l->no_cull_count * sizeof(u32));
+    u32 count = l->no_cull_count;
+
+    // Skip spans that start too far left to reach the area
+    u32 lo = 0, hi = l->span_count;
+    while (lo < hi)
+    {
+        u32 mid = (lo + hi) / 2;
+        if (l->spans[mid].min.x <= min.x - l->max_width) lo = mid + 1;
+        else hi = mid;
+    }
+    for (u32 i = lo; i < l->span_count && l->spans[i].min.x < max.x; ++i)
+    {
+        const struct static_span *sp = &l->spans[i];
+        if (sp->max.x > min.x && sp->min.y < max.y && sp->max.y > min.y)
+        {
+            l->found[count++] = sp->index;
+        }
+    }
+
+    qsort(l->found, count, sizeof(u32), vulkan_compare_index);
+    return count;
+}
+
+/* Compare static spans by their left edge */
+static int
+vulkan_compare_span(const void *a, const void *b)
+{
+    f32 xa = ((const struct static_span *)a)->min.x,
+        xb = ((const struct static_span *)b)->min.x;
+    return (xa > xb) - (xa < xb);
+}
+
+/* Sort the static objects in each group by their bounds */
+static void
+vulkan_build_static_lists(void)
+{
+    for (u32 g = 0; g < SHADER_COUNT; ++g)
+    {
+        struct static_list *l = &static_lists[g];
+        u32 count = static_counts[g];
+        if (!count) continue;
+
+        l->spans = malloc(count * sizeof(struct static_span));
+        l->no_cull = malloc(count * sizeof(u32));
+        l->found = malloc(count * sizeof(u32));
+        l->span_count = l->no_cull_count = 0;
+        l->max_width = 0.0f;
+        for (u32 o = 0; o < count; ++o)
+        {
+            struct renderable *obj = &g_renderer.objgroups[g].objs[o];
+        #ifndef NO_CULLING
+            if (!(obj->flags & RENDERABLE_NO_CULL_BIT))
+            {
+                // Same bounds as vulkan_check_should_cull_obj uses (static
+                // objects don't move)
+                vec2s b_min, b_max;
+                vulkan_obj_bounds(obj, &b_min, &b_max);
+                struct static_span *sp = &l->spans[l->span_count++];
+                sp->min = (vec2s)
+                {{
+                    obj->pos.x + b_min.x,
+                    -obj->pos.y + b_min.y,
+                }};
+                sp->max = (vec2s)
+                {{
+                    obj->pos.x + b_max.x,
+                    -obj->pos.y + b_max.y,
+                }};
+                sp->index = o;
+                l->max_width = max(l->max_width, sp->max.x - sp->min.x);
+                continue;
+            }
+        #endif
+            l->no_cull[l->no_cull_count++] = o;
+        }
+        qsort(l->spans, l->span_count, sizeof(struct static_span),
+            vulkan_compare_span);
+    }
+}
+
+static void
+vulkan_free_static_lists(void)
+{
+    for (u32 g = 0; g < SHADER_COUNT; ++g)
+    {
+        free(static_lists[g].spans);
+        free(static_lists[g].no_cull);
+        free(static_lists[g].found);
+    }
+    memset(static_lists, 0, sizeof(static_lists));
+}
+
+/* Record this frame's particles */
+static void
+vulkan_record_particles(VkCommandBuffer cbuf)
+{
+    struct shader *part_s = &g_shader_list[SHADER_PARTICLE];
+    struct particle_frame *part_f = &g_parts->frames[cur_image_index];
+
+    vkCmdBindPipeline(cbuf,
+        VK_PIPELINE_BIND_POINT_GRAPHICS, part_s->pipeline);
 
     // Bind vertex and index buffers
+    static const VkDeviceSize offset = 0;
     vkCmdBindVertexBuffers(cbuf,
         0,
         1,
-        &obj->vb.vk_buffer,
+        &part_f->vb.vk_buffer,
         &offset);
     vkCmdBindIndexBuffer(cbuf,
-        obj->ib.vk_buffer,
+        g_parts->ib.vk_buffer,
         0,
         IB_VKTYPE);
+    bound_vb = part_f->vb.vk_buffer;
+    bound_ib = g_parts->ib.vk_buffer;
+
+    // Bind descriptor sets
+    vkCmdBindDescriptorSets(cbuf,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        part_s->pipeline_layout,
+        0, 1,
+        &g_vulkan->desc_sets[cur_image_index],
+        0, NULL);
+
+    // Draw!
+    vkCmdDrawIndexed(cbuf,
+        part_f->index_count,
+        1, g_parts->ib.first_index, 0, 0);
+    ++draw_calls;
+}
+
+/* Get shading multiplier for an object drawn with the default shaders */
+static inline vec4s
+vulkan_obj_shading(const struct renderable *obj)
+{
+    f32 dim = (obj->flags & RENDERABLE_SHADED_BIT) ? 0.60f : 1.0f;
+    vec4s shading =
+        (obj->flags & RENDERABLE_EXTRA_SHADING_BIT)
+        ? obj->extra_shading
+        : GLMS_VEC4_ONE;
+    shading.x *= dim;
+    shading.y *= dim;
+    shading.z *= dim;
+    return shading;
+}
+
+/*
+ * Get the placement of an object's vertices (the unit quad for quads), with
+ * texture size applied here rather than in the shader
+ */
+static inline void
+vulkan_obj_placement(const struct renderable *obj,
+    vec3s *origin, vec2s *size)
+{
+    vec2s tex_size = (vec2s)GLMS_VEC2_ONE_INIT;
+    if (obj->flags & RENDERABLE_TEX_SCALE_BIT)
+    {
+        tex_size.x = (f32)g_vulkan->textures[obj->tex].w;
+        tex_size.y = (f32)g_vulkan->textures[obj->tex].h;
+    }
+    *origin = (obj->flags & RENDERABLE_QUAD_BIT)
+        ? obj->quad.origin
+        : (vec3s)GLMS_VEC3_ZERO_INIT;
+    *size = (obj->flags & RENDERABLE_QUAD_BIT)
+        ? obj->quad.size
+        : (vec2s)GLMS_VEC2_ONE_INIT;
+    origin->x *= tex_size.x;
+    origin->y *= tex_size.y;
+    *size = glms_vec2_mul(*size, tex_size);
+}
+
+/* Get the transform the vertex shaders place an object with */
+static inline struct transform_2d
+vulkan_obj_transform(const struct renderable *obj)
+{
+    vec3s origin;
+    vec2s size;
+    vulkan_obj_placement(obj, &origin, &size);
+
+    return (struct transform_2d)
+    {
+        .pos = vulkan_obj_draw_pos(obj),
+        .offset = obj->offset,
+        .origin = origin,
+        .rot = obj->rot,
+        .size = size,
+        .scale = (obj->flags & RENDERABLE_SCALED_BIT) ? obj->scale : 1.0f,
+        .flip = (obj->flags & RENDERABLE_FLIPPED_BIT) ? -1.0f : 1.0f,
+    };
+}
+
+/*
+ * Get an object's bounds, relative to its position.  Texture-scaled objects
+ * use their texture size, which is only looked up when the texture changes
+ */
+static inline void
+vulkan_obj_bounds(struct renderable *obj, vec2s *min, vec2s *max)
+{
+    if (!(obj->flags & RENDERABLE_TEX_SCALE_BIT))
+    {
+        *min = obj->bounds.min;
+        *max = obj->bounds.max;
+        return;
+    }
+    if (obj->bounds.tex != obj->tex + 1)
+    {
+        f32 tw = (f32)g_vulkan->textures[obj->tex].w / 2.0f,
+            th = (f32)g_vulkan->textures[obj->tex].h / 2.0f;
+        obj->bounds.tex_min = (vec2s){ -tw, -tw };
+        obj->bounds.tex_max = (vec2s){ tw, th };
+        obj->bounds.tex = obj->tex + 1;
+    }
+    *min = obj->bounds.tex_min;
+    *max = obj->bounds.tex_max;
+}
+
+/* Fill in the instance attributes for a sprite */
+static void
+vulkan_sprite_instance(struct sprite_instance *inst,
+    const struct renderable *obj)
+{
+    vec3s origin;
+    vec2s size;
+    vulkan_obj_placement(obj, &origin, &size);
+
+    *inst = (struct sprite_instance)
+    {
+        .pos = vulkan_obj_draw_pos(obj),
+        .offset = obj->offset,
+        .origin = origin,
+        .rot = obj->rot,
+        .size = size,
+        .scale = (obj->flags & RENDERABLE_SCALED_BIT) ? obj->scale : 1.0f,
+        .flip = (obj->flags & RENDERABLE_FLIPPED_BIT) ? -1.0f : 1.0f,
+        .shading = vulkan_obj_shading(obj),
+        .tex_offset = obj->tex_offset,
+        .tex_index = obj->tex,
+    };
+}
+
+/* Fill in an object for the GPU-driven object buffer */
+static void
+vulkan_gpu_renderable(struct gpu_renderable *g, struct renderable *obj)
+{
+    vec3s origin;
+    vec2s size;
+    vulkan_obj_placement(obj, &origin, &size);
 
-    // Put MVP in push constants
-    f32 flip_sign = -((f32)!!(obj->flags &
-        RENDERABLE_FLIPPED_BIT) * 2.0f - 1.0f);
-    mat4s m_m = (mat4s)GLMS_MAT4_IDENTITY_INIT;
+    // Same bounds as vulkan_check_should_cull_obj uses
+    vec2s b_min, b_max;
+    vulkan_obj_bounds(obj, &b_min, &b_max);
 
-    // Apply object position
-    m_m = glms_translate(m_m, (vec3s)
+    bool draw = !(obj->flags & RENDERABLE_HIDDEN_BIT);
+#ifndef NO_CULLING
+    bool cull = !(obj->flags & RENDERABLE_NO_CULL_BIT);
+#else
+    bool cull = false;
+#endif
+    *g = (struct gpu_renderable)
     {
-        obj->pos.x + obj->offset.x * flip_sign,
-        obj->pos.y - obj->offset.y,
-        0.0f
-    });
-    // Apply object scale
-    if (obj->flags & RENDERABLE_SCALED_BIT)
+        .pos = vulkan_obj_draw_pos(obj),
+        .offset = obj->offset,
+        .origin = origin,
+        .rot = obj->rot,
+        .size = size,
+        .scale = (obj->flags & RENDERABLE_SCALED_BIT) ? obj->scale : 1.0f,
+        .flip = (obj->flags & RENDERABLE_FLIPPED_BIT) ? -1.0f : 1.0f,
+        .shading = vulkan_obj_shading(obj),
+        .tex_offset = obj->tex_offset,
+        .tex_index = obj->tex,
+        .cull = cull,
+        .bounds_min = b_min,
+        .bounds_max = b_max,
+        .index_count = draw ? obj->ib.index_count : 0,
+        .first_index = obj->ib.first_index,
+        .vertex_offset = (i32)obj->vb.first_vertex,
+    };
+}
+
+/*
+ * Write this frame's objects in the default groups to the object buffer, and
+ * dispatch the compute pass that culls them into indirect draws
+ */
+static void
+vulkan_record_cull(
+    VkCommandBuffer cbuf,
+    struct renderer_obj_group *objgrps,
+    vec3s *cam_pos)
+{
+    PROFILE_ZONE("vulkan_record_cull");
+    static const enum shader_type groups[] =
     {
-        m_m = glms_scale(m_m, (vec3s)
+        SHADER_DEFAULT,
+        SHADER_DEFAULT_NO_ZBUFFER,
+    };
+    struct gpu_frame *f = &gpu_frames[cur_image_index];
+
+    u32 count = 0;
+    for (u32 g = 0; g < sizeof(groups) / sizeof(groups[0]); ++g)
+    {
+        const struct renderer_obj_group *grp = &objgrps[groups[g]];
+        // (Static objects are already recorded)
+        gpu_groups[groups[g]].first = count;
+        gpu_groups[groups[g]].count =
+            grp->obj_count - static_counts[groups[g]];
+        for (u32 o = static_counts[groups[g]]; o < grp->obj_count; ++o)
         {
-            obj->scale, obj->scale, 1.0f
-        });
+            vulkan_gpu_renderable(&f->objs[count++], &grp->objs[o]);
+        }
+    }
+    if (count == 0) return;
+
+    vkCmdBindPipeline(cbuf,
+        VK_PIPELINE_BIND_POINT_COMPUTE, g_cull_shader.pipeline);
+    vkCmdBindDescriptorSets(cbuf,
+        VK_PIPELINE_BIND_POINT_COMPUTE,
+        g_cull_shader.pipeline_layout,
+        0, 1,
+        &f->desc_set,
+        0, NULL);
+
+    // Same viewport as vulkan_check_should_cull_obj
+    struct push_constants_cull pconsts =
+    {
+        .view_min = (vec2s)
+        {{
+            cam_pos->x,
+            -cam_pos->y - HEIGHT_INTERNAL,
+        }},
+        .view_max = (vec2s)
+        {{
+            cam_pos->x + WIDTH_INTERNAL,
+            -cam_pos->y,
+        }},
+        .count = count,
+    };
+    vkCmdPushConstants(cbuf,
+        g_cull_shader.pipeline_layout,
+        VK_SHADER_STAGE_COMPUTE_BIT,
+        0,
+        g_cull_shader.pconst_size,
+        &pconsts);
+    vkCmdDispatch(cbuf, (count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1, 1);
+
+    // Draws have to be written before they're read
+    const VkMemoryBarrier barrier =
+    {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+        .srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT,
+        .dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+    };
+    vkCmdPipelineBarrier(cbuf,
+        VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+        VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT,
+        0,
+        1, &barrier,
+        0, NULL,
+        0, NULL);
+}
+
+/* Draw a whole group from the indirect draws written by the cull pass */
+static void
+vulkan_record_indirect(
+    VkCommandBuffer cbuf,
+    enum shader_type group,
+    enum shader_type shader_id)
+{
+    static const VkDeviceSize offset = 0;
+    struct shader *s = &g_shader_list[shader_id];
+    struct gpu_frame *f = &gpu_frames[cur_image_index];
+    if (gpu_groups[group].count == 0) return;
+
+    vkCmdBindPipeline(cbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, s->pipeline);
+
+    // Every object is in the geometry heap
+    VkBuffer vb = vb_heap_buffer(), ib = ib_heap_buffer();
+    if (vb != bound_vb)
+    {
+        vkCmdBindVertexBuffers(cbuf, 0, 1, &vb, &offset);
+        bound_vb = vb;
+    }
+    if (ib != bound_ib)
+    {
+        vkCmdBindIndexBuffer(cbuf, ib, 0, IB_VKTYPE);
+        bound_ib = ib;
     }
 
-    m_m.raw[0][0] *= flip_sign;
-    m_m.raw[1][1] *= -1.0f;
-    if (obj->rot != 0.0f)
+    const VkDescriptorSet sets[] =
+    {
+        g_vulkan->desc_sets[cur_image_index],
+        f->desc_set,
+    };
+    vkCmdBindDescriptorSets(cbuf,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        s->pipeline_layout,
+        0, 2,
+        sets,
+        0, NULL);
+
+    // Draw!
+    vkCmdDrawIndexedIndirect(cbuf,
+        f->draws_buf,
+        gpu_groups[group].first * sizeof(VkDrawIndexedIndirectCommand),
+        gpu_groups[group].count,
+        sizeof(VkDrawIndexedIndirectCommand));
+    ++draw_calls;
+}
+
+/* Draw a run of sprite instances, using the given object's quad geometry */
+static void
+vulkan_record_sprites(
+    VkCommandBuffer cbuf,
+    const struct renderable *quad,
+    u32 first,
+    u32 count)
+{
+    static const VkDeviceSize offset = 0;
+    struct shader *s = &g_shader_list[SHADER_SPRITE];
+
+    vkCmdBindPipeline(cbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, s->pipeline);
+
+    // Bind the quad, and this frame's instances
+    if (quad->vb.vk_buffer != bound_vb)
     {
-        // Apply object rotation
-        m_m = glms_rotate_z(m_m, glm_rad(obj->rot));
+        vkCmdBindVertexBuffers(cbuf, 0, 1, &quad->vb.vk_buffer, &offset);
+        bound_vb = quad->vb.vk_buffer;
     }
-    if (obj->flags & RENDERABLE_TEX_SCALE_BIT)
+    if (quad->ib.vk_buffer != bound_ib)
     {
-        // Scale the object by texture size
-        m_m = glms_scale(m_m, (vec3s)
-        {
-            (f32)g_vulkan->textures[obj->tex].w,
-            (f32)g_vulkan->textures[obj->tex].h,
-            1.0f,
-        });
+        vkCmdBindIndexBuffer(cbuf, quad->ib.vk_buffer, 0, IB_VKTYPE);
+        bound_ib = quad->ib.vk_buffer;
     }
-    mat4s m_v = (mat4s)GLMS_MAT4_IDENTITY_INIT;
+    vkCmdBindVertexBuffers(cbuf,
+        1,
+        1,
+        &sprite_frames[cur_image_index].vb.vk_buffer,
+        &offset);
+
+    vkCmdBindDescriptorSets(cbuf,
+        VK_PIPELINE_BIND_POINT_GRAPHICS,
+        s->pipeline_layout,
+        0, 1,
+        &g_vulkan->desc_sets[cur_image_index],
+        0, NULL);
+
+    // Draw!
+    vkCmdDrawIndexed(cbuf,
+        quad->ib.index_count,
+        count,
+        quad->ib.first_index,
+        quad->vb.first_vertex,
+        first);
+    ++draw_calls;
+}
+
+// Record to command buffer for a single object
+static void
+vulkan_record_obj_command_buffer(
+    VkCommandBuffer cbuf,
+    struct renderable *obj,
+    struct shader *s,
+    enum shader_type shader_id)
+{
+    static const VkDeviceSize offset = 0;
 
-    // Apply camera position
-    m_v = glms_translate(m_v,
-        (vec3s){ -cam_pos->x, -cam_pos->y, 0.0f });
+    // Bind vertex and index buffers (if not already)
+    if (obj->vb.vk_buffer != bound_vb)
+    {
+        vkCmdBindVertexBuffers(cbuf,
+            0,
+            1,
+            &obj->vb.vk_buffer,
+            &offset);
+        bound_vb = obj->vb.vk_buffer;
+    }
+    if (obj->ib.vk_buffer != bound_ib)
+    {
+        vkCmdBindIndexBuffer(cbuf,
+            obj->ib.vk_buffer,
+            0,
+            IB_VKTYPE);
+        bound_ib = obj->ib.vk_buffer;
+    }
 
-    // Projection matrix
-    mat4s m_p = glms_ortho(
-        0.0f, WIDTH_INTERNAL,
-        0.0f, HEIGHT_INTERNAL,
-        -225.0f, 225.0f);
+    // Put the object's transform in push constants; the view-projection is
+    // in the per-frame uniforms
+    struct transform_2d transform = vulkan_obj_transform(obj);
 
     // A bit dodgey but works
     size_t pconst_size = s->pconst_size;
     void *pconsts = alloca(pconst_size);
     if (shader_id == SHADER_DEFAULT || shader_id == SHADER_DEFAULT_NO_ZBUFFER)
     {
-        // Shading multiplier
-        f32 dim = (obj->flags & RENDERABLE_SHADED_BIT) ? 0.60f : 1.0f;
-        vec4s shading =
-            (obj->flags & RENDERABLE_EXTRA_SHADING_BIT)
-            ? obj->extra_shading
-            : GLMS_VEC4_ONE;
-        shading.x *= dim;
-        shading.y *= dim;
-        shading.z *= dim;
-
         struct push_constants p =
         {
-            .mvp = glms_mat4_mul(m_p, glms_mat4_mul(m_v, m_m)),
-            .shading = shading,
+            .transform = transform,
+            .shading = vulkan_obj_shading(obj),
             .tex_offset = obj->tex_offset,
             .tex_index = obj->tex,
         };
@@ -1350,7 +2387,15 @@ vulkan_record_obj_command_buffer(
     {
         struct push_constants_vl p =
         {
-            .mvp = glms_mat4_mul(m_p, glms_mat4_mul(m_v, m_m)),
+            .transform = transform,
+        };
+        memcpy(pconsts, &p, pconst_size);
+    }
+    else if (shader_id == SHADER_WORLD)
+    {
+        struct push_constants_world p =
+        {
+            .transform = transform,
         };
         memcpy(pconsts, &p, pconst_size);
     }
@@ -1358,7 +2403,7 @@ vulkan_record_obj_command_buffer(
     {
         struct push_constants_light p =
         {
-            .mvp = glms_mat4_mul(m_p, glms_mat4_mul(m_v, m_m)),
+            .transform = transform,
             .colour = obj->light_colour,
             .tex_index = obj->tex,
         };
@@ -1388,8 +2433,11 @@ vulkan_record_obj_command_buffer(
     // Draw!
     vkCmdDrawIndexed(cbuf,
         obj->ib.index_count,
-        1, 0, 0, 0);
-    ++g_state.draw_calls;
+        1,
+        obj->ib.first_index,
+        obj->vb.first_vertex,
+        0);
+    ++draw_calls;
 }
 
 /* Check whether object should be culled */
@@ -1418,42 +2466,22 @@ vulkan_check_should_cull_obj(struct renderable *o, vec3s *cam_pos)
             -cam_pos->y,
         }},
     };
-    struct bounds obj_bounds;
-    if (!(o->flags & RENDERABLE_TEX_SCALE_BIT))
-    {
-        obj_bounds = (struct bounds)
-        {
-            .min = (vec2s)
-            {{
-                o->pos.x + o->bounds.min.x,
-                -o->pos.y + o->bounds.min.y
-            }},
-            .max = (vec2s)
-            {{
-                o->pos.x + o->bounds.max.x,
-                -o->pos.y + o->bounds.max.y
-            }},
-        };
-    }
-    else
+    vec2s pos = vulkan_obj_draw_pos(o);
+    vec2s b_min, b_max;
+    vulkan_obj_bounds(o, &b_min, &b_max);
+    const struct bounds obj_bounds =
     {
-        // Using texture size as bounds
-        f32 tw = (f32)g_vulkan->textures[o->tex].w / 2.0f,
-            th = (f32)g_vulkan->textures[o->tex].h / 2.0f;
-        obj_bounds = (struct bounds)
-        {
-            .min = (vec2s)
-            {{
-                o->pos.x - tw,
-                -o->pos.y - tw
-            }},
-            .max = (vec2s)
-            {{
-                o->pos.x + tw,
-                -o->pos.y + th
-            }},
-        };
-    }
+        .min = (vec2s)
+        {{
+            pos.x + b_min.x,
+            -pos.y + b_min.y
+        }},
+        .max = (vec2s)
+        {{
+            pos.x + b_max.x,
+            -pos.y + b_max.y
+        }},
+    };
     bool in_aabb =
         obj_bounds.min.x < viewport_bounds.max.x &&
         obj_bounds.max.x > viewport_bounds.min.x &&
@@ -1507,8 +2535,11 @@ vulkan_render_frame_pre(void)
     /*
      * Wait for frame to finish
      */
-    vkWaitForFences(g_vulkan->d, 1,
-        &in_flight_fences[cur_frame], VK_TRUE, UINT64_MAX);
+    {
+        PROFILE_ZONE("wait_frame_fence");
+        vkWaitForFences(g_vulkan->d, 1,
+            &in_flight_fences[cur_frame], VK_TRUE, UINT64_MAX);
+    }
 
     /*
      * Acquire an image from the swap chain
@@ -1524,6 +2555,7 @@ vulkan_render_frame_pre(void)
     // (i.e. there's a fence to wait on)
     if (in_flight_images[cur_image_index] != VK_NULL_HANDLE)
     {
+        PROFILE_ZONE("wait_image_fence");
         vkWaitForFences(g_vulkan->d, 1,
             &in_flight_images[cur_image_index], VK_TRUE, UINT64_MAX);
     }
@@ -1532,6 +2564,18 @@ vulkan_render_frame_pre(void)
 
     vkResetFences(g_vulkan->d, 1, &in_flight_fences[cur_frame]);
 
+    // Geometry created since the last frame has to be on its way first
+    vulkan_flush_uploads(false);
+
+    // Bind any textures that have finished streaming in.  The image's
+    // previous frame is done, so its descriptor set is free to update
+    vulkan_texture_stream_update(false);
+    if (desc_sets_dirty & (1u << cur_image_index))
+    {
+        vulkan_write_texture_descriptors(cur_image_index);
+        desc_sets_dirty &= ~(1u << cur_image_index);
+    }
+
     // Update particles for this frame
     particles_update_frame(cur_image_index);
 
@@ -1588,9 +2632,12 @@ vulkan_render_frame(void)
         .pSwapchains = &swapchain->handle,
         .pImageIndices = &cur_image_index,
     };
-    vkQueuePresentKHR(
-        g_vulkan->qfams[VKQ_PRESENT].queue,
-        &present_info);
+    {
+        PROFILE_ZONE("present");
+        vkQueuePresentKHR(
+            g_vulkan->qfams[VKQ_PRESENT].queue,
+            &present_info);
+    }
 
     cur_frame = (cur_frame + 1) % MAX_FRAMES_IN_FLIGHT;
     return 0;
@@ -1694,13 +2741,23 @@ vulkan_create_descriptor_pool()
             .type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
             .descriptorCount = swapchain->image_count * 2,
         },
+        {
+            // GPU-driven objects and indirect draw commands
+            .type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .descriptorCount = swapchain->image_count * 2,
+        },
+        {
+            // Subpass 1: per-frame uniforms
+            .type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .descriptorCount = swapchain->image_count,
+        },
     };
     VkDescriptorPoolCreateInfo pool_info =
     {
         .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
         .poolSizeCount = sizeof(pool_sizes) / sizeof(VkDescriptorPoolSize),
         .pPoolSizes = pool_sizes,
-        .maxSets = swapchain->image_count * 2,
+        .maxSets = swapchain->image_count * 3,
     };
     if (vkCreateDescriptorPool(g_vulkan->d,
         &pool_info, NULL, &g_vulkan->desc_pool) != VK_SUCCESS)
@@ -1791,100 +2848,436 @@ vulkan_setup_textures(void)
         lightmap_h = swapchain->extent.height;
     for (i32 i = 0; i < swapchain->image_count; ++i)
     {
-        /*
-         * Create the "lightmap" textures
-         */
-        if (vulkan_texture_create(NULL,
-            lightmap_w,
-            lightmap_h, 0,
-            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
-            VK_FORMAT_R16G16B16A16_SFLOAT,
-            &g_vulkan->light_tex[i]) < 0)
+        /*
+         * Create the "lightmap" textures
+         */
+        if (vulkan_texture_create(NULL,
+            lightmap_w,
+            lightmap_h, 0,
+            VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+            VK_FORMAT_R16G16B16A16_SFLOAT,
+            &g_vulkan->light_tex[i]) < 0)
+        {
+            LOG_ERROR("[vulkan] failed to create lightmap texture");
+            return -1;
+        }
+
+        /*
+         * Create lightmap framebuffers
+         */
+        VkFramebufferCreateInfo fb_info =
+        {
+            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+            .renderPass = g_vulkan->light_render_pass,
+            .attachmentCount = 1,
+            .pAttachments = &g_vulkan->light_tex[i].view,
+            .width  = lightmap_w,
+            .height = lightmap_h,
+            .layers = 1,
+        };
+
+        if (vkCreateFramebuffer(g_vulkan->d, &fb_info, NULL,
+            &g_vulkan->light_framebufs[i]) != VK_SUCCESS)
+        {
+            LOG_ERROR("[vulkan] failed to lightmap framebuffer");
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+i32
+vulkan_create_buffer(
+    VkDeviceSize size,
+    VkBufferUsageFlags usage,
+    VmaMemoryUsage usage_vma,
+    VmaAllocationCreateFlagBits flags_vma,
+    VkMemoryPropertyFlags props,
+    VkBuffer *buffer,
+    VmaAllocation *allocation)
+{
+    const VkBufferCreateInfo buffer_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+    };
+
+    // Use VulkanMemoryAllocator to allocate for us
+    const VmaAllocationCreateInfo vma_alloc_info =
+    {
+        .usage = usage_vma,
+        .requiredFlags = props,
+        .flags = flags_vma,
+    };
+    if (vmaCreateBuffer(g_vulkan->vma,
+        &buffer_info,
+        &vma_alloc_info,
+        buffer,
+        allocation, NULL) != VK_SUCCESS)
+    {
+        LOG_ERROR("[vulkan] failed to create buffer");
+        return -1;
+    }
+
+    return 0;
+}
+
+i32
+vulkan_copy_buffer(VkBuffer a, VkBuffer b, size_t size)
+{
+    VkCommandBuffer cmdbuf;
+    if ((cmdbuf = vulkan_begin_oneshot_cmd()) == VK_NULL_HANDLE) return -1;
+
+    // Set buffers to copy
+    const VkBufferCopy copy_region =
+    {
+        .srcOffset = 0,
+        .dstOffset = 0,
+        .size = (VkDeviceSize)size,
+    };
+    vkCmdCopyBuffer(cmdbuf, a, b, 1, &copy_region);
+
+    if (vulkan_end_oneshot_cmd(cmdbuf) < 0) return -1;
+
+    return 0;
+}
+
+/*
+ * Create the staging arena for buffer uploads (or replace it with a bigger
+ * one), along with its command buffer and fence
+ */
+static i32
+vulkan_create_upload_staging(VkDeviceSize size)
+{
+    if (uploads.buf)
+    {
+        vmaUnmapMemory(g_vulkan->vma, uploads.alloc);
+        vmaDestroyBuffer(g_vulkan->vma, uploads.buf, uploads.alloc);
+        uploads.buf = VK_NULL_HANDLE;
+        uploads.data = NULL;
+    }
+
+    if (vulkan_create_buffer(
+        size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        &uploads.buf,
+        &uploads.alloc) < 0)
+    {
+        LOG_ERROR("[vulkan] failed to create upload staging buffer");
+        return -1;
+    }
+    vmaMapMemory(g_vulkan->vma, uploads.alloc, (void **)&uploads.data);
+    uploads.size = size;
+    uploads.used = 0;
+
+    if (uploads.cmdbuf) return 0;
+
+    const VkCommandBufferAllocateInfo alloc_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = g_vulkan->cmd_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    const VkFenceCreateInfo fence_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+    if (vkAllocateCommandBuffers(g_vulkan->d, &alloc_info,
+            &uploads.cmdbuf) != VK_SUCCESS ||
+        vkCreateFence(g_vulkan->d, &fence_info, NULL,
+            &uploads.fence) != VK_SUCCESS)
+    {
+        LOG_ERROR("[vulkan] failed to create upload command buffer");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Create a host-mapped sprite instance buffer for each swapchain image, big
+ * enough for every object in the no-Z-buffer group
+ */
+static i32
+vulkan_create_sprite_buffers(void)
+{
+    const size_t size = MAX_OBJECTS[SHADER_DEFAULT_NO_ZBUFFER] *
+        sizeof(struct sprite_instance);
+
+    sprite_frames =
+        calloc(swapchain->image_count, sizeof(struct sprite_frame));
+    for (u32 i = 0; i < swapchain->image_count; ++i)
+    {
+        if (vb_new_empty(&sprite_frames[i].vb, size, true) < 0)
+        {
+            LOG_ERROR("[vulkan] failed to create sprite instance buffer");
+            return -1;
+        }
+        vmaMapMemory(g_vulkan->vma,
+            sprite_frames[i].vb.vma_alloc,
+            (void **)&sprite_frames[i].instances);
+    }
+    return 0;
+}
+
+/*
+ * Create the per-frame uniform buffer for each swapchain image
+ */
+static i32
+vulkan_create_frame_uniforms(void)
+{
+    frame_ubos = calloc(swapchain->image_count, sizeof(struct frame_ubo));
+    for (u32 i = 0; i < swapchain->image_count; ++i)
+    {
+        // Written by the CPU every frame
+        if (vulkan_create_buffer(
+                sizeof(struct frame_uniforms),
+                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+                VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+                VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                &frame_ubos[i].buf,
+                &frame_ubos[i].alloc) < 0)
+        {
+            LOG_ERROR("[vulkan] failed to create per-frame uniform buffer");
+            return -1;
+        }
+        vmaMapMemory(g_vulkan->vma,
+            frame_ubos[i].alloc, (void **)&frame_ubos[i].data);
+    }
+    return 0;
+}
+
+/*
+ * Create the object and indirect draw buffers for each swapchain image (if
+ * drawing GPU-driven), and the descriptor sets pointing at them
+ */
+static i32
+vulkan_create_gpu_buffers(void)
+{
+    if (!g_vulkan->gpu_driven) return 0;
+
+    const VkDeviceSize objs_size =
+        GPU_OBJECT_COUNT * sizeof(struct gpu_renderable);
+    const VkDeviceSize draws_size =
+        GPU_OBJECT_COUNT * sizeof(VkDrawIndexedIndirectCommand);
+
+    gpu_frames = calloc(swapchain->image_count, sizeof(struct gpu_frame));
+    VkDescriptorSetLayout *layouts =
+        malloc(swapchain->image_count * sizeof(VkDescriptorSetLayout));
+    for (u32 i = 0; i < swapchain->image_count; ++i)
+    {
+        struct gpu_frame *f = &gpu_frames[i];
+        layouts[i] = g_vulkan->desc_set_layout_obj;
+
+        // Objects are written by the CPU every frame
+        if (vulkan_create_buffer(
+                objs_size,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+                VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                    VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                &f->objs_buf,
+                &f->objs_alloc) < 0 ||
+            vulkan_create_buffer(
+                draws_size,
+                VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                    VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+                0,
+                VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                &f->draws_buf,
+                &f->draws_alloc) < 0)
+        {
+            LOG_ERROR("[vulkan] failed to create GPU-driven object buffers");
+            free(layouts);
+            return -1;
+        }
+        vmaMapMemory(g_vulkan->vma, f->objs_alloc, (void **)&f->objs);
+    }
+
+    // Allocate descriptor sets
+    const VkDescriptorSetAllocateInfo alloc_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+        .descriptorPool = g_vulkan->desc_pool,
+        .descriptorSetCount = 1,
+        .pSetLayouts = layouts,
+    };
+    for (u32 i = 0; i < swapchain->image_count; ++i)
+    {
+        if (vkAllocateDescriptorSets(g_vulkan->d,
+            &alloc_info, &gpu_frames[i].desc_set) != VK_SUCCESS)
         {
-            LOG_ERROR("[vulkan] failed to create lightmap texture");
+            LOG_ERROR("[vulkan] failed to allocate object buffer "
+                "descriptor sets");
+            free(layouts);
             return -1;
         }
 
-        /*
-         * Create lightmap framebuffers
-         */
-        VkFramebufferCreateInfo fb_info =
+        const VkDescriptorBufferInfo buf_infos[] =
         {
-            .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
-            .renderPass = g_vulkan->light_render_pass,
-            .attachmentCount = 1,
-            .pAttachments = &g_vulkan->light_tex[i].view,
-            .width  = lightmap_w,
-            .height = lightmap_h,
-            .layers = 1,
+            { gpu_frames[i].objs_buf, 0, objs_size },
+            { gpu_frames[i].draws_buf, 0, draws_size },
         };
-
-        if (vkCreateFramebuffer(g_vulkan->d, &fb_info, NULL,
-            &g_vulkan->light_framebufs[i]) != VK_SUCCESS)
+        const VkWriteDescriptorSet writes[] =
         {
-            LOG_ERROR("[vulkan] failed to lightmap framebuffer");
-            return -1;
-        }
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = gpu_frames[i].desc_set,
+                .dstBinding = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = &buf_infos[0],
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstSet = gpu_frames[i].desc_set,
+                .dstBinding = 1,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = &buf_infos[1],
+            },
+        };
+        vkUpdateDescriptorSets(g_vulkan->d,
+            sizeof(writes) / sizeof(VkWriteDescriptorSet), writes, 0, NULL);
     }
+    free(layouts);
 
+    LOG_INFO("[vulkan] drawing GPU-driven");
     return 0;
 }
 
+/*
+ * Queue data to be copied into a device-local buffer at the given offset.
+ * The copy happens once the uploads are flushed
+ */
 i32
-vulkan_create_buffer(
-    VkDeviceSize size,
-    VkBufferUsageFlags usage,
-    VmaMemoryUsage usage_vma,
-    VmaAllocationCreateFlagBits flags_vma,
-    VkMemoryPropertyFlags props,
-    VkBuffer *buffer,
-    VmaAllocation *allocation)
+vulkan_upload_buffer(
+    VkBuffer dst,
+    VkDeviceSize dst_offset,
+    const void *src,
+    size_t size)
 {
-    const VkBufferCreateInfo buffer_info =
+    if (uploads.used + size > uploads.size)
     {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = size,
-        .usage = usage,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-    };
+        // Out of room, so submit what there is and start over
+        if (vulkan_flush_uploads(true) < 0) return -1;
+        if (size > uploads.size &&
+            vulkan_create_upload_staging(size) < 0)
+        {
+            return -1;
+        }
+    }
 
-    // Use VulkanMemoryAllocator to allocate for us
-    const VmaAllocationCreateInfo vma_alloc_info =
-    {
-        .usage = usage_vma,
-        .requiredFlags = props,
-        .flags = flags_vma,
-    };
-    if (vmaCreateBuffer(g_vulkan->vma,
-        &buffer_info,
-        &vma_alloc_info,
-        buffer,
-        allocation, NULL) != VK_SUCCESS)
+    if (!uploads.recording)
     {
-        LOG_ERROR("[vulkan] failed to create buffer");
-        return -1;
+        // The last batch may still be reading from the arena
+        if (uploads.in_flight)
+        {
+            vkWaitForFences(g_vulkan->d, 1,
+                &uploads.fence, VK_TRUE, UINT64_MAX);
+            vkResetFences(g_vulkan->d, 1, &uploads.fence);
+            uploads.in_flight = false;
+        }
+
+        static const VkCommandBufferBeginInfo begin_info =
+        {
+            .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+            .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+        };
+        if (vkBeginCommandBuffer(uploads.cmdbuf, &begin_info) != VK_SUCCESS)
+        {
+            LOG_ERROR("[vulkan] failed to begin recording command buffer");
+            return -1;
+        }
+        uploads.recording = true;
+        uploads.used = 0;
     }
 
+    memcpy(uploads.data + uploads.used, src, size);
+    const VkBufferCopy copy_region =
+    {
+        .srcOffset = uploads.used,
+        .dstOffset = dst_offset,
+        .size = (VkDeviceSize)size,
+    };
+    vkCmdCopyBuffer(uploads.cmdbuf, uploads.buf, dst, 1, &copy_region);
+
+    // Keep each region 16-byte aligned
+    uploads.used += (size + 15) & ~(VkDeviceSize)15;
     return 0;
 }
 
+/*
+ * Submit the queued buffer uploads.  If wait is set, also wait for them (and
+ * any earlier batch) to finish
+ */
 i32
-vulkan_copy_buffer(VkBuffer a, VkBuffer b, size_t size)
+vulkan_flush_uploads(bool wait)
 {
-    VkCommandBuffer cmdbuf;
-    if ((cmdbuf = vulkan_begin_oneshot_cmd()) == VK_NULL_HANDLE) return -1;
+    if (g_vulkan->headless) return 0;
 
-    // Set buffers to copy
-    const VkBufferCopy copy_region =
+    if (uploads.recording)
     {
-        .srcOffset = 0,
-        .dstOffset = 0,
-        .size = (VkDeviceSize)size,
-    };
-    vkCmdCopyBuffer(cmdbuf, a, b, 1, &copy_region);
+        uploads.recording = false;
 
-    if (vulkan_end_oneshot_cmd(cmdbuf) < 0) return -1;
+        // Later submissions read the buffers as vertices and indices
+        const VkMemoryBarrier barrier =
+        {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+            .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+            .dstAccessMask = VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT |
+                VK_ACCESS_INDEX_READ_BIT,
+        };
+        vkCmdPipelineBarrier(uploads.cmdbuf,
+            VK_PIPELINE_STAGE_TRANSFER_BIT,
+            VK_PIPELINE_STAGE_VERTEX_INPUT_BIT,
+            0,
+            1, &barrier,
+            0, NULL,
+            0, NULL);
+
+        if (vkEndCommandBuffer(uploads.cmdbuf) != VK_SUCCESS)
+        {
+            LOG_ERROR("[vulkan] failed to record command buffer");
+            return -1;
+        }
+
+        const VkSubmitInfo submit_info =
+        {
+            .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+            .commandBufferCount = 1,
+            .pCommandBuffers = &uploads.cmdbuf,
+        };
+        if (vkQueueSubmit(
+            g_vulkan->qfams[VKQ_GRAPHICS].queue,
+            1,
+            &submit_info,
+            uploads.fence) != VK_SUCCESS)
+        {
+            LOG_ERROR("[vulkan] failed to submit buffer uploads!");
+            return -1;
+        }
+        uploads.in_flight = true;
+    }
 
+    if (wait && uploads.in_flight)
+    {
+        PROFILE_ZONE("wait_buffer_uploads");
+        vkWaitForFences(g_vulkan->d, 1, &uploads.fence, VK_TRUE, UINT64_MAX);
+        vkResetFences(g_vulkan->d, 1, &uploads.fence);
+        uploads.in_flight = false;
+    }
     return 0;
 }
 
@@ -1990,14 +3383,18 @@ vulkan_copy_buffer_to_image(VkBuffer buffer, VkImage img, u32 w, u32 h)
     return 0;
 }
 
+/*
+ * Fill in a layout transition barrier for a whole colour image, along with
+ * the stages it sits between
+ */
 static i32
-transition_image_layout(VkImage img, VkFormat fmt,
-    VkImageLayout layout_old, VkImageLayout layout_new)
+image_layout_barrier(VkImage img,
+    VkImageLayout layout_old, VkImageLayout layout_new,
+    VkImageMemoryBarrier *barrier,
+    VkPipelineStageFlags *src_stage,
+    VkPipelineStageFlags *dst_stage)
 {
-    VkCommandBuffer cmdbuf;
-    if ((cmdbuf = vulkan_begin_oneshot_cmd()) == VK_NULL_HANDLE) return -1;
-
-    VkImageMemoryBarrier barrier =
+    *barrier = (VkImageMemoryBarrier)
     {
         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
         .oldLayout = layout_old,
@@ -2015,36 +3412,52 @@ transition_image_layout(VkImage img, VkFormat fmt,
         },
     };
 
-    VkPipelineStageFlags src_stage, dst_stage;
     // undefined --> transfer destination: transfer writes don't need to wait
     //                                     for anything
     if (layout_old == VK_IMAGE_LAYOUT_UNDEFINED &&
         layout_new == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL)
     {
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        src_stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-        dst_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        barrier->srcAccessMask = 0;
+        barrier->dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        *src_stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        *dst_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
     }
     else if (layout_old == VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL &&
         layout_new == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
     {
-        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        src_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
-        dst_stage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        barrier->srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier->dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        *src_stage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        *dst_stage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
     }
     else if (layout_old == VK_IMAGE_LAYOUT_UNDEFINED &&
         layout_new == VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
     {
-        barrier.srcAccessMask = 0;
-        barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-        src_stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
-        dst_stage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        barrier->srcAccessMask = 0;
+        barrier->dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+        *src_stage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        *dst_stage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
     }
     else
     {
         LOG_ERROR("[vulkan] unsupported layout transition");
+        return -1;
+    }
+    return 0;
+}
+
+static i32
+transition_image_layout(VkImage img, VkFormat fmt,
+    VkImageLayout layout_old, VkImageLayout layout_new)
+{
+    VkCommandBuffer cmdbuf;
+    if ((cmdbuf = vulkan_begin_oneshot_cmd()) == VK_NULL_HANDLE) return -1;
+
+    VkImageMemoryBarrier barrier;
+    VkPipelineStageFlags src_stage, dst_stage;
+    if (image_layout_barrier(img, layout_old, layout_new,
+        &barrier, &src_stage, &dst_stage) < 0)
+    {
         vulkan_end_oneshot_cmd(cmdbuf);
         return -1;
     }
@@ -2061,6 +3474,77 @@ transition_image_layout(VkImage img, VkFormat fmt,
     return 0;
 }
 
+/* Create the (uninitialised) image for a texture */
+static i32
+vulkan_texture_create_image(struct vulkan_texture *tex,
+    VkImageUsageFlags usage)
+{
+    const VkImageCreateInfo image_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .extent =
+        {
+            .width = tex->w,
+            .height = tex->h,
+            .depth = 1,
+        },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .format = tex->format,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .usage = VK_IMAGE_USAGE_SAMPLED_BIT | usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .flags = 0,
+    };
+    const VmaAllocationCreateInfo image_alloc_info =
+    {
+        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
+        .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+    };
+    if (vmaCreateImage(g_vulkan->vma,
+        &image_info,
+        &image_alloc_info,
+        &tex->image,
+        &tex->alloc, NULL) != VK_SUCCESS)
+    {
+        LOG_ERROR("[vulkan] failed to create image");
+        return -1;
+    }
+    return 0;
+}
+
+static i32
+vulkan_texture_create_view(struct vulkan_texture *tex)
+{
+    VkImageViewCreateInfo view_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = tex->image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = tex->format,
+        .subresourceRange =
+        {
+            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+            .baseMipLevel = 0,
+            .levelCount = 1,
+            .baseArrayLayer = 0,
+            .layerCount = 1,
+        },
+    };
+    if (vkCreateImageView(g_vulkan->d,
+        &view_info,
+        NULL,
+        &tex->view) != VK_SUCCESS)
+    {
+        LOG_ERROR("[vulkan] failed to create image view for texture");
+        return -1;
+    }
+    return 0;
+}
+
 static i32
 vulkan_texture_create(u8 *pixels, i32 w, i32 h,
     VkDeviceSize size,
@@ -2135,42 +3619,9 @@ vulkan_texture_create(u8 *pixels, i32 w, i32 h,
     vmaUnmapMemory(g_vulkan->vma, staging_buf_alloc);
     usage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
 
-skip_tex_transfer:
-
-    const VkImageCreateInfo image_info =
-    {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
-        .imageType = VK_IMAGE_TYPE_2D,
-        .extent =
-        {
-            .width = w,
-            .height = h,
-            .depth = 1,
-        },
-        .mipLevels = 1,
-        .arrayLayers = 1,
-        .format = tex->format,
-        .tiling = VK_IMAGE_TILING_OPTIMAL,
-        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED,
-        .usage = VK_IMAGE_USAGE_SAMPLED_BIT | usage,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
-        .samples = VK_SAMPLE_COUNT_1_BIT,
-        .flags = 0,
-    };
-    const VmaAllocationCreateInfo image_alloc_info =
-    {
-        .usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE,
-        .requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-    };
-    if (vmaCreateImage(g_vulkan->vma,
-        &image_info,
-        &image_alloc_info,
-        &tex->image,
-        &tex->alloc, NULL) != VK_SUCCESS)
-    {
-        LOG_ERROR("[vulkan] failed to create image");
-        goto fail;
-    }
+skip_tex_transfer:
+
+    if (vulkan_texture_create_image(tex, usage) < 0) goto fail;
 
     // Transition image layout, and copy buffer
     if (transfer)
@@ -2196,29 +3647,7 @@ skip_tex_transfer:
     }
 
     // Create imageview
-    VkImageViewCreateInfo view_info =
-    {
-        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
-        .image = tex->image,
-        .viewType = VK_IMAGE_VIEW_TYPE_2D,
-        .format = tex->format,
-        .subresourceRange =
-        {
-            .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
-            .baseMipLevel = 0,
-            .levelCount = 1,
-            .baseArrayLayer = 0,
-            .layerCount = 1,
-        },
-    };
-    if (vkCreateImageView(g_vulkan->d,
-        &view_info,
-        NULL,
-        &tex->view) != VK_SUCCESS)
-    {
-        LOG_ERROR("[vulkan] failed to create image view for texture");
-        goto fail;
-    }
+    if (vulkan_texture_create_view(tex) < 0) goto fail;
 
     // Re-write descriptors if needed
     if (g_vulkan->in_level)
@@ -2236,6 +3665,34 @@ fail:
     return -1;
 }
 
+/* Decode a streamed texture's pixels; run on a worker thread */
+static void
+vulkan_texture_decode_job(u32 index, void *user)
+{
+    PROFILE_ZONE("texture_decode");
+    struct vulkan_texture *tex = &g_vulkan->textures[index];
+
+    i32 w, h, ch;
+    stbi_uc *pixels = stbi_load(tex->name, &w, &h, &ch, STBI_rgb_alpha);
+    if (pixels && ((u32)w != tex->w || (u32)h != tex->h))
+    {
+        // File changed since its header was read
+        stbi_image_free(pixels);
+        pixels = NULL;
+    }
+    if (!pixels)
+    {
+        LOG_ERROR("[texture] failed to load texture '%s'", tex->name);
+        __atomic_store_n(&tex_stream[index].state,
+            TEXTURE_STREAM_NONE, __ATOMIC_RELEASE);
+        return;
+    }
+
+    tex_stream[index].pixels = pixels;
+    __atomic_store_n(&tex_stream[index].state,
+        TEXTURE_STREAM_DECODED, __ATOMIC_RELEASE);
+}
+
 i32
 vulkan_texture_load(const char *path)
 {
@@ -2265,31 +3722,47 @@ vulkan_texture_load(const char *path)
         }
     }
 
-    // Load texture data
-    i32 w, h, ch;
-    stbi_uc *pixels = stbi_load(path,
-        &w, &h, &ch, STBI_rgb_alpha);
-    VkDeviceSize size = w * h * 4;
-    if (!pixels)
-    {
-        LOG_ERROR("[texture] failed to load texture '%s'",
-            path);
-        return -1;
-    }
+    // Callers only need the size straight away, so read just the header
+    i32 tex_index = vulkan_texture_load_info(path);
+    if (tex_index < 0 || g_vulkan->headless) return tex_index;
 
-    //LOG_DBUG("[stb_image] loaded image '%s'", path);
+    // The pixels are decoded on a worker and uploaded later; until then the
+    // default texture is drawn in its place
+    g_vulkan->textures[tex_index].format = VK_FORMAT_R8G8B8A8_SRGB;
+    tex_stream[tex_index].state = TEXTURE_STREAM_DECODING;
+    jobs_async(vulkan_texture_decode_job, tex_index, NULL);
 
-    // Create texture
-    i32 status = vulkan_texture_create(pixels, w, h, size, 0, 0, NULL);
+    return tex_index;
+}
 
-    stbi_image_free(pixels);
+/*
+ * Register a texture by reading only its header.  The size is all that the
+ * rest of the game needs to know (and all there is on the null backend)
+ */
+static i32
+vulkan_texture_load_info(const char *path)
+{
+    if (g_vulkan->tex_used + 1 >= MAX_TEXTURES)
+    {
+        LOG_ERROR("[vulkan] texture capacity (%d) exceeded",
+            g_vulkan->tex_used);
+        return -1;
+    }
 
-    if (status > 0)
+    i32 w, h, ch;
+    if (!stbi_info(path, &w, &h, &ch))
     {
-        strcpy(g_vulkan->textures[status].name, path);
+        LOG_ERROR("[texture] failed to read texture '%s'", path);
+        return -1;
     }
 
-    return status;
+    i32 tex_index = g_vulkan->tex_used++;
+    struct vulkan_texture *tex = &g_vulkan->textures[tex_index];
+    memset(tex, 0, sizeof(struct vulkan_texture));
+    tex->w = w;
+    tex->h = h;
+    strcpy(tex->name, path);
+    return tex_index;
 }
 
 i32
@@ -2297,7 +3770,11 @@ vulkan_level_begin(void)
 {
     // Free up all the textures (except reserved)
     g_vulkan->in_level = false;
-    for (u32 i = RESERVED_TEXTURE_COUNT; i < g_vulkan->tex_used; ++i)
+    vulkan_renderer_wait_for_idle();
+    vulkan_texture_stream_drop();
+    for (u32 i = RESERVED_TEXTURE_COUNT;
+        !g_vulkan->headless && i < g_vulkan->tex_used;
+        ++i)
     {
         vkDestroyImageView(g_vulkan->d, g_vulkan->textures[i].view, NULL);
         vmaDestroyImage(g_vulkan->vma,
@@ -2306,13 +3783,45 @@ vulkan_level_begin(void)
     }
     g_vulkan->tex_used = RESERVED_TEXTURE_COUNT;
 
+    // The level's static objects are going away
+    memset(static_counts, 0, sizeof(static_counts));
+    statics_dirty = 0;
+    vulkan_free_static_lists();
+
     return 0;
 }
 
 i32
 vulkan_level_end(void)
 {
+    if (g_vulkan->headless)
+    {
+        g_vulkan->in_level = true;
+        return 0;
+    }
+
+    // Start the level with all geometry and textures resident
+    vulkan_flush_uploads(true);
+    vulkan_texture_stream_update(true);
+
     i32 status = vulkan_rewrite_descriptors();
+
+    // Static objects were all added before anything else in their group, so
+    // they can be recorded once (subpass 1 groups only)
+    for (u32 i = 0; i < SHADER_COUNT; ++i)
+    {
+        const struct renderer_obj_group *grp = &g_renderer.objgroups[i];
+        static_counts[i] = 0;
+        if (!vulkan_is_subpass1_group(i)) continue;
+        while (static_counts[i] < grp->obj_count &&
+            (grp->objs[static_counts[i]].flags & RENDERABLE_STATIC_BIT))
+        {
+            ++static_counts[i];
+        }
+    }
+    vulkan_build_static_lists();
+    statics_dirty = (1u << swapchain->image_count) - 1;
+
     g_vulkan->in_level = true;
     return status;
 }
@@ -2320,6 +3829,8 @@ vulkan_level_end(void)
 i32
 vulkan_update_sp2_descriptors(void)
 {
+    if (g_vulkan->headless) return 0;
+
     if (!g_vulkan->desc_sets_sp2)
     {
         // Create descriptor sets
@@ -2350,6 +3861,17 @@ vulkan_update_sp2_descriptors(void)
         free(layouts);
     }
 
+    // The overlay has to be resident before it can be bound
+    if (!g_vulkan->textures[g_vulkan->env_tex_index].view)
+    {
+        vulkan_texture_stream_update(true);
+    }
+    i32 env_tex_index = g_vulkan->env_tex_index;
+    if (!g_vulkan->textures[env_tex_index].view)
+    {
+        env_tex_index = TEXINDEX_DEFAULT;
+    }
+
     for (u32 i = 0; i < swapchain->image_count; ++i)
     {
         const VkDescriptorImageInfo
@@ -2368,7 +3890,7 @@ vulkan_update_sp2_descriptors(void)
         info_envtex =
         {
             .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
-            .imageView = g_vulkan->textures[g_vulkan->env_tex_index].view,
+            .imageView = g_vulkan->textures[env_tex_index].view,
             .sampler = g_vulkan->sampler,
         };
 
@@ -2412,8 +3934,9 @@ vulkan_update_sp2_descriptors(void)
     return 0;
 }
 
-static i32
-vulkan_rewrite_descriptors(void)
+/* Point each texture descriptor at its view, or the default texture */
+static void
+vulkan_fill_texture_infos(void)
 {
     if (!g_vulkan->image_desc_infos)
     {
@@ -2424,9 +3947,14 @@ vulkan_rewrite_descriptors(void)
     // Set all image infos
     for (u32 i = 0; i < MAX_TEXTURES; ++i)
     {
-        // Just reset the non-used infos to the default texture at index 0
+        // Just reset the non-used (or not yet resident) infos to the default
+        // texture at index 0
         i32 index = i;
-        if (index >= g_vulkan->tex_used) index = 0;
+        if (index >= g_vulkan->tex_used ||
+            !g_vulkan->textures[index].view)
+        {
+            index = TEXINDEX_DEFAULT;
+        }
 
         g_vulkan->image_desc_infos[i] = (VkDescriptorImageInfo)
         {
@@ -2435,38 +3963,350 @@ vulkan_rewrite_descriptors(void)
             .sampler = VK_NULL_HANDLE,
         };
     }
+}
+
+/* Update the descriptor set of one swapchain image */
+static void
+vulkan_write_texture_descriptors(u32 image)
+{
+    const VkDescriptorBufferInfo ubo_info =
+    {
+        frame_ubos[image].buf, 0, sizeof(struct frame_uniforms),
+    };
+    const VkWriteDescriptorSet set_writes[] =
+    {
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = g_vulkan->desc_sets[image],
+            .dstBinding = 0,
+            .dstArrayElement = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
+            .descriptorCount = 1,
+            .pImageInfo = &g_vulkan->sampler_desc_info,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = g_vulkan->desc_sets[image],
+            .dstBinding = 1,
+            .dstArrayElement = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
+            .descriptorCount = MAX_TEXTURES,
+            .pImageInfo = g_vulkan->image_desc_infos,
+        },
+        {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstSet = g_vulkan->desc_sets[image],
+            .dstBinding = 2,
+            .dstArrayElement = 0,
+            .descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER,
+            .descriptorCount = 1,
+            .pBufferInfo = &ubo_info,
+        },
+    };
+
+    vkUpdateDescriptorSets(g_vulkan->d,
+        sizeof(set_writes) / sizeof(VkWriteDescriptorSet),
+        set_writes,
+        0, NULL);
+
+    // Command buffers that used the old set are no longer valid
+    statics_dirty |= 1u << image;
+}
+
+static i32
+vulkan_rewrite_descriptors(void)
+{
+    vulkan_fill_texture_infos();
 
     // Update descriptor sets
     for (u32 i = 0; i < swapchain->image_count; ++i)
     {
-        const VkWriteDescriptorSet set_writes[] =
+        vulkan_write_texture_descriptors(i);
+    }
+    desc_sets_dirty = 0;
+    return 0;
+}
+
+/*
+ * Create the staging buffer that streamed textures are uploaded through (or
+ * replace it with a bigger one), along with its command buffer and fence
+ */
+static i32
+vulkan_create_texture_staging(VkDeviceSize size)
+{
+    if (staging.buf)
+    {
+        vmaUnmapMemory(g_vulkan->vma, staging.alloc);
+        vmaDestroyBuffer(g_vulkan->vma, staging.buf, staging.alloc);
+        staging.buf = VK_NULL_HANDLE;
+        staging.data = NULL;
+    }
+
+    if (vulkan_create_buffer(
+        size,
+        VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        VMA_MEMORY_USAGE_AUTO_PREFER_HOST,
+        VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT,
+        VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+            VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+        &staging.buf,
+        &staging.alloc) < 0)
+    {
+        LOG_ERROR("[vulkan] failed to create texture staging buffer");
+        return -1;
+    }
+    vmaMapMemory(g_vulkan->vma, staging.alloc, (void **)&staging.data);
+    staging.size = size;
+
+    if (staging.cmdbuf) return 0;
+
+    const VkCommandBufferAllocateInfo alloc_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = g_vulkan->cmd_pool,
+        .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+        .commandBufferCount = 1,
+    };
+    const VkFenceCreateInfo fence_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+    };
+    if (vkAllocateCommandBuffers(g_vulkan->d, &alloc_info,
+            &staging.cmdbuf) != VK_SUCCESS ||
+        vkCreateFence(g_vulkan->d, &fence_info, NULL,
+            &staging.fence) != VK_SUCCESS)
+    {
+        LOG_ERROR("[vulkan] failed to create texture upload command buffer");
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * Copy every decoded texture that fits into the staging buffer, and submit
+ * them as one batch
+ */
+static i32
+vulkan_texture_stream_submit(void)
+{
+    PROFILE_ZONE("texture_stream_submit");
+
+    VkDeviceSize offsets[MAX_TEXTURES];
+    VkDeviceSize offset = 0;
+    staging.batch_count = 0;
+    for (u32 i = RESERVED_TEXTURE_COUNT; i < g_vulkan->tex_used; ++i)
+    {
+        if (__atomic_load_n(&tex_stream[i].state, __ATOMIC_ACQUIRE) !=
+            TEXTURE_STREAM_DECODED)
         {
+            continue;
+        }
+
+        struct vulkan_texture *tex = &g_vulkan->textures[i];
+        VkDeviceSize size = (VkDeviceSize)tex->w * tex->h * 4;
+        if (offset + size > staging.size)
+        {
+            // Leave it for the next batch, unless it could never fit
+            if (offset) break;
+            if (vulkan_create_texture_staging(size) < 0) return -1;
+        }
+
+        if (vulkan_texture_create_image(tex,
+            VK_IMAGE_USAGE_TRANSFER_DST_BIT) < 0)
+        {
+            stbi_image_free(tex_stream[i].pixels);
+            tex_stream[i].pixels = NULL;
+            tex_stream[i].state = TEXTURE_STREAM_NONE;
+            continue;
+        }
+
+        memcpy(staging.data + offset, tex_stream[i].pixels, size);
+        stbi_image_free(tex_stream[i].pixels);
+        tex_stream[i].pixels = NULL;
+        tex_stream[i].state = TEXTURE_STREAM_UPLOADING;
+
+        offsets[staging.batch_count] = offset;
+        staging.batch[staging.batch_count++] = i;
+        offset += size;
+    }
+    if (!staging.batch_count) return 0;
+
+    static const VkCommandBufferBeginInfo begin_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+        .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT,
+    };
+    if (vkBeginCommandBuffer(staging.cmdbuf, &begin_info) != VK_SUCCESS)
+    {
+        LOG_ERROR("[vulkan] failed to begin recording command buffer");
+        goto fail;
+    }
+
+    // Every image in the batch goes through the same transitions, so each
+    // one is a single barrier command
+    VkImageMemoryBarrier barriers[MAX_TEXTURES];
+    VkPipelineStageFlags src_stage, dst_stage;
+    for (u32 b = 0; b < staging.batch_count; ++b)
+    {
+        image_layout_barrier(g_vulkan->textures[staging.batch[b]].image,
+            VK_IMAGE_LAYOUT_UNDEFINED,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            &barriers[b], &src_stage, &dst_stage);
+    }
+    vkCmdPipelineBarrier(staging.cmdbuf, src_stage, dst_stage, 0,
+        0, NULL, 0, NULL, staging.batch_count, barriers);
+
+    for (u32 b = 0; b < staging.batch_count; ++b)
+    {
+        struct vulkan_texture *tex = &g_vulkan->textures[staging.batch[b]];
+        const VkBufferImageCopy rgn =
+        {
+            // Tightly packed
+            .bufferOffset = offsets[b],
+            .bufferRowLength = 0,
+            .bufferImageHeight = 0,
+            .imageSubresource =
             {
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .dstSet = g_vulkan->desc_sets[i],
-                .dstBinding = 0,
-                .dstArrayElement = 0,
-                .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLER,
-                .descriptorCount = 1,
-                .pImageInfo = &g_vulkan->sampler_desc_info,
-            },
-            {
-                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
-                .dstSet = g_vulkan->desc_sets[i],
-                .dstBinding = 1,
-                .dstArrayElement = 0,
-                .descriptorType = VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE,
-                .descriptorCount = MAX_TEXTURES,
-                .pImageInfo = g_vulkan->image_desc_infos,
+                .aspectMask = VK_IMAGE_ASPECT_COLOR_BIT,
+                .mipLevel = 0,
+                .baseArrayLayer = 0,
+                .layerCount = 1,
             },
+            .imageOffset = { 0, 0, 0 },
+            .imageExtent = { tex->w, tex->h, 1 },
         };
+        vkCmdCopyBufferToImage(staging.cmdbuf,
+            staging.buf,
+            tex->image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            1,
+            &rgn);
+    }
 
-        vkUpdateDescriptorSets(g_vulkan->d,
-            sizeof(set_writes) / sizeof(VkWriteDescriptorSet),
-            set_writes,
-            0, NULL);
+    for (u32 b = 0; b < staging.batch_count; ++b)
+    {
+        image_layout_barrier(g_vulkan->textures[staging.batch[b]].image,
+            VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            &barriers[b], &src_stage, &dst_stage);
+    }
+    vkCmdPipelineBarrier(staging.cmdbuf, src_stage, dst_stage, 0,
+        0, NULL, 0, NULL, staging.batch_count, barriers);
+
+    if (vkEndCommandBuffer(staging.cmdbuf) != VK_SUCCESS)
+    {
+        LOG_ERROR("[vulkan] failed to record command buffer");
+        goto fail;
+    }
+
+    const VkSubmitInfo submit_info =
+    {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &staging.cmdbuf,
+    };
+    if (vkQueueSubmit(
+        g_vulkan->qfams[VKQ_GRAPHICS].queue,
+        1,
+        &submit_info,
+        staging.fence) != VK_SUCCESS)
+    {
+        LOG_ERROR("[vulkan] failed to submit texture upload command buffer!");
+        goto fail;
     }
+    staging.in_flight = true;
     return 0;
+
+fail:
+    // Throw the batch's images away, and decode the textures again to try
+    // them in a later batch (after a few tries they stay on the default
+    // texture)
+    for (u32 b = 0; b < staging.batch_count; ++b)
+    {
+        u32 i = staging.batch[b];
+        struct vulkan_texture *tex = &g_vulkan->textures[i];
+        vmaDestroyImage(g_vulkan->vma, tex->image, tex->alloc);
+        tex->image = VK_NULL_HANDLE;
+        tex->alloc = VK_NULL_HANDLE;
+
+        if (++tex_stream[i].retries > TEXTURE_STREAM_MAX_RETRIES)
+        {
+            LOG_ERROR("[texture] giving up on uploading '%s'", tex->name);
+            tex_stream[i].state = TEXTURE_STREAM_NONE;
+            continue;
+        }
+        tex_stream[i].state = TEXTURE_STREAM_DECODING;
+        jobs_async(vulkan_texture_decode_job, i, NULL);
+    }
+    staging.batch_count = 0;
+    return -1;
+}
+
+/*
+ * Make the textures of the batch on the GPU resident once it has finished.
+ * Doesn't block unless wait is set
+ */
+static void
+vulkan_texture_stream_finish(bool wait)
+{
+    if (!staging.in_flight) return;
+    if (wait)
+    {
+        PROFILE_ZONE("wait_texture_upload");
+        vkWaitForFences(g_vulkan->d, 1, &staging.fence, VK_TRUE, UINT64_MAX);
+    }
+    else if (vkGetFenceStatus(g_vulkan->d, staging.fence) != VK_SUCCESS)
+    {
+        return;
+    }
+    vkResetFences(g_vulkan->d, 1, &staging.fence);
+    staging.in_flight = false;
+
+    for (u32 b = 0; b < staging.batch_count; ++b)
+    {
+        u32 i = staging.batch[b];
+        vulkan_texture_create_view(&g_vulkan->textures[i]);
+        tex_stream[i].state = TEXTURE_STREAM_NONE;
+        tex_stream[i].retries = 0;
+    }
+    staging.batch_count = 0;
+
+    // Each swapchain image picks up the new views once it is free
+    vulkan_fill_texture_infos();
+    desc_sets_dirty = (1u << swapchain->image_count) - 1;
+}
+
+/*
+ * Move streamed textures along: finish the batch on the GPU and submit the
+ * next.  If wait is set, only returns once every texture loaded so far is
+ * resident
+ */
+static void
+vulkan_texture_stream_update(bool wait)
+{
+    if (g_vulkan->headless) return;
+    if (wait) jobs_wait();
+
+    do
+    {
+        vulkan_texture_stream_finish(wait);
+        if (!staging.in_flight) vulkan_texture_stream_submit();
+    } while (wait && staging.in_flight);
+}
+
+/* Stop streaming, and throw away anything not yet uploaded */
+static void
+vulkan_texture_stream_drop(void)
+{
+    jobs_wait();
+    vulkan_texture_stream_finish(true);
+    for (u32 i = 0; i < MAX_TEXTURES; ++i)
+    {
+        if (tex_stream[i].pixels) stbi_image_free(tex_stream[i].pixels);
+        tex_stream[i].pixels = NULL;
+        tex_stream[i].state = TEXTURE_STREAM_NONE;
+        tex_stream[i].retries = 0;
+    }
 }
 
 /* Create the depth buffer image */
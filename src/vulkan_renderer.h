@@ -72,6 +72,9 @@ struct vulkan_renderer
     VkCommandBuffer *cmd_buffers;
     u32 cmd_buffer_count;
 
+    // GPU-driven object buffer descriptors
+    VkDescriptorSetLayout desc_set_layout_obj;
+
     // Subpass 2 descriptors
     VkDescriptorSetLayout desc_set_layout_sp2;
     VkDescriptorSet *desc_sets_sp2;
@@ -106,6 +109,14 @@ struct vulkan_renderer
 
     // Index of the current environment overlay texture (e.g. rain, snow, etc.)
     i32 env_tex_index;
+
+    // Null backend; objects and texture info are kept but nothing is ever
+    // created on the GPU (used for running without a window)
+    bool headless;
+
+    // Cull the default groups in a compute pass and draw them with indirect
+    // draws, rather than recording a draw for each object
+    bool gpu_driven;
 };
 
 extern struct vulkan_renderer *g_vulkan;
@@ -124,6 +135,8 @@ i32 vulkan_create_buffer(VkDeviceSize,
 i32 vulkan_copy_buffer(VkBuffer, VkBuffer, size_t);
 i32 vulkan_copy_buffer_using_cmdbuffer(VkCommandBuffer, VkFence,
     VkBuffer, VkBuffer, size_t);
+i32 vulkan_upload_buffer(VkBuffer, VkDeviceSize, const void *, size_t);
+i32 vulkan_flush_uploads(bool);
 
 i32 vulkan_render_frame_pre(void);
 i32 vulkan_record_command_buffers(struct renderer_obj_group *, size_t, vec3s *);